@@ -0,0 +1,106 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+// 常驻线程池，线程只在构造时创建一次。
+// parallelFor把[0, n)按下标动态分给工作线程和调用线程，全部完成后才返回。
+// 同一时间只能有一个线程调用parallelFor。
+class ThreadPool
+{
+  public:
+    // num_threads包括调用线程，num_threads<=1时parallelFor直接串行执行
+    explicit ThreadPool(int num_threads) : job(nullptr), job_size(0), active(0), generation(0), stop(false)
+    {
+        next.store(0);
+        for (int i = 1; i < num_threads; i++)
+            workers.emplace_back(&ThreadPool::worker, this);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stop = true;
+        }
+        con_job.notify_all();
+        for (auto &t : workers)
+            t.join();
+    }
+
+    int size() const { return (int)workers.size() + 1; }
+
+    void parallelFor(int n, const std::function<void(int)> &func)
+    {
+        if (workers.empty() || n <= 1)
+        {
+            for (int i = 0; i < n; i++)
+                func(i);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m);
+            job = &func;
+            job_size = n;
+            next.store(0);
+            active = (int)workers.size();
+            generation++;
+        }
+        con_job.notify_all();
+        runJob();
+        std::unique_lock<std::mutex> lock(m);
+        con_done.wait(lock, [&] { return active == 0; });
+        job = nullptr;
+    }
+
+  private:
+    void runJob()
+    {
+        int i;
+        while ((i = next.fetch_add(1)) < job_size)
+            (*job)(i);
+    }
+
+    void worker()
+    {
+        size_t seen = 0;
+        while (1)
+        {
+            std::unique_lock<std::mutex> lock(m);
+            con_job.wait(lock, [&] { return stop || generation != seen; });
+            if (stop)
+                return;
+            seen = generation;
+            lock.unlock();
+
+            runJob();
+
+            lock.lock();
+            if (--active == 0)
+                con_done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex m;
+    std::condition_variable con_job, con_done;
+    const std::function<void(int)> *job;
+    int job_size;
+    std::atomic<int> next;
+    int active;//还没做完当前任务的工作线程数
+    size_t generation;
+    bool stop;
+};
@@ -0,0 +1,81 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <cmath>
+#include "brief_matcher.h"
+#include "parameters.h"
+
+ThreadPool &BriefMatcher::threadPool()
+{
+    static ThreadPool pool(MATCH_THREADS);
+    return pool;
+}
+
+void BriefMatcher::match(const PackedDescriptors &query, const PackedDescriptors &train,
+                         const std::vector<cv::KeyPoint> &train_norm, const std::vector<cv::Point2f> *prior,
+                         std::vector<int> &best) const
+{
+    const int n = query.size();
+    best.assign(n, -1);
+    if (radius <= 0.f)
+        prior = NULL;
+    auto func = [&](int i) {
+        best[i] = matchOne(query[i], train, train_norm, prior ? &(*prior)[i] : NULL);
+    };
+    // 点少的时候分给线程池反而慢
+    if ((long)n * train.size() < 20000)
+    {
+        for (int i = 0; i < n; i++)
+            func(i);
+    }
+    else
+        threadPool().parallelFor(n, func);
+}
+
+int BriefMatcher::matchOne(const uint64_t *q, const PackedDescriptors &train,
+                           const std::vector<cv::KeyPoint> &train_norm, const cv::Point2f *prior) const
+{
+    const bool use_prior = prior != NULL && !std::isnan(prior->x);
+    const bool use_ratio = ratio < 1.f;
+    const float radius2 = radius * radius;
+    int best_dist = PackedDescriptors::BITS / 2;
+    int second_dist = PackedDescriptors::BITS / 2;
+    int best_index = -1;
+    const int m = train.size();
+    for (int j = 0; j < m; j++)
+    {
+        if (use_prior)
+        {
+            float dx = train_norm[j].pt.x - prior->x;
+            float dy = train_norm[j].pt.y - prior->y;
+            if (dx * dx + dy * dy > radius2)
+                continue;
+        }
+        const uint64_t *t = train[j];
+        // 前128位已经不比当前门限好就跳过后半部分
+        const int bound = use_ratio ? second_dist : best_dist;
+        int dist = popcount64(q[0] ^ t[0]) + popcount64(q[1] ^ t[1]);
+        if (dist >= bound)
+            continue;
+        dist += popcount64(q[2] ^ t[2]) + popcount64(q[3] ^ t[3]);
+        if (dist < best_dist)
+        {
+            second_dist = best_dist;
+            best_dist = dist;
+            best_index = j;
+        }
+        else if (dist < second_dist)
+            second_dist = dist;
+    }
+    if (best_index == -1 || best_dist >= max_distance)
+        return -1;
+    if (use_ratio && best_dist >= ratio * second_dist)
+        return -1;
+    return best_index;
+}
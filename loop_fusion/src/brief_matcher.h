@@ -0,0 +1,43 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "packed_descriptors.h"
+#include "vins_common/thread_pool.h"
+
+// 打包描述子上的暴力匹配。
+// 对query里的每个描述子在train里找汉明距离最小的，距离要小于max_distance；
+// ratio < 1时还要求最近距离 < ratio * 次近距离；
+// radius > 0且给了预测位置时，只在train里离预测位置(归一化坐标)不超过radius的点中找。
+class BriefMatcher
+{
+  public:
+    BriefMatcher(int _max_distance = 80, float _ratio = 1.f, float _radius = 0.f)
+        : max_distance(_max_distance), ratio(_ratio), radius(_radius) {}
+
+    // best[i]为query第i个描述子匹配到的train下标，没有匹配为-1。
+    // prior为空时不做空间预筛选，prior里x为NaN的点也不筛选
+    void match(const PackedDescriptors &query, const PackedDescriptors &train,
+               const std::vector<cv::KeyPoint> &train_norm, const std::vector<cv::Point2f> *prior,
+               std::vector<int> &best) const;
+
+    // 只在位姿图处理线程里用
+    static ThreadPool &threadPool();
+
+  private:
+    int matchOne(const uint64_t *q, const PackedDescriptors &train,
+                 const std::vector<cv::KeyPoint> &train_norm, const cv::Point2f *prior) const;
+
+    int max_distance;
+    float ratio;
+    float radius;
+};
@@ -0,0 +1,61 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "brief_service.h"
+
+BriefService::BriefService(int num_threads) : stop(false)
+{
+    // 在启动线程前加载pattern，避免第一个关键帧在工作线程里读文件
+    BriefExtractor::instance();
+    if (num_threads < 1)
+        num_threads = 1;
+    for (int i = 0; i < num_threads; i++)
+        workers.emplace_back(&BriefService::worker, this);
+}
+
+BriefService::~BriefService()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_task);
+        stop = true;
+    }
+    con_task.notify_all();
+    for (auto &t : workers)
+        t.join();
+}
+
+std::future<KeyFrame *> BriefService::submit(KeyFrame *keyframe)
+{
+    Task task;
+    task.keyframe = keyframe;
+    std::future<KeyFrame *> result = task.done.get_future();
+    {
+        std::lock_guard<std::mutex> lock(m_task);
+        tasks.push(std::move(task));
+    }
+    con_task.notify_one();
+    return result;
+}
+
+void BriefService::worker()
+{
+    while (1)
+    {
+        std::unique_lock<std::mutex> lock(m_task);
+        con_task.wait(lock, [&] { return stop || !tasks.empty(); });
+        if (tasks.empty())
+            return;
+        Task task = std::move(tasks.front());
+        tasks.pop();
+        lock.unlock();
+
+        task.keyframe->computeBRIEF();
+        task.done.set_value(task.keyframe);
+    }
+}
@@ -0,0 +1,46 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <queue>
+#include <vector>
+#include <future>
+#include <condition_variable>
+#include "keyframe.h"
+
+// 关键帧描述子提取服务。
+// 用_compute_brief = false构造的关键帧交给submit，在工作线程里调用computeBRIEF，
+// 返回的future在描述子算完后就绪，调用方按提交顺序取出再addKeyFrame。
+// 所有线程共用BriefExtractor::instance()，pattern只读一次
+class BriefService
+{
+  public:
+    explicit BriefService(int num_threads);
+    ~BriefService();
+
+    std::future<KeyFrame *> submit(KeyFrame *keyframe);
+
+  private:
+    struct Task
+    {
+        KeyFrame *keyframe;
+        std::promise<KeyFrame *> done;
+    };
+
+    void worker();
+
+    std::vector<std::thread> workers;
+    std::queue<Task> tasks;
+    std::mutex m_task;
+    std::condition_variable con_task;
+    bool stop;
+};
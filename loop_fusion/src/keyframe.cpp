@@ -24,7 +24,7 @@ static void reduceVector(vector<Derived> &v, vector<uchar> status)//重新调整
 // create keyframe online
 KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3d &_vio_R_w_i, cv::Mat &_image,
 		           vector<cv::Point3f> &_point_3d, vector<cv::Point2f> &_point_2d_uv, vector<cv::Point2f> &_point_2d_norm,
-		           vector<double> &_point_id, int _sequence)
+		           vector<double> &_point_id, int _sequence, bool _compute_brief)
 {
 	time_stamp = _time_stamp;
 	index = _index;
@@ -45,16 +45,15 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 	has_fast_point = false;
 	loop_info << 0, 0, 0, 0, 0, 0, 0, 0;
 	sequence = _sequence;
-	computeWindowBRIEFPoint();//对滑窗里的对滑窗里的关键帧计算描述子
-    computeBRIEFPoint();//再计算fast特征点，并计算描述子
-	if(!DEBUG_IMAGE)
-		image.release();
+	//_compute_brief为false时由BriefService在工作线程里调用computeBRIEF
+	if (_compute_brief)
+		computeBRIEF();
 }
 
 // load previous keyframe
 KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3d &_vio_R_w_i, Vector3d &_T_w_i, Matrix3d &_R_w_i,
 					cv::Mat &_image, int _loop_index, Eigen::Matrix<double, 8, 1 > &_loop_info,
-					vector<cv::KeyPoint> &_keypoints, vector<cv::KeyPoint> &_keypoints_norm, vector<BRIEF::bitset> &_brief_descriptors)
+					vector<cv::KeyPoint> &_keypoints, vector<cv::KeyPoint> &_keypoints_norm, const uint64_t *_packed_descriptors)
 {
 	time_stamp = _time_stamp;
 	index = _index;
@@ -79,7 +78,8 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 	sequence = 0;
 	keypoints = _keypoints;
 	keypoints_norm = _keypoints_norm;
-	brief_descriptors = _brief_descriptors;
+	//描述子直接拷贝打包好的，brief_descriptors只在加入DBoW时临时生成
+	packed_descriptors.assign(_packed_descriptors, keypoints.size());
 }
 //uisee
 KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3d &_vio_R_w_i,int _loop_index)
@@ -138,21 +138,21 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 //    if(!DEBUG_IMAGE)
 //        image.release();
 //}
-void KeyFrame::computeWindowBRIEFPoint()
+// 先对滑窗里的点计算描述子，再提取fast特征点并计算描述子，两组点共用一次高斯平滑
+void KeyFrame::computeBRIEF()
 {
-	BriefExtractor extractor(BRIEF_PATTERN_FILE.c_str());
+	const BriefExtractor &extractor = BriefExtractor::instance();
+	cv::Mat smoothed;
+	BriefExtractor::smooth(image, smoothed);
+
 	for(int i = 0; i < (int)point_2d_uv.size(); i++)
 	{
 	    cv::KeyPoint key;
 	    key.pt = point_2d_uv[i];
 	    window_keypoints.push_back(key);
 	}
-	extractor(image, window_keypoints, window_brief_descriptors);
-}
+	extractor.computeSmoothed(smoothed, window_keypoints, window_brief_descriptors);
 
-void KeyFrame::computeBRIEFPoint()
-{
-	BriefExtractor extractor(BRIEF_PATTERN_FILE.c_str());
 	const int fast_th = 20; // corner detector response threshold
 	if(1)
 		cv::FAST(image, keypoints, fast_th, true);
@@ -167,7 +167,10 @@ void KeyFrame::computeBRIEFPoint()
 		    keypoints.push_back(key);
 		}
 	}
-	extractor(image, keypoints, brief_descriptors);
+	extractor.computeSmoothed(smoothed, keypoints, brief_descriptors);
+	packed_window_descriptors.assign(window_brief_descriptors);
+	packed_descriptors.assign(brief_descriptors);
+	keypoints_norm.reserve(keypoints.size());
 	for (int i = 0; i < (int)keypoints.size(); i++)
 	{
 		Eigen::Vector3d tmp_p;
@@ -176,6 +179,8 @@ void KeyFrame::computeBRIEFPoint()
 		tmp_norm.pt = cv::Point2f(tmp_p.x()/tmp_p.z(), tmp_p.y()/tmp_p.z());
 		keypoints_norm.push_back(tmp_norm);
 	}
+	if(!DEBUG_IMAGE)
+		image.release();
 }
 
 void BriefExtractor::operator() (const cv::Mat &im, vector<cv::KeyPoint> &keys, vector<BRIEF::bitset> &descriptors) const
@@ -183,57 +188,73 @@ void BriefExtractor::operator() (const cv::Mat &im, vector<cv::KeyPoint> &keys,
   m_brief.compute(im, keys, descriptors);
 }
 
+void BriefExtractor::computeSmoothed(const cv::Mat &smoothed, const vector<cv::KeyPoint> &keys, vector<BRIEF::bitset> &descriptors) const
+{
+  m_brief.compute(smoothed, keys, descriptors, false);
+}
 
-bool KeyFrame::searchInAera(const BRIEF::bitset window_descriptor,
-                            const std::vector<BRIEF::bitset> &descriptors_old,
-                            const std::vector<cv::KeyPoint> &keypoints_old,
-                            const std::vector<cv::KeyPoint> &keypoints_old_norm,
-                            cv::Point2f &best_match,
-                            cv::Point2f &best_match_norm)
+// 和DVision::BRIEF::compute里的预处理一致
+void BriefExtractor::smooth(const cv::Mat &im, cv::Mat &smoothed)
 {
-    cv::Point2f best_pt;
-    int bestDist = 128;
-    int bestIndex = -1;
-    for(int i = 0; i < (int)descriptors_old.size(); i++)
-    {
+  cv::GaussianBlur(im, smoothed, cv::Size(9, 9), 2, 2);
+}
 
-        int dis = HammingDis(window_descriptor, descriptors_old[i]);
-        if(dis < bestDist)
-        {
-            bestDist = dis;
-            bestIndex = i;
-        }
-    }
-    //printf("best dist %d", bestDist);
-    if (bestIndex != -1 && bestDist < 80)
-    {
-      best_match = keypoints_old[bestIndex].pt;
-      best_match_norm = keypoints_old_norm[bestIndex].pt;
-      return true;
-    }
-    else
-      return false;
+const BriefExtractor &BriefExtractor::instance()
+{
+  static const BriefExtractor extractor(BRIEF_PATTERN_FILE);
+  return extractor;
+}
+
+
+// 用VIO位姿把滑窗点投到回环帧的归一化平面上，作为匹配时的预测位置
+void KeyFrame::predictInOldFrame(KeyFrame* old_kf, std::vector<cv::Point2f> &prior)
+{
+	//point_3d在当前帧原始的VIO坐标系(origin_vio)下，vio_T_w_i已经换到了位姿图的base坐标系，先把回环帧位姿换回原始VIO坐标系
+	Matrix3d R_rb = origin_vio_R * vio_R_w_i.transpose();
+	Vector3d t_rb = origin_vio_T - R_rb * vio_T_w_i;
+	Vector3d old_T;
+	Matrix3d old_R;
+	old_kf->getVioPose(old_T, old_R);
+	Matrix3d R_w_c = R_rb * old_R * qic;
+	Vector3d T_w_c = R_rb * (old_T + old_R * tic) + t_rb;
+	prior.resize(point_3d.size());
+	for (int i = 0; i < (int)point_3d.size(); i++)
+	{
+		Vector3d p_c = R_w_c.transpose() * (Vector3d(point_3d[i].x, point_3d[i].y, point_3d[i].z) - T_w_c);
+		if (p_c.z() > 0)
+			prior[i] = cv::Point2f(p_c.x() / p_c.z(), p_c.y() / p_c.z());
+		else
+			prior[i] = cv::Point2f(NAN, NAN);
+	}
 }
 
 void KeyFrame::searchByBRIEFDes(std::vector<cv::Point2f> &matched_2d_old,
 								std::vector<cv::Point2f> &matched_2d_old_norm,
                                 std::vector<uchar> &status,
-                                const std::vector<BRIEF::bitset> &descriptors_old,
+                                const PackedDescriptors &descriptors_old,
                                 const std::vector<cv::KeyPoint> &keypoints_old,
-                                const std::vector<cv::KeyPoint> &keypoints_old_norm)
+                                const std::vector<cv::KeyPoint> &keypoints_old_norm,
+                                const std::vector<cv::Point2f> *prior)
 {
-    for(int i = 0; i < (int)window_brief_descriptors.size(); i++)
+    double FOCAL_LENGTH = 460.0;
+    BriefMatcher matcher(80, LOOP_MATCH_RATIO, LOOP_SEARCH_RADIUS / FOCAL_LENGTH);
+    vector<int> best;
+    matcher.match(packed_window_descriptors, descriptors_old, keypoints_old_norm, prior, best);
+    for(int i = 0; i < (int)best.size(); i++)
     {
-        cv::Point2f pt(0.f, 0.f);
-        cv::Point2f pt_norm(0.f, 0.f);
-        if (searchInAera(window_brief_descriptors[i], descriptors_old, keypoints_old, keypoints_old_norm, pt, pt_norm))
-          status.push_back(1);
+        if (best[i] != -1)
+        {
+            status.push_back(1);
+            matched_2d_old.push_back(keypoints_old[best[i]].pt);
+            matched_2d_old_norm.push_back(keypoints_old_norm[best[i]].pt);
+        }
         else
-          status.push_back(0);
-        matched_2d_old.push_back(pt);
-        matched_2d_old_norm.push_back(pt_norm);
+        {
+            status.push_back(0);
+            matched_2d_old.push_back(cv::Point2f(0.f, 0.f));
+            matched_2d_old_norm.push_back(cv::Point2f(0.f, 0.f));
+        }
     }
-
 }
 
 
@@ -366,7 +387,13 @@ bool KeyFrame::findConnection(KeyFrame* old_kf)
 	//printf("search by des\n");
 	//需要注意的是FAST点和第一类点是通过不同方式检测出来的点，它们往往是不重合的。所以searchByBRIEFDes的时候效果应该不会特别好吧。如果想优化这部分的，可以在这方面动动脑筋。
 	//使用了 当前帧的window_brief_descriptors和过去帧的特征
-	searchByBRIEFDes(matched_2d_old, matched_2d_old_norm, status, old_kf->brief_descriptors, old_kf->keypoints, old_kf->keypoints_norm);
+	//配置了loop_search_radius时，同一序列里只在VIO位姿预测的位置附近找匹配
+	vector<cv::Point2f> prior;
+	bool use_prior = LOOP_SEARCH_RADIUS > 0 && old_kf->sequence == sequence;
+	if (use_prior)
+		predictInOldFrame(old_kf, prior);
+	searchByBRIEFDes(matched_2d_old, matched_2d_old_norm, status, old_kf->packed_descriptors, old_kf->keypoints, old_kf->keypoints_norm,
+	                 use_prior ? &prior : NULL);
 	reduceVector(matched_2d_cur, status);//重新调整大小
 	reduceVector(matched_2d_old, status);
 	reduceVector(matched_2d_cur_norm, status);
@@ -563,14 +590,6 @@ bool KeyFrame::findConnection(KeyFrame* old_kf)
 	return false;
 }
 
-
-int KeyFrame::HammingDis(const BRIEF::bitset &a, const BRIEF::bitset &b)
-{
-    BRIEF::bitset xor_of_bitset = a ^ b;
-    int dis = xor_of_bitset.count();
-    return dis;
-}
-
 void KeyFrame::getVioPose(Eigen::Vector3d &_T_w_i, Eigen::Matrix3d &_R_w_i)
 {
     _T_w_i = vio_T_w_i;
@@ -24,6 +24,7 @@
 //#include "./parameters/parameters.h"
 #include "ThirdParty/DBoW/DBoW2.h"
 #include "ThirdParty/DVision/DVision.h"
+#include "brief_matcher.h"
 
 #define MIN_LOOP_NUM 25
 
@@ -36,7 +37,12 @@ class BriefExtractor
 {
 public:
   virtual void operator()(const cv::Mat &im, vector<cv::KeyPoint> &keys, vector<BRIEF::bitset> &descriptors) const;
+  // smoothed必须是smooth()的结果，同一张图上的多组点共用一次平滑
+  void computeSmoothed(const cv::Mat &smoothed, const vector<cv::KeyPoint> &keys, vector<BRIEF::bitset> &descriptors) const;
+  static void smooth(const cv::Mat &im, cv::Mat &smoothed);
   BriefExtractor(const std::string &pattern_file);
+  // 全进程共用一个，第一次调用时从BRIEF_PATTERN_FILE读pattern
+  static const BriefExtractor &instance();
 
   DVision::BRIEF m_brief;
 };
@@ -46,29 +52,23 @@ class KeyFrame
 public:
 	KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3d &_vio_R_w_i, cv::Mat &_image,
 			 vector<cv::Point3f> &_point_3d, vector<cv::Point2f> &_point_2d_uv, vector<cv::Point2f> &_point_2d_normal, 
-			 vector<double> &_point_id, int _sequence);
+			 vector<double> &_point_id, int _sequence, bool _compute_brief = true);
 	KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3d &_vio_R_w_i, Vector3d &_T_w_i, Matrix3d &_R_w_i,
 			 cv::Mat &_image, int _loop_index, Eigen::Matrix<double, 8, 1 > &_loop_info,
-			 vector<cv::KeyPoint> &_keypoints, vector<cv::KeyPoint> &_keypoints_norm, vector<BRIEF::bitset> &_brief_descriptors);
+			 vector<cv::KeyPoint> &_keypoints, vector<cv::KeyPoint> &_keypoints_norm, const uint64_t *_packed_descriptors);
     KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3d &_vio_R_w_i,int _loop_index);//uisee
     KeyFrame(double _time_stamp, int _index,  cv::Mat &_image,int _sequence);//uisee
 	bool findConnection(KeyFrame* old_kf);
-	void computeWindowBRIEFPoint();
-	void computeBRIEFPoint();
+	void computeBRIEF();
 	//void extractBrief();
-	int HammingDis(const BRIEF::bitset &a, const BRIEF::bitset &b);
-	bool searchInAera(const BRIEF::bitset window_descriptor,
-	                  const std::vector<BRIEF::bitset> &descriptors_old,
-	                  const std::vector<cv::KeyPoint> &keypoints_old,
-	                  const std::vector<cv::KeyPoint> &keypoints_old_norm,
-	                  cv::Point2f &best_match,
-	                  cv::Point2f &best_match_norm);
+	void predictInOldFrame(KeyFrame* old_kf, std::vector<cv::Point2f> &prior);
 	void searchByBRIEFDes(std::vector<cv::Point2f> &matched_2d_old,
 						  std::vector<cv::Point2f> &matched_2d_old_norm,
                           std::vector<uchar> &status,
-                          const std::vector<BRIEF::bitset> &descriptors_old,
+                          const PackedDescriptors &descriptors_old,
                           const std::vector<cv::KeyPoint> &keypoints_old,
-                          const std::vector<cv::KeyPoint> &keypoints_old_norm);
+                          const std::vector<cv::KeyPoint> &keypoints_old_norm,
+                          const std::vector<cv::Point2f> *prior);
 	void FundmantalMatrixRANSAC(const std::vector<cv::Point2f> &matched_2d_cur_norm,
                                 const std::vector<cv::Point2f> &matched_2d_old_norm,
                                 vector<uchar> &status);
@@ -108,6 +108,8 @@ public:
 	vector<cv::KeyPoint> window_keypoints;
 	vector<BRIEF::bitset> brief_descriptors;
 	vector<BRIEF::bitset> window_brief_descriptors;
+	PackedDescriptors packed_descriptors;//brief_descriptors打包后的副本，用于匹配
+	PackedDescriptors packed_window_descriptors;
 	bool has_fast_point;
 	int sequence;
 
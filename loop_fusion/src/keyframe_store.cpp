@@ -0,0 +1,43 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "keyframe_store.h"
+#include <cassert>
+#include <cstdio>
+
+KeyFrameStore::KeyFrameStore()
+    : num(0)
+{
+    for (int i = 0; i < MAX_CHUNKS; i++)
+        chunks[i] = NULL;
+}
+
+KeyFrameStore::~KeyFrameStore()
+{
+    for (int i = 0; i < MAX_CHUNKS; i++)
+        delete[] chunks[i];
+}
+
+void KeyFrameStore::add(KeyFrame *keyframe)
+{
+    std::lock_guard<std::mutex> lock(m_add);
+    int index = num.load(std::memory_order_relaxed);
+    int chunk = index >> CHUNK_BITS;
+    if (chunk >= MAX_CHUNKS)
+    {
+        printf("keyframe store is full, drop keyframe %d\n", keyframe->index);
+        return;
+    }
+    assert(keyframe->index == index);
+    if (chunks[chunk] == NULL)
+        chunks[chunk] = new KeyFrame *[CHUNK_SIZE];
+    chunks[chunk][index & (CHUNK_SIZE - 1)] = keyframe;
+    // 先写好指针再发布size，读线程看到新的size时一定能看到这个指针
+    num.store(index + 1, std::memory_order_release);
+}
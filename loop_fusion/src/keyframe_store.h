@@ -0,0 +1,48 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include "keyframe.h"
+
+// 位姿图的关键帧存储，按index直接取。
+// index从0连续递增，指针分块存放，块分配以后不再移动也不释放，
+// 所以已经加进来的关键帧可以不加锁读(get/size)，只有add拿锁。
+// 读的时候先取size()作为快照，[0, size)里的指针之后都不会变。
+// 只管指针，关键帧的位姿由PoseGraph自己加锁
+class KeyFrameStore
+{
+  public:
+    static const int CHUNK_BITS = 10;
+    static const int CHUNK_SIZE = 1 << CHUNK_BITS;
+    static const int MAX_CHUNKS = 4096; // 最多约400万个关键帧
+
+    KeyFrameStore();
+    ~KeyFrameStore();
+
+    // keyframe->index必须等于当前size()
+    void add(KeyFrame *keyframe);
+    int size() const { return num.load(std::memory_order_acquire); }
+    KeyFrame *get(int index) const
+    {
+        if (index < 0 || index >= size())
+            return NULL;
+        return chunks[index >> CHUNK_BITS][index & (CHUNK_SIZE - 1)];
+    }
+
+  private:
+    KeyFrameStore(const KeyFrameStore &);
+    KeyFrameStore &operator=(const KeyFrameStore &);
+
+    KeyFrame **chunks[MAX_CHUNKS];
+    std::atomic<int> num;
+    std::mutex m_add;
+};
@@ -0,0 +1,76 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include <boost/dynamic_bitset.hpp>
+
+static_assert(sizeof(boost::dynamic_bitset<>::block_type) == sizeof(uint64_t),
+              "descriptor packing assumes 64-bit dynamic_bitset blocks");
+
+inline int descriptorWords(int descriptor_bits)
+{
+    return (descriptor_bits + 63) / 64;
+}
+
+// BRIEF::bitset(boost::dynamic_bitset<>)和打包的uint64互转，块顺序和dynamic_bitset内部一致
+inline void packDescriptor(const boost::dynamic_bitset<> &bits, uint64_t *words)
+{
+    boost::to_block_range(bits, words);
+}
+
+inline void unpackDescriptor(const uint64_t *words, int descriptor_bits, boost::dynamic_bitset<> &bits)
+{
+    bits.resize(descriptor_bits);
+    boost::from_block_range(words, words + descriptorWords(descriptor_bits), bits);
+}
+
+// x86上用-DLOOP_FUSION_POPCNT=ON编译时是popcnt指令，ARM上是NEON的cnt
+inline int popcount64(uint64_t x)
+{
+    return __builtin_popcountll(x);
+}
+
+// 256位BRIEF描述子连续存放，每个4个uint64，匹配时不用再走dynamic_bitset
+class PackedDescriptors
+{
+  public:
+    static const int BITS = 256;
+    static const int WORDS = BITS / 64;
+
+    void assign(const std::vector<boost::dynamic_bitset<>> &descriptors)
+    {
+        words.resize(descriptors.size() * WORDS);
+        for (size_t i = 0; i < descriptors.size(); i++)
+        {
+            assert(descriptors[i].size() == BITS);
+            packDescriptor(descriptors[i], &words[i * WORDS]);
+        }
+    }
+
+    // 已经打包好的num个描述子(例如mmap进来的地图)，直接拷贝
+    void assign(const uint64_t *src, int num)
+    {
+        words.assign(src, src + (size_t)num * WORDS);
+    }
+
+    int size() const { return (int)(words.size() / WORDS); }
+    const uint64_t *operator[](int i) const { return &words[i * WORDS]; }
+
+    static int distance(const uint64_t *a, const uint64_t *b)
+    {
+        return popcount64(a[0] ^ b[0]) + popcount64(a[1] ^ b[1]) +
+               popcount64(a[2] ^ b[2]) + popcount64(a[3] ^ b[3]);
+    }
+
+    std::vector<uint64_t> words;
+};
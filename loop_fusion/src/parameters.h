@@ -33,5 +33,9 @@ extern int ROW;
 extern int COL;
 extern std::string VINS_RESULT_PATH;
 extern int DEBUG_IMAGE;
+extern int BRIEF_THREADS;//计算关键帧描述子的工作线程数
+extern int MATCH_THREADS;//回环描述子匹配的线程数
+extern double LOOP_MATCH_RATIO;//最近/次近距离比值门限，1表示不做比值检验
+extern double LOOP_SEARCH_RADIUS;//按VIO位姿预测位置预筛选的半径(像素)，0表示不筛选
 
 
@@ -17,6 +17,7 @@ PoseGraph::PoseGraph()
     posegraph_visualization->setScale(0.1);
     posegraph_visualization->setLineWidth(0.01);
     earliest_loop_index = -1;
+    optimize_start_index = -1;
     t_drift = Eigen::Vector3d(0, 0, 0);
     yaw_drift = 0;
     r_drift = Eigen::Matrix3d::Identity();
@@ -89,6 +90,7 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     cur_kf->index = global_index;
     global_index++;
 	int loop_index = -1;
+    bool need_optimize = false;
     if (flag_detect_loop)
     {
         TicToc tmp_t;
@@ -150,36 +152,43 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
                 vio_P_cur = w_r_vio * vio_P_cur + w_t_vio;//这里是不是多了？
                 vio_R_cur = w_r_vio *  vio_R_cur;
                 cur_kf->updateVioPose(vio_P_cur, vio_R_cur);
-                list<KeyFrame*>::iterator it = keyframelist.begin();
-                for (; it != keyframelist.end(); it++)   
+                m_keyframe_pose.lock();
+                int keyframe_num = keyframes.size();
+                for (int i = 0; i < keyframe_num; i++)
                 {
-                    if((*it)->sequence == cur_kf->sequence)
+                    KeyFrame* kf = keyframes.get(i);
+                    if(kf->sequence == cur_kf->sequence)
                     {
                         Vector3d vio_P_cur;
                         Matrix3d vio_R_cur;
-                        (*it)->getVioPose(vio_P_cur, vio_R_cur);
+                        kf->getVioPose(vio_P_cur, vio_R_cur);
                         vio_P_cur = w_r_vio * vio_P_cur + w_t_vio;
                         vio_R_cur = w_r_vio *  vio_R_cur;
-                        (*it)->updateVioPose(vio_P_cur, vio_R_cur);
+                        kf->updateVioPose(vio_P_cur, vio_R_cur);
                     }
                 }
+                m_keyframe_pose.unlock();
                 sequence_loop[cur_kf->sequence] = 1;
             }
-            //将当前帧放入优化队列中
-            m_optimize_buf.lock();
-            optimize_buf.push(cur_kf->index);//push后，optimize6DoF 6自由度位姿变换线程开始执行优化的程序  std::thread(&PoseGraph::optimize6DoF, this);
-            m_optimize_buf.unlock();
+            need_optimize = true;
         }
 	}
-	m_keyframelist.lock();
+	m_path.lock();
     Vector3d P;
     Matrix3d R;
 
     cur_kf->getVioPose(P, R); //获取VIO当前帧的位姿P、R，根据偏移量得到实际位姿
+    m_drift.lock();
     P = r_drift * P + t_drift;//在optimize6DoF线程中进行了赋值
     R = r_drift * R;
     std::cout<<"r_drift="<<r_drift<<"  t_drift="<<t_drift<<std::endl;
     cur_kf->updatePose(P, R);//更新当前帧的位姿P、R到T_w_i R_w_i
+    //拿着m_drift插入，优化线程改完漂移量以后的updatePoseAfter不会漏掉这一帧
+    keyframes.add(cur_kf);
+    m_drift.unlock();
+    //将当前帧放入优化队列中，必须在加入keyframes之后，优化线程才能取到这一帧
+    if (need_optimize)
+        pushOptimize(cur_kf->index, loop_index);
 
     //发布path[sequence_cnt]
     Quaterniond Q{R};
@@ -218,20 +227,19 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     //draw local connection
     if (SHOW_S_EDGE)
     {
-        list<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
-        for (int i = 0; i < 4; i++)
+        m_keyframe_pose.lock();
+        for (int i = 1; i <= 4 && cur_kf->index - i >= 0; i++)
         {
-            if (rit == keyframelist.rend())
-                break;
+            KeyFrame* kf = keyframes.get(cur_kf->index - i);
             Vector3d conncected_P;
             Matrix3d connected_R;
-            if((*rit)->sequence == cur_kf->sequence)
+            if(kf->sequence == cur_kf->sequence)
             {
-                (*rit)->getPose(conncected_P, connected_R);
+                kf->getPose(conncected_P, connected_R);
                 posegraph_visualization->add_edge(P, conncected_P);
             }
-            rit++;
         }
+        m_keyframe_pose.unlock();
     }
 
     //当前帧与其回环帧连线
@@ -243,9 +251,11 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
             KeyFrame* connected_KF = getKeyFrame(cur_kf->loop_index);
             Vector3d connected_P,P0;
             Matrix3d connected_R,R0;
+            m_keyframe_pose.lock();
             connected_KF->getPose(connected_P, connected_R);
             //cur_kf->getVioPose(P0, R0);
             cur_kf->getPose(P0, R0);
+            m_keyframe_pose.unlock();
             if(cur_kf->sequence > 0)
             {
                 //printf("add loop into visual \n");
@@ -256,9 +266,8 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     }
     //posegraph_visualization->add_pose(P + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0), Q);
     //发送path主题数据，用以显示
-	keyframelist.push_back(cur_kf);
     publish();
-	m_keyframelist.unlock();
+	m_path.unlock();
 }
 
 
@@ -267,6 +276,7 @@ void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     cur_kf->index = global_index;
     global_index++;
     int loop_index = -1;
+    bool need_optimize = false;
     if (flag_detect_loop)
        loop_index = detectLoop(cur_kf, cur_kf->index);
     else
@@ -281,15 +291,16 @@ void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
         {
             if (earliest_loop_index > loop_index || earliest_loop_index == -1)
                 earliest_loop_index = loop_index;
-            m_optimize_buf.lock();
-            optimize_buf.push(cur_kf->index);
-            m_optimize_buf.unlock();
+            need_optimize = true;
         }
     }
-    m_keyframelist.lock();
+    m_path.lock();
     Vector3d P;
     Matrix3d R;
     cur_kf->getPose(P, R);
+    keyframes.add(cur_kf);
+    if (need_optimize)
+        pushOptimize(cur_kf->index, loop_index);
     Quaterniond Q{R};
     geometry_msgs::PoseStamped pose_stamped;
     pose_stamped.header.stamp = ros::Time(cur_kf->time_stamp);
@@ -307,20 +318,19 @@ void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     //draw local connection
     if (SHOW_S_EDGE)
     {
-        list<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
-        for (int i = 0; i < 1; i++)
+        m_keyframe_pose.lock();
+        for (int i = 1; i <= 1 && cur_kf->index - i >= 0; i++)
         {
-            if (rit == keyframelist.rend())
-                break;
+            KeyFrame* kf = keyframes.get(cur_kf->index - i);
             Vector3d conncected_P;
             Matrix3d connected_R;
-            if((*rit)->sequence == cur_kf->sequence)
+            if(kf->sequence == cur_kf->sequence)
             {
-                (*rit)->getPose(conncected_P, connected_R);
+                kf->getPose(conncected_P, connected_R);
                 posegraph_visualization->add_edge(P, conncected_P);
             }
-            rit++;
         }
+        m_keyframe_pose.unlock();
     }
     /*
     if (cur_kf->has_loop)
@@ -333,24 +343,23 @@ void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     }
     */
 
-    keyframelist.push_back(cur_kf);
     //publish();
-    m_keyframelist.unlock();
+    m_path.unlock();
+}
+
+// push后，optimize4DoF/optimize6DoF线程开始执行优化
+void PoseGraph::pushOptimize(int cur_index, int loop_index)
+{
+    m_optimize_buf.lock();
+    if (optimize_start_index == -1 || optimize_start_index > loop_index)
+        optimize_start_index = loop_index;
+    optimize_buf.push(cur_index);
+    m_optimize_buf.unlock();
 }
 
 KeyFrame* PoseGraph::getKeyFrame(int index)
 {
-//    unique_lock<mutex> lock(m_keyframelist);
-    list<KeyFrame*>::iterator it = keyframelist.begin();
-    for (; it != keyframelist.end(); it++)   
-    {
-        if((*it)->index == index)
-            break;
-    }
-    if (it != keyframelist.end())
-        return *it;
-    else
-        return NULL;
+    return keyframes.get(index);
 }
 
 int PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index)//输入关键帧和关键帧的索引
@@ -463,9 +472,63 @@ void PoseGraph::addKeyFrameIntoVoc(KeyFrame* keyframe)
         image_pool[keyframe->index] = compressed_image;
     }
 
-    db.add(keyframe->brief_descriptors);
+    if (keyframe->brief_descriptors.empty() && keyframe->packed_descriptors.size() > 0)
+    {
+        // 从地图加载的关键帧只有打包的描述子，DBoW要bitset，临时解开
+        vector<BRIEF::bitset> brief_descriptors(keyframe->packed_descriptors.size());
+        for (size_t i = 0; i < brief_descriptors.size(); i++)
+            unpackDescriptor(keyframe->packed_descriptors[i], PackedDescriptors::BITS, brief_descriptors[i]);
+        db.add(brief_descriptors);
+    }
+    else
+        db.add(keyframe->brief_descriptors);
 }
 
+// 收集一次优化用到的关键帧，nodes按index升序：
+// [first_index - 4, cur_index]里的所有帧(first_index之前的只作常量，给顺序边用)，
+// 然后是这些帧的回环边连到范围外的帧(常量)。返回范围内的帧数，local_index为在nodes里的下标
+int PoseGraph::collectOptimizeNodes(int first_index, int cur_index, vector<KeyFrame*> &nodes)
+{
+    nodes.clear();
+    for (int index = max(first_index - 4, 0); index <= cur_index; index++)
+        nodes.push_back(keyframes.get(index));
+    int range_size = nodes.size();
+    for (int k = 0; k < range_size; k++)
+        nodes[k]->local_index = k;
+    for (int k = 0; k < range_size; k++)
+    {
+        if (nodes[k]->has_loop && nodes[k]->index >= first_index && nodes[k]->loop_index < nodes[0]->index)
+        {
+            KeyFrame* old_kf = getKeyFrame(nodes[k]->loop_index);
+            assert(old_kf != NULL);
+            if (old_kf->local_index >= range_size && old_kf->local_index < (int)nodes.size() && nodes[old_kf->local_index] == old_kf)
+                continue;
+            old_kf->local_index = nodes.size();
+            nodes.push_back(old_kf);
+        }
+    }
+    return range_size;
+}
+
+// (cur_index, end_index)之间的帧还没参与优化，按新的漂移量更新
+void PoseGraph::updatePoseAfter(int cur_index, int end_index)
+{
+    for (int index = cur_index + 1; index < end_index; index++)
+    {
+        KeyFrame* kf = keyframes.get(index);
+        Vector3d P;
+        Matrix3d R;
+        kf->getVioPose(P, R);
+        P = r_drift * P + t_drift;
+        R = r_drift * R;
+        kf->updatePose(P, R);
+    }
+}
+
+// 每次只优化受新回环影响的子图：从这批新回环里最早的回环帧到当前帧，
+// 更早的帧保持上次优化的结果作为常量(仍然通过顺序边和回环边约束子图)。
+// 初值用当前的位姿图位姿(热启动)，顺序边的观测用VIO位姿，和从头建图时一样。
+// 优化状态都在堆上，每次开销和回环跨度有关，和地图大小无关
 void PoseGraph::optimize4DoF()
 {
     while(true)
@@ -476,24 +539,27 @@ void PoseGraph::optimize4DoF()
         while(!optimize_buf.empty())
         {
             cur_index = optimize_buf.front();
-            first_looped_index = earliest_loop_index;
             optimize_buf.pop();
         }
+        first_looped_index = optimize_start_index != -1 ? optimize_start_index : earliest_loop_index;
+        optimize_start_index = -1;
         m_optimize_buf.unlock();
         if (cur_index != -1)
         {
             printf("optimize pose graph \n");
             TicToc tmp_t;
-            m_keyframelist.lock();
             KeyFrame* cur_kf = getKeyFrame(cur_index);
 
-            int max_length = cur_index + 1;
+            vector<KeyFrame*> nodes;
+            int range_size = collectOptimizeNodes(first_looped_index, cur_index, nodes);
+            int n = nodes.size();
 
             // w^t_i   w^q_i
-            double t_array[max_length][3];
-            Quaterniond q_array[max_length];
-            double euler_array[max_length][3];
-            double sequence_array[max_length];
+            vector<array<double, 3>> t_array(n);
+            vector<array<double, 3>> euler_array(n);
+            vector<Vector3d> vio_P(n), vio_euler(n);
+            vector<Matrix3d> vio_R(n);
+            vector<bool> fixed(n);
 
             ceres::Problem problem;
             ceres::Solver::Options options;
@@ -508,108 +574,85 @@ void PoseGraph::optimize4DoF()
             ceres::LocalParameterization* angle_local_parameterization =
                 AngleLocalParameterization::Create();
 
-            list<KeyFrame*>::iterator it;
-
-            int i = 0;
-            for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+            m_keyframe_pose.lock();
+            for (int i = 0; i < n; i++)
             {
-                if ((*it)->index < first_looped_index)
-                    continue;
-                (*it)->local_index = i;
-                Quaterniond tmp_q;
+                KeyFrame* kf = nodes[i];
                 Matrix3d tmp_r;
                 Vector3d tmp_t;
-                (*it)->getVioPose(tmp_t, tmp_r);
-                tmp_q = tmp_r;
-                t_array[i][0] = tmp_t(0);
-                t_array[i][1] = tmp_t(1);
-                t_array[i][2] = tmp_t(2);
-                q_array[i] = tmp_q;
-
-                Vector3d euler_angle = Utility::R2ypr(tmp_q.toRotationMatrix());
-                euler_array[i][0] = euler_angle.x();
-                euler_array[i][1] = euler_angle.y();
-                euler_array[i][2] = euler_angle.z();
-
-                sequence_array[i] = (*it)->sequence;
+                kf->getPose(tmp_t, tmp_r);
+                Vector3d euler_angle = Utility::R2ypr(tmp_r);
+                for (int k = 0; k < 3; k++)
+                {
+                    t_array[i][k] = tmp_t(k);
+                    euler_array[i][k] = euler_angle(k);
+                }
+                kf->getVioPose(vio_P[i], vio_R[i]);
+                vio_euler[i] = Utility::R2ypr(vio_R[i]);
 
-                problem.AddParameterBlock(euler_array[i], 1, angle_local_parameterization);
-                problem.AddParameterBlock(t_array[i], 3);
+                problem.AddParameterBlock(euler_array[i].data(), 1, angle_local_parameterization);
+                problem.AddParameterBlock(t_array[i].data(), 3);
 
-                if ((*it)->index == first_looped_index || (*it)->sequence == 0)
+                fixed[i] = i >= range_size || kf->index <= first_looped_index || kf->sequence == 0;
+                if (fixed[i])
                 {   
-                    problem.SetParameterBlockConstant(euler_array[i]);
-                    problem.SetParameterBlockConstant(t_array[i]);
+                    problem.SetParameterBlockConstant(euler_array[i].data());
+                    problem.SetParameterBlockConstant(t_array[i].data());
                 }
+            }
+            m_keyframe_pose.unlock();
 
+            for (int i = 0; i < range_size; i++)
+            {
                 //add edge
                 for (int j = 1; j < 5; j++)
                 {
-                  if (i - j >= 0 && sequence_array[i] == sequence_array[i-j])
+                  if (i - j >= 0 && nodes[i]->sequence == nodes[i-j]->sequence && !(fixed[i] && fixed[i-j]))
                   {
-                    Vector3d euler_conncected = Utility::R2ypr(q_array[i-j].toRotationMatrix());
-                    Vector3d relative_t(t_array[i][0] - t_array[i-j][0], t_array[i][1] - t_array[i-j][1], t_array[i][2] - t_array[i-j][2]);
-                    relative_t = q_array[i-j].inverse() * relative_t;
-                    double relative_yaw = euler_array[i][0] - euler_array[i-j][0];
+                    Vector3d relative_t = vio_R[i-j].transpose() * (vio_P[i] - vio_P[i-j]);
+                    double relative_yaw = vio_euler[i].x() - vio_euler[i-j].x();
                     ceres::CostFunction* cost_function = FourDOFError::Create( relative_t.x(), relative_t.y(), relative_t.z(),
-                                                   relative_yaw, euler_conncected.y(), euler_conncected.z());
-                    problem.AddResidualBlock(cost_function, NULL, euler_array[i-j], 
-                                            t_array[i-j], 
-                                            euler_array[i], 
-                                            t_array[i]);
+                                                   relative_yaw, vio_euler[i-j].y(), vio_euler[i-j].z());
+                    problem.AddResidualBlock(cost_function, NULL, euler_array[i-j].data(), 
+                                            t_array[i-j].data(), 
+                                            euler_array[i].data(), 
+                                            t_array[i].data());
                   }
                 }
 
                 //add loop edge
-                
-                if((*it)->has_loop)
+                if(nodes[i]->has_loop && nodes[i]->index >= first_looped_index)
                 {
-                    assert((*it)->loop_index >= first_looped_index);
-                    int connected_index = getKeyFrame((*it)->loop_index)->local_index;
-                    Vector3d euler_conncected = Utility::R2ypr(q_array[connected_index].toRotationMatrix());
+                    int connected_index = getKeyFrame(nodes[i]->loop_index)->local_index;
+                    if (fixed[i] && fixed[connected_index])
+                        continue;
                     Vector3d relative_t;
-                    relative_t = (*it)->getLoopRelativeT();
-                    double relative_yaw = (*it)->getLoopRelativeYaw();
+                    relative_t = nodes[i]->getLoopRelativeT();
+                    double relative_yaw = nodes[i]->getLoopRelativeYaw();
                     ceres::CostFunction* cost_function = FourDOFWeightError::Create( relative_t.x(), relative_t.y(), relative_t.z(),
-                                                                               relative_yaw, euler_conncected.y(), euler_conncected.z());
-                    problem.AddResidualBlock(cost_function, loss_function, euler_array[connected_index], 
-                                                                  t_array[connected_index], 
-                                                                  euler_array[i], 
-                                                                  t_array[i]);
-                    
+                                                                               relative_yaw, vio_euler[connected_index].y(), vio_euler[connected_index].z());
+                    problem.AddResidualBlock(cost_function, loss_function, euler_array[connected_index].data(), 
+                                                                  t_array[connected_index].data(), 
+                                                                  euler_array[i].data(), 
+                                                                  t_array[i].data());
                 }
-                
-                if ((*it)->index == cur_index)
-                    break;
-                i++;
             }
-            m_keyframelist.unlock();
 
             ceres::Solve(options, &problem, &summary);
             //std::cout << summary.BriefReport() << "\n";
-            
-            //printf("pose optimization time: %f \n", tmp_t.toc());
-            /*
-            for (int j = 0 ; j < i; j++)
-            {
-                printf("optimize i: %d p: %f, %f, %f\n", j, t_array[j][0], t_array[j][1], t_array[j][2] );
-            }
-            */
-            m_keyframelist.lock();
-            i = 0;
-            for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+            printf("pose graph 4DoF: %d keyframes (%d fixed), %d iterations, %f ms\n",
+                   n, (int)count(fixed.begin(), fixed.end(), true), (int)summary.iterations.size(), tmp_t.toc());
+
+            m_keyframe_pose.lock();
+            for (int i = 0; i < range_size; i++)
             {
-                if ((*it)->index < first_looped_index)
+                if (fixed[i])
                     continue;
                 Quaterniond tmp_q;
                 tmp_q = Utility::ypr2R(Vector3d(euler_array[i][0], euler_array[i][1], euler_array[i][2]));
                 Vector3d tmp_t = Vector3d(t_array[i][0], t_array[i][1], t_array[i][2]);
                 Matrix3d tmp_r = tmp_q.toRotationMatrix();
-                (*it)-> updatePose(tmp_t, tmp_r);
-
-                if ((*it)->index == cur_index)
-                    break;
-                i++;
+                nodes[i]->updatePose(tmp_t, tmp_r);
             }
 
             Vector3d cur_t, vio_t;
@@ -620,22 +663,14 @@ void PoseGraph::optimize4DoF()
             yaw_drift = Utility::R2ypr(cur_r).x() - Utility::R2ypr(vio_r).x();
             r_drift = Utility::ypr2R(Vector3d(yaw_drift, 0, 0));
             t_drift = cur_t - r_drift * vio_t;
+            int end_index = keyframes.size();
             m_drift.unlock();
             // cout << "t_drift " << t_drift.transpose() << endl;
             // cout << "r_drift " << Utility::R2ypr(r_drift).transpose() << endl;
             // cout << "yaw drift " << yaw_drift << endl;
 
-            it++;
-            for (; it != keyframelist.end(); it++)
-            {
-                Vector3d P;
-                Matrix3d R;
-                (*it)->getVioPose(P, R);
-                P = r_drift * P + t_drift;
-                R = r_drift * R;
-                (*it)->updatePose(P, R);
-            }
-            m_keyframelist.unlock();
+            updatePoseAfter(cur_index, end_index);
+            m_keyframe_pose.unlock();
             updatePath();
         }
 
@@ -655,23 +690,27 @@ void PoseGraph::optimize6DoF()
         while(!optimize_buf.empty())
         {
             cur_index = optimize_buf.front();
-            first_looped_index = earliest_loop_index;
             optimize_buf.pop();
         }
+        first_looped_index = optimize_start_index != -1 ? optimize_start_index : earliest_loop_index;
+        optimize_start_index = -1;
         m_optimize_buf.unlock();
         if (cur_index != -1)
         {
             printf("optimize pose graph \n");
             TicToc tmp_t;
-            m_keyframelist.lock();
             KeyFrame* cur_kf = getKeyFrame(cur_index);
 
-            int max_length = cur_index + 1;
+            vector<KeyFrame*> nodes;
+            int range_size = collectOptimizeNodes(first_looped_index, cur_index, nodes);
+            int n = nodes.size();
 
             // w^t_i   w^q_i
-            double t_array[max_length][3];
-            double q_array[max_length][4];
-            double sequence_array[max_length];
+            vector<array<double, 3>> t_array(n);
+            vector<array<double, 4>> q_array(n);
+            vector<Vector3d> vio_P(n);
+            vector<Matrix3d> vio_R(n);
+            vector<bool> fixed(n);
 
             ceres::Problem problem;
             ceres::Solver::Options options;
@@ -685,19 +724,14 @@ void PoseGraph::optimize6DoF()
             //loss_function = new ceres::CauchyLoss(1.0);
             ceres::LocalParameterization* local_parameterization = new ceres::QuaternionParameterization();
 
-            list<KeyFrame*>::iterator it;
-
-            int i = 0;
-            for (it = keyframelist.begin(); it != keyframelist.end(); it++)//一次遍历所有帧获取回环起始后的所有帧位姿
+            m_keyframe_pose.lock();
+            for (int i = 0; i < n; i++)//子图里的帧从当前位姿图位姿热启动
             {
-                if ((*it)->index < first_looped_index)
-                    continue;
-                (*it)->local_index = i;
-                Quaterniond tmp_q;
+                KeyFrame* kf = nodes[i];
                 Matrix3d tmp_r;
                 Vector3d tmp_t;
-                (*it)->getVioPose(tmp_t, tmp_r);
-                tmp_q = tmp_r;
+                kf->getPose(tmp_t, tmp_r);
+                Quaterniond tmp_q(tmp_r);
                 t_array[i][0] = tmp_t(0);
                 t_array[i][1] = tmp_t(1);
                 t_array[i][2] = tmp_t(2);
@@ -705,81 +739,67 @@ void PoseGraph::optimize6DoF()
                 q_array[i][1] = tmp_q.x();
                 q_array[i][2] = tmp_q.y();
                 q_array[i][3] = tmp_q.z();
+                kf->getVioPose(vio_P[i], vio_R[i]);
 
-                sequence_array[i] = (*it)->sequence;
-
-                problem.AddParameterBlock(q_array[i], 4, local_parameterization);//帧位姿优化
-                problem.AddParameterBlock(t_array[i], 3);
+                problem.AddParameterBlock(q_array[i].data(), 4, local_parameterization);//帧位姿优化
+                problem.AddParameterBlock(t_array[i].data(), 3);
 
-                if ((*it)->index == first_looped_index || (*it)->sequence == 0)
+                fixed[i] = i >= range_size || kf->index <= first_looped_index || kf->sequence == 0;
+                if (fixed[i])
                 {   
-                    problem.SetParameterBlockConstant(q_array[i]);
-                    problem.SetParameterBlockConstant(t_array[i]);
+                    problem.SetParameterBlockConstant(q_array[i].data());
+                    problem.SetParameterBlockConstant(t_array[i].data());
                 }
+            }
+            m_keyframe_pose.unlock();
 
+            for (int i = 0; i < range_size; i++)
+            {
                 //add edge
                 for (int j = 1; j < 5; j++)
                 {
-                    if (i - j >= 0 && sequence_array[i] == sequence_array[i-j])
+                    if (i - j >= 0 && nodes[i]->sequence == nodes[i-j]->sequence && !(fixed[i] && fixed[i-j]))
                     {
-                        Vector3d relative_t(t_array[i][0] - t_array[i-j][0], t_array[i][1] - t_array[i-j][1], t_array[i][2] - t_array[i-j][2]);
-                        Quaterniond q_i_j = Quaterniond(q_array[i-j][0], q_array[i-j][1], q_array[i-j][2], q_array[i-j][3]);
-                        Quaterniond q_i = Quaterniond(q_array[i][0], q_array[i][1], q_array[i][2], q_array[i][3]);
-                        relative_t = q_i_j.inverse() * relative_t;
-                        Quaterniond relative_q = q_i_j.inverse() * q_i;
+                        Vector3d relative_t = vio_R[i-j].transpose() * (vio_P[i] - vio_P[i-j]);
+                        Quaterniond relative_q(vio_R[i-j].transpose() * vio_R[i]);
                         ceres::CostFunction* vo_function = RelativeRTError::Create(relative_t.x(), relative_t.y(), relative_t.z(),
                                                                                 relative_q.w(), relative_q.x(), relative_q.y(), relative_q.z(),
                                                                                 0.1, 0.01);
-                        problem.AddResidualBlock(vo_function, NULL, q_array[i-j], t_array[i-j], q_array[i], t_array[i]);
+                        problem.AddResidualBlock(vo_function, NULL, q_array[i-j].data(), t_array[i-j].data(), q_array[i].data(), t_array[i].data());
                     }
                 }
 
                 //add loop edge
-                
-                if((*it)->has_loop)
+                if(nodes[i]->has_loop && nodes[i]->index >= first_looped_index)
                 {
-                    assert((*it)->loop_index >= first_looped_index);
-                    int connected_index = getKeyFrame((*it)->loop_index)->local_index;
+                    int connected_index = getKeyFrame(nodes[i]->loop_index)->local_index;
+                    if (fixed[i] && fixed[connected_index])
+                        continue;
                     Vector3d relative_t;
-                    relative_t = (*it)->getLoopRelativeT();
+                    relative_t = nodes[i]->getLoopRelativeT();
                     Quaterniond relative_q;
-                    relative_q = (*it)->getLoopRelativeQ();
+                    relative_q = nodes[i]->getLoopRelativeQ();
                     ceres::CostFunction* loop_function = RelativeRTError::Create(relative_t.x(), relative_t.y(), relative_t.z(),
                                                                                 relative_q.w(), relative_q.x(), relative_q.y(), relative_q.z(),
                                                                                 0.1, 0.01);
-                    problem.AddResidualBlock(loop_function, loss_function, q_array[connected_index], t_array[connected_index], q_array[i], t_array[i]);                    
+                    problem.AddResidualBlock(loop_function, loss_function, q_array[connected_index].data(), t_array[connected_index].data(), q_array[i].data(), t_array[i].data());
                 }
-                
-                if ((*it)->index == cur_index)
-                    break;
-                i++;
             }
-            m_keyframelist.unlock();
 
             ceres::Solve(options, &problem, &summary);
             //std::cout << summary.BriefReport() << "\n";
-            
-            //printf("pose optimization time: %f \n", tmp_t.toc());
-            /*
-            for (int j = 0 ; j < i; j++)
-            {
-                printf("optimize i: %d p: %f, %f, %f\n", j, t_array[j][0], t_array[j][1], t_array[j][2] );
-            }
-            */
-            m_keyframelist.lock();
-            i = 0;
-            for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+            printf("pose graph 6DoF: %d keyframes (%d fixed), %d iterations, %f ms\n",
+                   n, (int)count(fixed.begin(), fixed.end(), true), (int)summary.iterations.size(), tmp_t.toc());
+
+            m_keyframe_pose.lock();
+            for (int i = 0; i < range_size; i++)
             {
-                if ((*it)->index < first_looped_index)
+                if (fixed[i])
                     continue;
                 Quaterniond tmp_q(q_array[i][0], q_array[i][1], q_array[i][2], q_array[i][3]);
                 Vector3d tmp_t = Vector3d(t_array[i][0], t_array[i][1], t_array[i][2]);
                 Matrix3d tmp_r = tmp_q.toRotationMatrix();
-                (*it)-> updatePose(tmp_t, tmp_r);
-
-                if ((*it)->index == cur_index)
-                    break;
-                i++;
+                nodes[i]->updatePose(tmp_t, tmp_r);
             }
 
             Vector3d cur_t, vio_t;
@@ -789,21 +809,13 @@ void PoseGraph::optimize6DoF()
             m_drift.lock();
             r_drift = cur_r * vio_r.transpose();//在process线程里面的子函数用到了
             t_drift = cur_t - r_drift * vio_t;
+            int end_index = keyframes.size();
             m_drift.unlock();
             cout << "t_drift " << t_drift.transpose() << endl;
             cout << "r_drift " << Utility::R2ypr(r_drift).transpose() << endl;
 
-            it++;
-            for (; it != keyframelist.end(); it++)//将所有位姿改一遍
-            {
-                Vector3d P;
-                Matrix3d R;
-                (*it)->getVioPose(P, R);
-                P = r_drift * P + t_drift;
-                R = r_drift * R;
-                (*it)->updatePose(P, R);
-            }
-            m_keyframelist.unlock();
+            updatePoseAfter(cur_index, end_index);//将还没参与优化的帧的位姿改一遍
+            m_keyframe_pose.unlock();
             updatePath();//更新ROSmsg的path
         }
 
@@ -815,8 +827,16 @@ void PoseGraph::optimize6DoF()
 
 void PoseGraph::updatePath()
 {
-    m_keyframelist.lock();
-    list<KeyFrame*>::iterator it;
+    m_path.lock();
+    // 先在锁里把所有位姿拷出来，后面组消息、写文件都不再拿m_keyframe_pose
+    m_keyframe_pose.lock();
+    int keyframe_num = keyframes.size();
+    vector<Vector3d> P_array(keyframe_num);
+    vector<Matrix3d> R_array(keyframe_num);
+    for (int i = 0; i < keyframe_num; i++)
+        keyframes.get(i)->getPose(P_array[i], R_array[i]);
+    m_keyframe_pose.unlock();
+
     for (int i = 1; i <= sequence_cnt; i++)
     {
         path[i].poses.clear();
@@ -824,23 +844,24 @@ void PoseGraph::updatePath()
     base_path.poses.clear();
     posegraph_visualization->reset();
 
+    ofstream loop_path_file;
     if (SAVE_LOOP_PATH)
     {
-        ofstream loop_path_file_tmp(VINS_RESULT_PATH, ios::out);
-        loop_path_file_tmp.close();
+        loop_path_file.open(VINS_RESULT_PATH, ios::out);
+        loop_path_file.setf(ios::fixed, ios::floatfield);
     }
 
-    for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+    for (int k = 0; k < keyframe_num; k++)
     {
-        Vector3d P;
-        Matrix3d R;
-        (*it)->getPose(P, R);
+        KeyFrame* kf = keyframes.get(k);
+        Vector3d P = P_array[k];
+        Matrix3d R = R_array[k];
         Quaterniond Q;
         Q = R;
 //        printf("path p: %f, %f, %f\n",  P.x(),  P.z(),  P.y() );
 
         geometry_msgs::PoseStamped pose_stamped;
-        pose_stamped.header.stamp = ros::Time((*it)->time_stamp);
+        pose_stamped.header.stamp = ros::Time(kf->time_stamp);
         pose_stamped.header.frame_id = "world";
         pose_stamped.pose.position.x = P.x() + VISUALIZATION_SHIFT_X;
         pose_stamped.pose.position.y = P.y() + VISUALIZATION_SHIFT_Y;
@@ -849,24 +870,22 @@ void PoseGraph::updatePath()
         pose_stamped.pose.orientation.y = Q.y();
         pose_stamped.pose.orientation.z = Q.z();
         pose_stamped.pose.orientation.w = Q.w();
-        if((*it)->sequence == 0)
+        if(kf->sequence == 0)
         {
             base_path.poses.push_back(pose_stamped);
             base_path.header = pose_stamped.header;
         }
         else
         {
-            path[(*it)->sequence].poses.push_back(pose_stamped);
-            path[(*it)->sequence].header = pose_stamped.header;
+            path[kf->sequence].poses.push_back(pose_stamped);
+            path[kf->sequence].header = pose_stamped.header;
         }
 // updatePath
         if (SAVE_LOOP_PATH)
         {
-            ofstream loop_path_file(VINS_RESULT_PATH, ios::app);
-            loop_path_file.setf(ios::fixed, ios::floatfield);
             loop_path_file.precision(6);
-//            loop_path_file << (*it)->time_stamp * 1e9 << ",";
-            loop_path_file << (*it)->time_stamp << " ";
+//            loop_path_file << kf->time_stamp * 1e9 << ",";
+            loop_path_file << kf->time_stamp << " ";
             loop_path_file.precision(5);
             loop_path_file  << P.x() << " "
                   << P.y() << " "
@@ -876,48 +895,22 @@ void PoseGraph::updatePath()
                   << Q.z() << " "
                   << Q.w()
                   << endl;
-            loop_path_file.close();
         }
         //draw local connection
         if (SHOW_S_EDGE)
         {
-            list<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
-            list<KeyFrame*>::reverse_iterator lrit;
-            for (; rit != keyframelist.rend(); rit++)  
-            {  
-                if ((*rit)->index == (*it)->index)
-                {
-                    lrit = rit;
-                    lrit++;
-                    for (int i = 0; i < 4; i++)
-                    {
-                        if (lrit == keyframelist.rend())
-                            break;
-                        if((*lrit)->sequence == (*it)->sequence)
-                        {
-                            Vector3d conncected_P;
-                            Matrix3d connected_R;
-                            (*lrit)->getPose(conncected_P, connected_R);
-                            posegraph_visualization->add_edge(P, conncected_P);
-                        }
-                        lrit++;
-                    }
-                    break;
-                }
-            } 
+            for (int i = 1; i <= 4 && k - i >= 0; i++)
+            {
+                if(keyframes.get(k - i)->sequence == kf->sequence)
+                    posegraph_visualization->add_edge(P, P_array[k - i]);
+            }
         }
         if (SHOW_L_EDGE)
         {
-            if ((*it)->has_loop && (*it)->sequence == sequence_cnt)
+            if (kf->has_loop && kf->sequence == sequence_cnt)
             {
-                
-                KeyFrame* connected_KF = getKeyFrame((*it)->loop_index);
-                Vector3d connected_P;
-                Matrix3d connected_R;
-                connected_KF->getPose(connected_P, connected_R);
-                //(*it)->getVioPose(P, R);
-                (*it)->getPose(P, R);
-                if((*it)->sequence > 0)
+                Vector3d connected_P = P_array[kf->loop_index];
+                if(kf->sequence > 0)
                 {
                     posegraph_visualization->add_loopedge(P, connected_P + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0));
                 }
@@ -926,67 +919,148 @@ void PoseGraph::updatePath()
 
     }
     publish();
-    m_keyframelist.unlock();
+    m_path.unlock();
 }
 
 
 void PoseGraph::savePoseGraph()
 {
-    m_keyframelist.lock();
     TicToc tmp_t;
-    FILE *pFile;
     printf("pose graph path: %s\n",POSE_GRAPH_SAVE_PATH.c_str());
     printf("pose graph saving... \n");
-    string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.txt";
-    pFile = fopen (file_path.c_str(),"w");
-    //fprintf(pFile, "index time_stamp Tx Ty Tz Qw Qx Qy Qz loop_index loop_info\n");
-    list<KeyFrame*>::iterator it;
-    for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+    string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.bin";
+    // 只有位姿会被优化线程改，在锁里拷进records，特征点和描述子加入以后不再变
+    m_keyframe_pose.lock();
+    int keyframe_num = keyframes.size();
+    vector<PoseGraphMapRecord> records;
+    records.reserve(keyframe_num);
+    for (int index = 0; index < keyframe_num; index++)
+    {
+        KeyFrame* kf = keyframes.get(index);
+        Quaterniond VIO_tmp_Q{kf->vio_R_w_i};
+        Quaterniond PG_tmp_Q{kf->R_w_i};
+        Vector3d VIO_tmp_T = kf->vio_T_w_i;
+        Vector3d PG_tmp_T = kf->T_w_i;
+
+        PoseGraphMapRecord r;
+        r.index = kf->index;
+        r.loop_index = kf->loop_index;
+        r.keypoints_num = kf->keypoints.size();
+        r.time_stamp = kf->time_stamp;
+        for (int k = 0; k < 3; k++)
+        {
+            r.vio_T[k] = VIO_tmp_T(k);
+            r.pg_T[k] = PG_tmp_T(k);
+        }
+        r.vio_Q[0] = VIO_tmp_Q.w(); r.vio_Q[1] = VIO_tmp_Q.x(); r.vio_Q[2] = VIO_tmp_Q.y(); r.vio_Q[3] = VIO_tmp_Q.z();
+        r.pg_Q[0] = PG_tmp_Q.w(); r.pg_Q[1] = PG_tmp_Q.x(); r.pg_Q[2] = PG_tmp_Q.y(); r.pg_Q[3] = PG_tmp_Q.z();
+        for (int k = 0; k < 8; k++)
+            r.loop_info[k] = kf->loop_info(k);
+        records.push_back(r);
+
+        assert((int)kf->keypoints.size() == kf->packed_descriptors.size());
+    }
+    m_keyframe_pose.unlock();
+
+    // write keypoints, brief_descriptors，描述子直接用打包好的packed_descriptors
+    PoseGraphMapWriter writer;
+    bool ok = writer.open(file_path, records, PackedDescriptors::BITS);
+    vector<PoseGraphMapKeyPoint> keypoints;
+    for (int index = 0; ok && index < keyframe_num; index++)
     {
-        std::string image_path, descriptor_path, brief_path, keypoints_path;
+        KeyFrame* kf = keyframes.get(index);
         if (DEBUG_IMAGE)
         {
-            image_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_image.png";
-            imwrite(image_path.c_str(), (*it)->image);
+            std::string image_path = POSE_GRAPH_SAVE_PATH + to_string(kf->index) + "_image.png";
+            imwrite(image_path.c_str(), kf->image);
         }
-        Quaterniond VIO_tmp_Q{(*it)->vio_R_w_i};
-        Quaterniond PG_tmp_Q{(*it)->R_w_i};
-        Vector3d VIO_tmp_T = (*it)->vio_T_w_i;
-        Vector3d PG_tmp_T = (*it)->T_w_i;
-
-        fprintf (pFile, " %d %f %f %f %f %f %f %f %f %f %f %f %f %f %f %f %d %f %f %f %f %f %f %f %f %d\n",(*it)->index, (*it)->time_stamp, 
-                                    VIO_tmp_T.x(), VIO_tmp_T.y(), VIO_tmp_T.z(), 
-                                    PG_tmp_T.x(), PG_tmp_T.y(), PG_tmp_T.z(), 
-                                    VIO_tmp_Q.w(), VIO_tmp_Q.x(), VIO_tmp_Q.y(), VIO_tmp_Q.z(), 
-                                    PG_tmp_Q.w(), PG_tmp_Q.x(), PG_tmp_Q.y(), PG_tmp_Q.z(), 
-                                    (*it)->loop_index, 
-                                    (*it)->loop_info(0), (*it)->loop_info(1), (*it)->loop_info(2), (*it)->loop_info(3),
-                                    (*it)->loop_info(4), (*it)->loop_info(5), (*it)->loop_info(6), (*it)->loop_info(7),
-                                    (int)(*it)->keypoints.size());
-
-        // write keypoints, brief_descriptors   vector<cv::KeyPoint> keypoints vector<BRIEF::bitset> brief_descriptors;
-        assert((*it)->keypoints.size() == (*it)->brief_descriptors.size());
-        brief_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_briefdes.dat";
-        std::ofstream brief_file(brief_path, std::ios::binary);
-        keypoints_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_keypoints.txt";
-        FILE *keypoints_file;
-        keypoints_file = fopen(keypoints_path.c_str(), "w");
-        for (int i = 0; i < (int)(*it)->keypoints.size(); i++)
+        int num = kf->keypoints.size();
+        keypoints.resize(num);
+        for (int i = 0; i < num; i++)
         {
-            brief_file << (*it)->brief_descriptors[i] << endl;
-            fprintf(keypoints_file, "%f %f %f %f\n", (*it)->keypoints[i].pt.x, (*it)->keypoints[i].pt.y, 
-                                                     (*it)->keypoints_norm[i].pt.x, (*it)->keypoints_norm[i].pt.y);
+            keypoints[i].x = kf->keypoints[i].pt.x;
+            keypoints[i].y = kf->keypoints[i].pt.y;
+            keypoints[i].x_norm = kf->keypoints_norm[i].pt.x;
+            keypoints[i].y_norm = kf->keypoints_norm[i].pt.y;
         }
-        brief_file.close();
-        fclose(keypoints_file);
+        ok = writer.write(keypoints.data(), kf->packed_descriptors.words.data(), num);
     }
-    fclose(pFile);
+    ok = writer.close() && ok;
+    if (!ok)
+        printf("save pose graph failed: %s\n", file_path.c_str());
 
     printf("save pose graph time: %f s\n", tmp_t.toc() / 1000);
-    m_keyframelist.unlock();
 }
+
+void PoseGraph::loadPoseGraphMap(const PoseGraphMapReader &map)
+{
+    TicToc tmp_t;
+    if (map.descriptorBits() != PackedDescriptors::BITS)
+    {
+        printf("pose graph map has %d bit descriptors, expected %d\n", map.descriptorBits(), PackedDescriptors::BITS);
+        return;
+    }
+    int cnt = 0;
+    for (int k = 0; k < map.size(); k++)
+    {
+        const PoseGraphMapRecord &r = map.record(k);
+        cv::Mat image;
+        if (DEBUG_IMAGE)
+        {
+            std::string image_path = POSE_GRAPH_SAVE_PATH + to_string(r.index) + "_image.png";
+            image = cv::imread(image_path.c_str(), 0);
+        }
+
+        Vector3d VIO_T(r.vio_T[0], r.vio_T[1], r.vio_T[2]);
+        Vector3d PG_T(r.pg_T[0], r.pg_T[1], r.pg_T[2]);
+        Matrix3d VIO_R = Quaterniond(r.vio_Q[0], r.vio_Q[1], r.vio_Q[2], r.vio_Q[3]).toRotationMatrix();
+        Matrix3d PG_R = Quaterniond(r.pg_Q[0], r.pg_Q[1], r.pg_Q[2], r.pg_Q[3]).toRotationMatrix();
+        Eigen::Matrix<double, 8, 1 > loop_info(r.loop_info);
+        int loop_index = r.loop_index;
+
+        if (loop_index != -1)
+            if (earliest_loop_index > loop_index || earliest_loop_index == -1)
+            {
+                earliest_loop_index = loop_index;
+            }
+
+        const PoseGraphMapKeyPoint *pts = map.keypoints(k);
+        const uint64_t *des = map.descriptors(k);
+        vector<cv::KeyPoint> keypoints(r.keypoints_num);
+        vector<cv::KeyPoint> keypoints_norm(r.keypoints_num);
+        for (int i = 0; i < r.keypoints_num; i++)
+        {
+            keypoints[i].pt.x = pts[i].x;
+            keypoints[i].pt.y = pts[i].y;
+            keypoints_norm[i].pt.x = pts[i].x_norm;
+            keypoints_norm[i].pt.y = pts[i].y_norm;
+        }
+
+        // 描述子是打包好的256位，直接从mmap里拷进关键帧
+        KeyFrame* keyframe = new KeyFrame(r.time_stamp, r.index, VIO_T, VIO_R, PG_T, PG_R, image, loop_index, loop_info, keypoints, keypoints_norm, des);
+        loadKeyFrame(keyframe, 0);
+        if (cnt % 20 == 0)
+        {
+            publish();
+        }
+        cnt++;
+    }
+    printf("load pose graph time: %f s\n", tmp_t.toc()/1000);
+    base_sequence = 0;
+}
+
 void PoseGraph::loadPoseGraph()
 {
+    // 优先读二进制地图，没有的话按旧的文本格式读(可以用pose_graph_convert转成二进制)
+    string map_path = POSE_GRAPH_SAVE_PATH + "pose_graph.bin";
+    PoseGraphMapReader map;
+    if (map.open(map_path))
+    {
+        printf("lode pose graph from: %s, %d keyframes\n", map_path.c_str(), map.size());
+        loadPoseGraphMap(map);
+        return;
+    }
+
     TicToc tmp_t;
     FILE * pFile;
     string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.txt";
@@ -1072,10 +1146,13 @@ void PoseGraph::loadPoseGraph()
         vector<cv::KeyPoint> keypoints;
         vector<cv::KeyPoint> keypoints_norm;
         vector<BRIEF::bitset> brief_descriptors;
+        vector<uint64_t> packed_descriptors(keypoints_num * PackedDescriptors::WORDS);
         for (int i = 0; i < keypoints_num; i++)
         {
             BRIEF::bitset tmp_des;
             brief_file >> tmp_des;
+            assert(tmp_des.size() == PackedDescriptors::BITS);
+            packDescriptor(tmp_des, &packed_descriptors[i * PackedDescriptors::WORDS]);
             brief_descriptors.push_back(tmp_des);
             cv::KeyPoint tmp_keypoint;
             cv::KeyPoint tmp_keypoint_norm;
@@ -1092,7 +1169,8 @@ void PoseGraph::loadPoseGraph()
         brief_file.close();
         fclose(keypoints_file);
 
-        KeyFrame* keyframe = new KeyFrame(time_stamp, index, VIO_T, VIO_R, PG_T, PG_R, image, loop_index, loop_info, keypoints, keypoints_norm, brief_descriptors);
+        KeyFrame* keyframe = new KeyFrame(time_stamp, index, VIO_T, VIO_R, PG_T, PG_R, image, loop_index, loop_info, keypoints, keypoints_norm, packed_descriptors.data());
+        keyframe->brief_descriptors.swap(brief_descriptors);//文本里本来就是bitset，加入DBoW时不用再解包
         loadKeyFrame(keyframe, 0);
         if (cnt % 20 == 0)
         {
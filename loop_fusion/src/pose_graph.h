@@ -19,6 +19,8 @@
 #include <ceres/ceres.h>
 #include <ceres/rotation.h>
 #include <queue>
+#include <array>
+#include <algorithm>
 #include <assert.h>
 #include <nav_msgs/Path.h>
 #include <geometry_msgs/PointStamped.h>
@@ -26,10 +28,12 @@
 #include <stdio.h>
 #include <ros/ros.h>
 #include "keyframe.h"
+#include "keyframe_store.h"
 #include "utility/tic_toc.h"
 #include "utility/utility.h"
 #include "utility/CameraPoseVisualization.h"
 #include "utility/tic_toc.h"
+#include "pose_graph_map.h"
 #include "ThirdParty/DBoW/DBoW2.h"
 #include "ThirdParty/DVision/DVision.h"
 #include "ThirdParty/DBoW/TemplatedDatabase.h"
@@ -70,15 +74,20 @@ public:
 
 private:
 	int detectLoop(KeyFrame* keyframe, int frame_index);
+	void loadPoseGraphMap(const PoseGraphMapReader &map);
+	int collectOptimizeNodes(int first_index, int cur_index, vector<KeyFrame*> &nodes);
+	void updatePoseAfter(int cur_index, int end_index);
+	void pushOptimize(int cur_index, int loop_index);
 	void addKeyFrameIntoVoc(KeyFrame* keyframe);
 	void optimize4DoF();
 	void optimize6DoF();
 	void updatePath();
-	list<KeyFrame*> keyframelist;
-	std::mutex m_keyframelist;
+	KeyFrameStore keyframes;//按index直接取关键帧，读不加锁
+	// 加锁顺序: m_path -> m_keyframe_pose -> m_drift
+	std::mutex m_keyframe_pose;//已经加入keyframes的关键帧的位姿
 	std::mutex m_optimize_buf;
-	std::mutex m_path;
-	std::mutex m_drift;
+	std::mutex m_path;//path、base_path、posegraph_visualization和VINS_RESULT_PATH
+	std::mutex m_drift;//漂移量，加入新关键帧时也拿着，和优化线程的updatePoseAfter互斥
 	std::thread t_optimization;
 	std::queue<int> optimize_buf;
 
@@ -87,6 +96,7 @@ private:
 	vector<bool> sequence_loop;
 	map<int, cv::Mat> image_pool;
 	int earliest_loop_index;
+	int optimize_start_index;//上次优化以后新回环里最早的回环帧，下次优化从这里开始
 	int base_sequence;
 	bool use_imu;
 
@@ -0,0 +1,122 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+// 把旧的文本位姿图(pose_graph.txt + 每个关键帧的_briefdes.dat/_keypoints.txt)转成pose_graph.bin
+// 用法: pose_graph_convert <pose_graph_save_path>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "pose_graph_map.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        printf("usage: pose_graph_convert <pose_graph_save_path>\n"
+               "reads pose_graph.txt and the per keyframe files, writes pose_graph.bin into the same directory\n");
+        return 1;
+    }
+    string dir = argv[1];
+    if (!dir.empty() && dir[dir.size() - 1] != '/')
+        dir += "/";
+
+    string txt_path = dir + "pose_graph.txt";
+    FILE *pFile = fopen(txt_path.c_str(), "r");
+    if (pFile == NULL)
+    {
+        printf("cannot open %s\n", txt_path.c_str());
+        return 1;
+    }
+    vector<PoseGraphMapRecord> records;
+    PoseGraphMapRecord r;
+    while (fscanf(pFile, "%d %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %d %lf %lf %lf %lf %lf %lf %lf %lf %d", &r.index, &r.time_stamp,
+                  &r.vio_T[0], &r.vio_T[1], &r.vio_T[2],
+                  &r.pg_T[0], &r.pg_T[1], &r.pg_T[2],
+                  &r.vio_Q[0], &r.vio_Q[1], &r.vio_Q[2], &r.vio_Q[3],
+                  &r.pg_Q[0], &r.pg_Q[1], &r.pg_Q[2], &r.pg_Q[3],
+                  &r.loop_index,
+                  &r.loop_info[0], &r.loop_info[1], &r.loop_info[2], &r.loop_info[3],
+                  &r.loop_info[4], &r.loop_info[5], &r.loop_info[6], &r.loop_info[7],
+                  &r.keypoints_num) == 26)
+    {
+        records.push_back(r);
+    }
+    fclose(pFile);
+    printf("%d keyframes in %s\n", (int)records.size(), txt_path.c_str());
+
+    // 描述子位数从第一个非空的_briefdes.dat里取
+    int descriptor_bits = 0;
+    for (size_t k = 0; k < records.size() && descriptor_bits == 0; k++)
+    {
+        if (records[k].keypoints_num == 0)
+            continue;
+        ifstream brief_file(dir + to_string(records[k].index) + "_briefdes.dat", ios::binary);
+        boost::dynamic_bitset<> des;
+        if (brief_file >> des)
+            descriptor_bits = des.size();
+    }
+    if (descriptor_bits == 0)
+        descriptor_bits = 256;
+
+    string bin_path = dir + "pose_graph.bin";
+    PoseGraphMapWriter writer;
+    if (!writer.open(bin_path, records, descriptor_bits))
+        return 1;
+    int words = descriptorWords(descriptor_bits);
+    vector<PoseGraphMapKeyPoint> keypoints;
+    vector<uint64_t> descriptors;
+    bool ok = true;
+    for (size_t k = 0; k < records.size() && ok; k++)
+    {
+        int num = records[k].keypoints_num;
+        string brief_path = dir + to_string(records[k].index) + "_briefdes.dat";
+        string keypoints_path = dir + to_string(records[k].index) + "_keypoints.txt";
+        ifstream brief_file(brief_path, ios::binary);
+        FILE *keypoints_file = fopen(keypoints_path.c_str(), "r");
+        if (num > 0 && (!brief_file || keypoints_file == NULL))
+        {
+            printf("missing %s or %s\n", brief_path.c_str(), keypoints_path.c_str());
+            ok = false;
+        }
+        keypoints.resize(num);
+        descriptors.assign(num * words, 0);
+        for (int i = 0; i < num && ok; i++)
+        {
+            boost::dynamic_bitset<> des;
+            PoseGraphMapKeyPoint &p = keypoints[i];
+            if (!(brief_file >> des) || (int)des.size() != descriptor_bits ||
+                fscanf(keypoints_file, "%f %f %f %f", &p.x, &p.y, &p.x_norm, &p.y_norm) != 4)
+            {
+                printf("bad keypoint %d of keyframe %d\n", i, records[k].index);
+                ok = false;
+                break;
+            }
+            packDescriptor(des, &descriptors[i * words]);
+        }
+        if (keypoints_file)
+            fclose(keypoints_file);
+        ok = ok && writer.write(keypoints.data(), descriptors.data(), num);
+    }
+    ok = writer.close() && ok;
+    if (!ok)
+    {
+        printf("convert failed\n");
+        return 1;
+    }
+
+    PoseGraphMapReader map;
+    if (!map.open(bin_path))
+        return 1;
+    printf("wrote %s: %d keyframes, %d bit descriptors\n", bin_path.c_str(), map.size(), map.descriptorBits());
+    return 0;
+}
@@ -0,0 +1,192 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "pose_graph_map.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char POSE_GRAPH_MAP_MAGIC[8] = "VINSPGM";
+static const uint32_t POSE_GRAPH_MAP_ENDIAN = 0x01020304;
+
+static uint64_t blockSize(int keypoints_num, int descriptor_words)
+{
+    return (uint64_t)keypoints_num * (sizeof(PoseGraphMapKeyPoint) + descriptor_words * sizeof(uint64_t));
+}
+
+PoseGraphMapWriter::PoseGraphMapWriter()
+    : file(NULL), written(0), descriptor_words(0), ok(false)
+{
+}
+
+PoseGraphMapWriter::~PoseGraphMapWriter()
+{
+    if (file)
+        fclose(file);
+}
+
+bool PoseGraphMapWriter::open(const std::string &path, std::vector<PoseGraphMapRecord> &records, int descriptor_bits)
+{
+    // 先写到临时文件，close时再rename，保存中途退出不会留下半个地图
+    file_path = path;
+    file = fopen((path + ".tmp").c_str(), "wb");
+    if (file == NULL)
+    {
+        printf("pose graph map: cannot open %s.tmp for writing\n", path.c_str());
+        return false;
+    }
+    descriptor_words = descriptorWords(descriptor_bits);
+
+    PoseGraphMapHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, POSE_GRAPH_MAP_MAGIC, sizeof(header.magic));
+    header.version = POSE_GRAPH_MAP_VERSION;
+    header.endian = POSE_GRAPH_MAP_ENDIAN;
+    header.keyframe_num = records.size();
+    header.descriptor_bits = descriptor_bits;
+
+    uint64_t offset = sizeof(PoseGraphMapHeader) + records.size() * sizeof(PoseGraphMapRecord);
+    keypoints_num.resize(records.size());
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        records[i].reserved = 0;
+        records[i].data_offset = offset;
+        keypoints_num[i] = records[i].keypoints_num;
+        header.keypoints_total += records[i].keypoints_num;
+        offset += blockSize(records[i].keypoints_num, descriptor_words);
+    }
+    header.file_size = offset;
+
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (ok && !records.empty())
+        ok = fwrite(records.data(), sizeof(PoseGraphMapRecord), records.size(), file) == records.size();
+    written = 0;
+    return ok;
+}
+
+bool PoseGraphMapWriter::write(const PoseGraphMapKeyPoint *keypoints, const uint64_t *descriptors, int num)
+{
+    if (!ok || written >= (int)keypoints_num.size() || num != keypoints_num[written])
+    {
+        printf("pose graph map: keyframe %d does not match its record\n", written);
+        ok = false;
+        return false;
+    }
+    if (num > 0)
+    {
+        ok = fwrite(keypoints, sizeof(PoseGraphMapKeyPoint), num, file) == (size_t)num &&
+             fwrite(descriptors, sizeof(uint64_t), (size_t)num * descriptor_words, file) == (size_t)num * descriptor_words;
+    }
+    written++;
+    return ok;
+}
+
+bool PoseGraphMapWriter::close()
+{
+    if (file == NULL)
+        return false;
+    ok = ok && written == (int)keypoints_num.size();
+    ok = (fclose(file) == 0) && ok;
+    file = NULL;
+    std::string tmp_path = file_path + ".tmp";
+    if (!ok)
+    {
+        printf("pose graph map: failed to write %s\n", file_path.c_str());
+        remove(tmp_path.c_str());
+        return false;
+    }
+    if (rename(tmp_path.c_str(), file_path.c_str()) != 0)
+    {
+        printf("pose graph map: cannot rename %s\n", tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+PoseGraphMapReader::PoseGraphMapReader()
+    : data(NULL), data_size(0), header(NULL), records(NULL)
+{
+}
+
+PoseGraphMapReader::~PoseGraphMapReader()
+{
+    close();
+}
+
+bool PoseGraphMapReader::open(const std::string &path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(PoseGraphMapHeader))
+    {
+        ::close(fd);
+        printf("pose graph map: %s is too small\n", path.c_str());
+        return false;
+    }
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+    {
+        printf("pose graph map: cannot mmap %s\n", path.c_str());
+        return false;
+    }
+    // 加载时会扫一遍整个文件，提前读进页缓存
+    madvise(addr, st.st_size, MADV_WILLNEED);
+    data = static_cast<const char *>(addr);
+    data_size = st.st_size;
+    header = reinterpret_cast<const PoseGraphMapHeader *>(data);
+    records = reinterpret_cast<const PoseGraphMapRecord *>(data + sizeof(PoseGraphMapHeader));
+    if (!validate())
+    {
+        printf("pose graph map: %s is not a valid version %d map\n", path.c_str(), POSE_GRAPH_MAP_VERSION);
+        close();
+        return false;
+    }
+    return true;
+}
+
+void PoseGraphMapReader::close()
+{
+    if (data)
+        munmap(const_cast<char *>(data), data_size);
+    data = NULL;
+    data_size = 0;
+    header = NULL;
+    records = NULL;
+}
+
+bool PoseGraphMapReader::validate()
+{
+    if (memcmp(header->magic, POSE_GRAPH_MAP_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != POSE_GRAPH_MAP_VERSION ||
+        header->endian != POSE_GRAPH_MAP_ENDIAN ||
+        header->file_size != data_size ||
+        header->descriptor_bits == 0)
+        return false;
+    uint64_t offset = sizeof(PoseGraphMapHeader) + (uint64_t)header->keyframe_num * sizeof(PoseGraphMapRecord);
+    if (offset > data_size)
+        return false;
+    // 只看偏移和长度，保证后面按记录取指针不会越界
+    int words = descriptorWords();
+    for (uint32_t i = 0; i < header->keyframe_num; i++)
+    {
+        const PoseGraphMapRecord &r = records[i];
+        if (r.keypoints_num < 0 || r.data_offset != offset)
+            return false;
+        offset += blockSize(r.keypoints_num, words);
+        if (offset > data_size)
+            return false;
+    }
+    return offset == data_size;
+}
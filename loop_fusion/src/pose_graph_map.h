@@ -0,0 +1,114 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "packed_descriptors.h"
+
+// 单文件二进制位姿图地图(pose_graph.bin)，加载时整个文件mmap进来，不做解析。
+// 布局(小端，所有段8字节对齐):
+//   PoseGraphMapHeader
+//   PoseGraphMapRecord[keyframe_num]
+//   每个关键帧一段: PoseGraphMapKeyPoint[keypoints_num]，然后uint64_t[keypoints_num * descriptor_words]
+// 记录里的data_offset是该段相对文件头的偏移。
+// 格式变化时增加POSE_GRAPH_MAP_VERSION，旧版本文件直接拒绝，用pose_graph_convert从文本重新生成
+
+#define POSE_GRAPH_MAP_VERSION 1
+
+struct PoseGraphMapHeader
+{
+    char magic[8];              // "VINSPGM"
+    uint32_t version;
+    uint32_t endian;            // 0x01020304，读的时候检查字节序
+    uint32_t keyframe_num;
+    uint32_t descriptor_bits;   // BRIEF是256
+    uint64_t keypoints_total;
+    uint64_t file_size;
+};
+
+struct PoseGraphMapRecord
+{
+    int32_t index;
+    int32_t loop_index;
+    int32_t keypoints_num;
+    int32_t reserved;
+    double time_stamp;
+    double vio_T[3];
+    double vio_Q[4];            // w x y z
+    double pg_T[3];
+    double pg_Q[4];             // w x y z
+    double loop_info[8];
+    uint64_t data_offset;
+};
+
+struct PoseGraphMapKeyPoint
+{
+    float x, y;                 // 像素坐标
+    float x_norm, y_norm;       // 归一化平面坐标
+};
+
+static_assert(sizeof(PoseGraphMapHeader) == 40, "PoseGraphMapHeader layout changed");
+static_assert(sizeof(PoseGraphMapRecord) == 208, "PoseGraphMapRecord layout changed");
+static_assert(sizeof(PoseGraphMapKeyPoint) == 16, "PoseGraphMapKeyPoint layout changed");
+
+// 顺序写: open时给出所有记录(keypoints_num要填好，data_offset由这里算)，
+// 然后按记录顺序对每个关键帧调用一次write，最后close
+class PoseGraphMapWriter
+{
+  public:
+    PoseGraphMapWriter();
+    ~PoseGraphMapWriter();
+    bool open(const std::string &path, std::vector<PoseGraphMapRecord> &records, int descriptor_bits);
+    bool write(const PoseGraphMapKeyPoint *keypoints, const uint64_t *descriptors, int keypoints_num);
+    bool close();
+
+  private:
+    FILE *file;
+    std::string file_path;
+    std::vector<int> keypoints_num;
+    int written;
+    int descriptor_words;
+    bool ok;
+};
+
+// 只读mmap，对象析构时munmap，取出的指针在此之前有效
+class PoseGraphMapReader
+{
+  public:
+    PoseGraphMapReader();
+    ~PoseGraphMapReader();
+    bool open(const std::string &path);
+    void close();
+
+    int size() const { return header->keyframe_num; }
+    int descriptorBits() const { return header->descriptor_bits; }
+    int descriptorWords() const { return ::descriptorWords(header->descriptor_bits); }
+    const PoseGraphMapRecord &record(int i) const { return records[i]; }
+    const PoseGraphMapKeyPoint *keypoints(int i) const
+    {
+        return reinterpret_cast<const PoseGraphMapKeyPoint *>(data + records[i].data_offset);
+    }
+    const uint64_t *descriptors(int i) const
+    {
+        return reinterpret_cast<const uint64_t *>(data + records[i].data_offset +
+                                                  records[i].keypoints_num * sizeof(PoseGraphMapKeyPoint));
+    }
+
+  private:
+    bool validate();
+
+    const char *data;
+    size_t data_size;
+    const PoseGraphMapHeader *header;
+    const PoseGraphMapRecord *records;
+};
@@ -30,6 +30,7 @@
 #include "keyframe.h"
 #include "utility/tic_toc.h"
 #include "pose_graph.h"
+#include "brief_service.h"
 #include "utility/CameraPoseVisualization.h"
 #include "parameters.h"
 #define SKIP_FIRST_CNT 10
@@ -65,6 +66,13 @@ ros::Publisher pub_camera_pose_visual;
 ros::Publisher pub_odometry_rect;
 
 std::string BRIEF_PATTERN_FILE;
+int BRIEF_THREADS;
+int MATCH_THREADS;
+double LOOP_MATCH_RATIO;
+double LOOP_SEARCH_RADIUS;
+BriefService *brief_service;
+std::queue<std::future<KeyFrame*>> extracting;//已交给BriefService、还没加入位姿图的关键帧
+std::mutex m_extracting;//保护extracting，也保证关键帧按提交顺序加入位姿图
 std::string POSE_GRAPH_SAVE_PATH;
 std::string VINS_RESULT_PATH;
 CameraPoseVisualization cameraposevisual(1, 0, 0, 1);
@@ -244,10 +252,29 @@ void extrinsic_callback(const nav_msgs::Odometry::ConstPtr &pose_msg)
     //std::cout<<"callback tic="<<tic<<"  qic="<<qic<<std::endl;
 }
 
+// 描述子已经算好的关键帧按提交顺序加入位姿图，wait为true时等所有提交的关键帧算完再加入
+void addExtractedKeyFrames(bool wait)
+{
+    m_extracting.lock();
+    while (!extracting.empty() &&
+           (wait || extracting.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready))
+    {
+        KeyFrame* keyframe = extracting.front().get();
+        extracting.pop();
+        m_process.lock();
+        start_flag = 1;
+        posegraph.addKeyFrame(keyframe, 1);//第二个参数代表是需要回环检测detect_loop 提取的FAST特征点
+        m_process.unlock();
+    }
+    m_extracting.unlock();
+}
+
 void process()
 {
     while (true)
     {
+        addExtractedKeyFrames(false);
+
         sensor_msgs::ImageConstPtr image_msg = NULL;
         sensor_msgs::PointCloudConstPtr point_msg = NULL;
         nav_msgs::Odometry::ConstPtr pose_msg = NULL;
@@ -366,12 +393,12 @@ void process()
 
                 }
 
+                // fast特征点和描述子(用于DBW2中的query)在BriefService的工作线程里算，这里不等
                 KeyFrame* keyframe = new KeyFrame(pose_msg->header.stamp.toSec(), frame_index, T, R, image,
-                                   point_3d, point_2d_uv, point_2d_normal, point_id, sequence);   //应该是生成fast特征点了，用于DBW2中的query
-                m_process.lock();
-                start_flag = 1;
-                posegraph.addKeyFrame(keyframe, 1);//第二个参数代表是需要回环检测detect_loop 提取的FAST特征点
-                m_process.unlock();
+                                   point_3d, point_2d_uv, point_2d_normal, point_id, sequence, false);
+                m_extracting.lock();
+                extracting.push(brief_service->submit(keyframe));
+                m_extracting.unlock();
                 frame_index++;
                 last_t = T;
             }
@@ -388,6 +415,7 @@ void command()
         char c = getchar();
         if (c == 's')
         {
+            addExtractedKeyFrames(true);//还在提取描述子的关键帧也要存进地图
             m_process.lock();
             posegraph.savePoseGraph();
             m_process.unlock();
@@ -463,6 +491,16 @@ int main(int argc, char **argv)
     fsSettings["pose_graph_save_path"] >> POSE_GRAPH_SAVE_PATH;
     fsSettings["output_path"] >> VINS_RESULT_PATH;
     fsSettings["save_image"] >> DEBUG_IMAGE;
+    BRIEF_THREADS = fsSettings["brief_threads"];
+    if (BRIEF_THREADS <= 0)
+        BRIEF_THREADS = 1;
+    MATCH_THREADS = fsSettings["match_threads"];
+    if (MATCH_THREADS <= 0)
+        MATCH_THREADS = 2;
+    LOOP_MATCH_RATIO = fsSettings["loop_match_ratio"];
+    if (LOOP_MATCH_RATIO <= 0 || LOOP_MATCH_RATIO > 1)
+        LOOP_MATCH_RATIO = 1;
+    LOOP_SEARCH_RADIUS = fsSettings["loop_search_radius"];
 
     LOAD_PREVIOUS_POSE_GRAPH = fsSettings["load_previous_pose_graph"];
     VINS_RESULT_PATH = VINS_RESULT_PATH + "/vio_loop.csv";
@@ -504,6 +542,7 @@ int main(int argc, char **argv)
     std::thread measurement_process;
     std::thread keyboard_command_process;
 
+    brief_service = new BriefService(BRIEF_THREADS);
     measurement_process = std::thread(process);
     keyboard_command_process = std::thread(command);
     //有一个全局优化线程t_optimization = std::thread(&PoseGraph::optimize4DoF, this);
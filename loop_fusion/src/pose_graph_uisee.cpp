@@ -1422,19 +1422,18 @@ void PoseGraph::savePoseGraph()
 {
     m_keyframelist.lock();
     TicToc tmp_t;
-    FILE *pFile;
     printf("pose graph path: %s\n",POSE_GRAPH_SAVE_PATH.c_str());
     printf("pose graph saving... \n");
-    string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.txt";
-    pFile = fopen (file_path.c_str(),"w");
-    //fprintf(pFile, "index time_stamp Tx Ty Tz Qw Qx Qy Qz loop_index loop_info\n");
+    string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.bin";
+    vector<PoseGraphMapRecord> records;
+    records.reserve(keyframelist.size());
+    int descriptor_bits = 0;
     list<KeyFrame*>::iterator it;
     for (it = keyframelist.begin(); it != keyframelist.end(); it++)
     {
-        std::string image_path, descriptor_path, brief_path, keypoints_path;
         if (DEBUG_IMAGE)
         {
-            image_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_image.png";
+            std::string image_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_image.png";
             imwrite(image_path.c_str(), (*it)->image);
         }
         Quaterniond VIO_tmp_Q{(*it)->vio_R_w_i};
@@ -1442,39 +1441,125 @@ void PoseGraph::savePoseGraph()
         Vector3d VIO_tmp_T = (*it)->vio_T_w_i;
         Vector3d PG_tmp_T = (*it)->T_w_i;
 
-        fprintf (pFile, " %d %f %f %f %f %f %f %f %f %f %f %f %f %f %f %f %d %f %f %f %f %f %f %f %f %d\n",(*it)->index, (*it)->time_stamp, 
-                                    VIO_tmp_T.x(), VIO_tmp_T.y(), VIO_tmp_T.z(), 
-                                    PG_tmp_T.x(), PG_tmp_T.y(), PG_tmp_T.z(), 
-                                    VIO_tmp_Q.w(), VIO_tmp_Q.x(), VIO_tmp_Q.y(), VIO_tmp_Q.z(), 
-                                    PG_tmp_Q.w(), PG_tmp_Q.x(), PG_tmp_Q.y(), PG_tmp_Q.z(), 
-                                    (*it)->loop_index, 
-                                    (*it)->loop_info(0), (*it)->loop_info(1), (*it)->loop_info(2), (*it)->loop_info(3),
-                                    (*it)->loop_info(4), (*it)->loop_info(5), (*it)->loop_info(6), (*it)->loop_info(7),
-                                    (int)(*it)->keypoints.size());
-
-        // write keypoints, brief_descriptors   vector<cv::KeyPoint> keypoints vector<BRIEF::bitset> brief_descriptors;
+        PoseGraphMapRecord r;
+        r.index = (*it)->index;
+        r.loop_index = (*it)->loop_index;
+        r.keypoints_num = (*it)->keypoints.size();
+        r.time_stamp = (*it)->time_stamp;
+        for (int k = 0; k < 3; k++)
+        {
+            r.vio_T[k] = VIO_tmp_T(k);
+            r.pg_T[k] = PG_tmp_T(k);
+        }
+        r.vio_Q[0] = VIO_tmp_Q.w(); r.vio_Q[1] = VIO_tmp_Q.x(); r.vio_Q[2] = VIO_tmp_Q.y(); r.vio_Q[3] = VIO_tmp_Q.z();
+        r.pg_Q[0] = PG_tmp_Q.w(); r.pg_Q[1] = PG_tmp_Q.x(); r.pg_Q[2] = PG_tmp_Q.y(); r.pg_Q[3] = PG_tmp_Q.z();
+        for (int k = 0; k < 8; k++)
+            r.loop_info[k] = (*it)->loop_info(k);
+        records.push_back(r);
+
         assert((*it)->keypoints.size() == (*it)->brief_descriptors.size());
-        brief_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_briefdes.dat";
-        std::ofstream brief_file(brief_path, std::ios::binary);
-        keypoints_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_keypoints.txt";
-        FILE *keypoints_file;
-        keypoints_file = fopen(keypoints_path.c_str(), "w");
-        for (int i = 0; i < (int)(*it)->keypoints.size(); i++)
+        if (descriptor_bits == 0 && !(*it)->brief_descriptors.empty())
+            descriptor_bits = (*it)->brief_descriptors[0].size();
+    }
+    if (descriptor_bits == 0)
+        descriptor_bits = 256;
+
+    // write keypoints, brief_descriptors   vector<cv::KeyPoint> keypoints vector<BRIEF::bitset> brief_descriptors;
+    PoseGraphMapWriter writer;
+    bool ok = writer.open(file_path, records, descriptor_bits);
+    int words = descriptorWords(descriptor_bits);
+    vector<PoseGraphMapKeyPoint> keypoints;
+    vector<uint64_t> descriptors;
+    for (it = keyframelist.begin(); ok && it != keyframelist.end(); it++)
+    {
+        int num = (*it)->keypoints.size();
+        keypoints.resize(num);
+        descriptors.resize(num * words);
+        for (int i = 0; i < num; i++)
         {
-            brief_file << (*it)->brief_descriptors[i] << endl;
-            fprintf(keypoints_file, "%f %f %f %f\n", (*it)->keypoints[i].pt.x, (*it)->keypoints[i].pt.y, 
-                                                     (*it)->keypoints_norm[i].pt.x, (*it)->keypoints_norm[i].pt.y);
+            keypoints[i].x = (*it)->keypoints[i].pt.x;
+            keypoints[i].y = (*it)->keypoints[i].pt.y;
+            keypoints[i].x_norm = (*it)->keypoints_norm[i].pt.x;
+            keypoints[i].y_norm = (*it)->keypoints_norm[i].pt.y;
+            packDescriptor((*it)->brief_descriptors[i], &descriptors[i * words]);
         }
-        brief_file.close();
-        fclose(keypoints_file);
+        ok = writer.write(keypoints.data(), descriptors.data(), num);
     }
-    fclose(pFile);
+    ok = writer.close() && ok;
+    if (!ok)
+        printf("save pose graph failed: %s\n", file_path.c_str());
 
     printf("save pose graph time: %f s\n", tmp_t.toc() / 1000);
     m_keyframelist.unlock();
 }
+
+void PoseGraph::loadPoseGraphMap(const PoseGraphMapReader &map)
+{
+    TicToc tmp_t;
+    int bits = map.descriptorBits();
+    int words = map.descriptorWords();
+    int cnt = 0;
+    for (int k = 0; k < map.size(); k++)
+    {
+        const PoseGraphMapRecord &r = map.record(k);
+        cv::Mat image;
+        if (DEBUG_IMAGE)
+        {
+            std::string image_path = POSE_GRAPH_SAVE_PATH + to_string(r.index) + "_image.png";
+            image = cv::imread(image_path.c_str(), 0);
+        }
+
+        Vector3d VIO_T(r.vio_T[0], r.vio_T[1], r.vio_T[2]);
+        Vector3d PG_T(r.pg_T[0], r.pg_T[1], r.pg_T[2]);
+        Matrix3d VIO_R = Quaterniond(r.vio_Q[0], r.vio_Q[1], r.vio_Q[2], r.vio_Q[3]).toRotationMatrix();
+        Matrix3d PG_R = Quaterniond(r.pg_Q[0], r.pg_Q[1], r.pg_Q[2], r.pg_Q[3]).toRotationMatrix();
+        Eigen::Matrix<double, 8, 1 > loop_info(r.loop_info);
+        int loop_index = r.loop_index;
+
+        if (loop_index != -1)
+            if (earliest_loop_index > loop_index || earliest_loop_index == -1)
+            {
+                earliest_loop_index = loop_index;
+            }
+
+        const PoseGraphMapKeyPoint *pts = map.keypoints(k);
+        const uint64_t *des = map.descriptors(k);
+        vector<cv::KeyPoint> keypoints(r.keypoints_num);
+        vector<cv::KeyPoint> keypoints_norm(r.keypoints_num);
+        vector<BRIEF::bitset> brief_descriptors(r.keypoints_num);
+        for (int i = 0; i < r.keypoints_num; i++)
+        {
+            keypoints[i].pt.x = pts[i].x;
+            keypoints[i].pt.y = pts[i].y;
+            keypoints_norm[i].pt.x = pts[i].x_norm;
+            keypoints_norm[i].pt.y = pts[i].y_norm;
+            unpackDescriptor(des + i * words, bits, brief_descriptors[i]);
+        }
+
+        KeyFrame* keyframe = new KeyFrame(r.time_stamp, r.index, VIO_T, VIO_R, PG_T, PG_R, image, loop_index, loop_info, keypoints, keypoints_norm, brief_descriptors);
+        loadKeyFrame(keyframe, 0);
+        if (cnt % 20 == 0)
+        {
+            publish_uisee();
+        }
+        cnt++;
+    }
+    printf("load pose graph time: %f s\n", tmp_t.toc()/1000);
+    base_sequence = 0;
+}
+
 void PoseGraph::loadPoseGraph()
 {
+    // 优先读二进制地图，没有的话按旧的文本格式读(可以用pose_graph_convert转成二进制)
+    string map_path = POSE_GRAPH_SAVE_PATH + "pose_graph.bin";
+    PoseGraphMapReader map;
+    if (map.open(map_path))
+    {
+        printf("lode pose graph from: %s, %d keyframes\n", map_path.c_str(), map.size());
+        loadPoseGraphMap(map);
+        return;
+    }
+
     TicToc tmp_t;
     FILE * pFile;
     string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.txt";
@@ -30,6 +30,7 @@
 #include "utility/utility.h"
 #include "utility/CameraPoseVisualization.h"
 #include "utility/tic_toc.h"
+#include "pose_graph_map.h"
 #include "ThirdParty/DBoW/DBoW2.h"
 #include "ThirdParty/DVision/DVision.h"
 #include "ThirdParty/DBoW/TemplatedDatabase.h"
@@ -72,6 +73,7 @@ public:
 
 private:
 	int detectLoop(KeyFrame* keyframe, int frame_index);
+	void loadPoseGraphMap(const PoseGraphMapReader &map);
 	void addKeyFrameIntoVoc_uisee(KeyFrame* keyframe);
 	void optimize4DoF();
 	void optimize6DoF();
@@ -0,0 +1,33 @@
+#!/bin/bash
+# 不同solver_threads下的求解耗时对比
+# 用法: ./run_kaist_solver_threads.sh config.yaml sequence_path output_path [threads...]
+# 例如: ./run_kaist_solver_threads.sh /home/q/linux/code/vins_fusion_ws/src/vins-fusion/config/kaist/kaist_cam0_viwo_38-39.yaml /home/q_ftp/DataSet1/KAIST/kaist39/ /home/qcx/linux/output/threads/ 1 2 4 8
+yamlPath="$1"
+sequencePath="$2"
+pathWrite="$3"
+shift 3
+threads="$@"
+if [ -z "$threads" ]; then
+    threads="1 2 4 8"
+fi
+
+for n in $threads
+do
+    echo "run solver_threads $n ----------------------"
+    mkdir -p "$pathWrite"/threads_$n/
+    yamlTmp="$pathWrite"/threads_$n/config.yaml
+    # 在原配置后面追加solver_threads，相机内参等相对路径仍按原配置目录查找
+    cp "$yamlPath" "$yamlTmp"
+    printf "\nsolver_threads: %d\n" "$n" >> "$yamlTmp"
+    for f in $(dirname "$yamlPath")/*.yaml
+    do
+        [ "$f" != "$yamlPath" ] && cp "$f" "$pathWrite"/threads_$n/
+    done
+    ./kaist_viwo "$yamlTmp" "$sequencePath" "$pathWrite"/threads_$n/ | tee "$pathWrite"/threads_$n/log.txt | grep "solver threads"
+done
+
+echo "summary ----------------------"
+for n in $threads
+do
+    grep "solver threads" "$pathWrite"/threads_$n/log.txt
+done
@@ -176,14 +176,14 @@ int main(int argc, char** argv)
                     if(readWheels(wheels_file_st,wheels_time,last_wheels_time,wheels_cnt,vel,ang_vel))//文件流 时间 轮编码计数 轮速 角速度
                     {
 //                        cout<<setprecision(17)<<wheels_time<<"\tlinearVel="<<vel<<"\todomAngleVel= "<<ang_vel<<endl;
-                        if(SHOW_MESSAGE)
+                        if(DIAG(DIAG_MESSAGE))
                             cout<<setprecision(17)<<vel<<"  ";
                         Eigen::Vector3d velVec(vel,0,0);
                         estimator.inputVEL(wheels_time, velVec, ang_vel);
                     }
                     else break;
             }
-            if(SHOW_MESSAGE)
+            if(DIAG(DIAG_MESSAGE))
                 cout<<endl;
             while(gps_time < imu_time)
             {
@@ -197,7 +197,7 @@ int main(int argc, char** argv)
                 else if(state==0)
                     break;
             }
-            if(SHOW_MESSAGE)
+            if(DIAG(DIAG_MESSAGE))
                 printf("\nprocess image %d with time:%f\n", (int)i,vTimestamps[i]);
             leftImagePath = vstrImageFilenames0[i];
             rightImagePath = vstrImageFilenames1[i];
@@ -229,7 +229,7 @@ int main(int argc, char** argv)
 
             Eigen::Vector3d vel_est;
             estimator.getVelInWorldFrame(vel_est);
-            if(SHOW_MESSAGE)
+            if(DIAG(DIAG_MESSAGE))
                 std::cout<<"vel_estimator = "<<vel_est.transpose() <<"  norm= "<<vel_est.norm()<<std::endl;
             Eigen::Matrix<double, 4, 4> pose;
             estimator.getPoseInWorldFrame(pose);
@@ -10,10 +10,23 @@
 #include "estimator.h"//估计器
 #include "../utility/visualization.h"
 
-Estimator::Estimator(): f_manager{Rs}
+Estimator::Estimator(): imuBuf(IMU_BUF_SIZE), velBuf(VEL_BUF_SIZE),
+                         featureBuf(FEATURE_BUF_SIZE), imageBuf(IMAGE_BUF_SIZE), f_manager{Rs},
+                         frame_cache(para_Pose, para_Ex_Pose[0])
 {
     ROS_INFO("init begins");
     initThreadFlag = false;
+    processExit = false;
+    inputOverflow = false;
+    restartRequest = false;
+    log_imu = log_imu_int = log_ece = log_init_pose = log_odometry = -1;
+    bias_repropagate_cnt = 0;
+    for (int i = 0; i < WINDOW_SIZE + 1; i++)
+        pre_integrations[i] = nullptr;
+    tmp_pre_integration = nullptr;
+    problem = nullptr;
+    loss_function = new ceres::HuberLoss(1.0);
+    //loss_function = new ceres::CauchyLoss(1.0 / FOCAL_LENGTH);
     clearState();
 }
 
@@ -21,20 +34,37 @@ Estimator::~Estimator()
 {
     if (MULTIPLE_THREAD)
     {
+        processExit = true;
+        notifyProcess();
+        mTrack.lock();
+        mTrack.unlock();
+        conTrack.notify_all();
+        if (PIPELINE)
+            trackThread.join();
         processThread.join();
         printf("join thread \n");
     }
+    if (solve_stat.cnt > 0)
+        printf("solver threads %d: solve average %f ms max %f ms, marginalization average %f ms, %d frames\n",
+               SOLVER_THREADS, solve_stat.average(), solve_stat.max, margin_stat.average(), solve_stat.cnt);
+    if (USE_IMU)
+        printf("preintegration repropagated %d times on bias drift, %d preintegration blocks allocated\n",
+               bias_repropagate_cnt, integration_pool.allocCount());
+    resetProblem();
+    delete loss_function;
 }
 
 void Estimator::clearState()
 {
     mProcess.lock();
-    while(!accBuf.empty())
-        accBuf.pop();
-    while(!gyrBuf.empty())
-        gyrBuf.pop();
+    //在处理线程里调用，队列里的帧还没被取走，可以还给framePool
+    imuBuf.clear();
+    velBuf.clear();
     while(!featureBuf.empty())
+    {
+        framePool.release(featureBuf.front());
         featureBuf.pop();
+    }
 
     prevTime = -1;
     curTime = 0;
@@ -56,10 +86,7 @@ void Estimator::clearState()
         angular_velocity_buf[i].clear();
         vel_velocity_buf[i].clear();
 
-        if (pre_integrations[i] != nullptr)
-        {
-            delete pre_integrations[i];
-        }
+        integration_pool.release(pre_integrations[i]);
         pre_integrations[i] = nullptr;
     }
 
@@ -75,16 +102,21 @@ void Estimator::clearState()
     frame_count = 0;
     solver_flag = INITIAL;
     initial_timestamp = 0;
+    for (auto &it : all_image_frame)
+        integration_pool.release(it.second.pre_integration);
     all_image_frame.clear();
 
-    if (tmp_pre_integration != nullptr)
-        delete tmp_pre_integration;
+    integration_pool.release(tmp_pre_integration);
     if (last_marginalization_info != nullptr)
         delete last_marginalization_info;
 
     tmp_pre_integration = nullptr;
     last_marginalization_info = nullptr;
     last_marginalization_parameter_blocks.clear();
+    resetProblem();
+    budget.reset();
+    frame_solve_time = frame_margin_time = 0;
+    opt_feature_cnt = 0;
 
     f_manager.clearState();
 
@@ -106,6 +138,8 @@ void Estimator::setParameter()
     riv = RIV[0];
     cout << " exitrinsic vel "  << endl  <<"riv"<<endl <<riv << endl <<"tiv"<<endl<< tiv.transpose() << endl;
     f_manager.setRic(ric);
+    f_manager.setThreadPool(&MarginalizationInfo::threadPool());//和边缘化共用，都在处理线程里调用
+    //sqrt_info是静态成员，只在这里(持有mProcess)写，求解时多个线程只读
     ProjectionTwoFrameOneCamFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
     ProjectionTwoFrameTwoCamFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
     ProjectionOneFrameTwoCamFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
@@ -113,12 +147,21 @@ void Estimator::setParameter()
     g = G;
     cout << "set g " << g.transpose() << endl;
     featureTracker.readIntrinsicParameter(CAM_NAMES);
+    openLogFiles();
+    budget.setParameter(FRAME_DEADLINE, MIN_OPT_FEATURES);
+    //构造时配置还没读，第一次setParameter(订阅传感器之前)按配置放大缓冲区，之后容量不再变
+    if (imuBuf.capacity() < (size_t)IMU_BUF_SIZE)
+        imuBuf.reset(IMU_BUF_SIZE);
+    if (velBuf.capacity() < (size_t)VEL_BUF_SIZE)
+        velBuf.reset(VEL_BUF_SIZE);
 
     std::cout << "MULTIPLE_THREAD is " << MULTIPLE_THREAD << '\n';
     if (MULTIPLE_THREAD && !initThreadFlag)
     {
         initThreadFlag = true;
         processThread = std::thread(&Estimator::processMeasurements, this);
+        if (PIPELINE)
+            trackThread = std::thread(&Estimator::processTrack, this);
     }
     mProcess.unlock();
 }
@@ -144,6 +187,7 @@ void Estimator::changeSensorType(int use_imu, int use_stereo)
                 if (last_marginalization_info != nullptr)
                     delete last_marginalization_info;
 
+                integration_pool.release(tmp_pre_integration);
                 tmp_pre_integration = nullptr;
                 last_marginalization_info = nullptr;
                 last_marginalization_parameter_blocks.clear();
@@ -151,16 +195,12 @@ void Estimator::changeSensorType(int use_imu, int use_stereo)
         }
 
         STEREO = use_stereo;
+        resetProblem();//参数块随传感器配置变化，重建problem
         printf("use imu %d use stereo %d\n", USE_IMU, STEREO);
     }
     mProcess.unlock();
     if(restart)
-    {
-        clearState();
-        setParameter();
-
-    }
-    mProcess.unlock();
+        requestRestart();
 }
 //time img0,img1
 void Estimator::inputImage(double t, const cv::Mat &_img, const cv::Mat &_img1)
@@ -170,15 +210,32 @@ void Estimator::inputImage(double t, const cv::Mat &_img, const cv::Mat &_img1)
 //        cout<<"PS\n"<<pos<<endl;
 //    }
     inputImageCnt++;
-    map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> featureFrame;//map是键-值对的集合，可以理解为关联数组 pair是将2个数据组合成一组数据
+    if(PIPELINE)
+    {
+        //交给trackThread跟踪，队列满时在这里等待
+        std::unique_lock<std::mutex> lk(mTrack);
+        TicToc t_stall;
+        conTrack.wait(lk, [&]{ return (int)imageBuf.size() < PIPELINE_QUEUE_SIZE || processExit; });
+        input_stall_stat.add(t_stall.toc());
+        ImageInput input;
+        input.t = t;
+        input.img0 = _img;
+        input.img1 = _img1;
+        input.t_queue.tic();
+        imageBuf.push(input);
+        lk.unlock();
+        conTrack.notify_all();
+        return;
+    }
+
+    FeatureFrame *featureFrame = framePool.acquire();//从池里取，processImage之后还回去
     TicToc featureTrackerTime;//时间
 
     //计算特征点,先跟踪特征点，再计算新的特征点
-    if(_img1.empty())
-        featureFrame = featureTracker.trackImage(t, _img);
-    else
-        featureFrame = featureTracker.trackImage(t, _img, _img1);//左目camera_id=0.右目camera_id=1
+    featureTracker.trackImage(t, _img, _img1, *featureFrame);//左目camera_id=0.右目camera_id=1
     //printf("featureTracker time: %f\n", featureTrackerTime.toc());
+    if(!MULTIPLE_THREAD)
+        budget.addTrack(featureTrackerTime.toc());//单线程时跟踪也算在每帧的预算里
 
     if (SHOW_TRACK)
     {
@@ -190,33 +247,102 @@ void Estimator::inputImage(double t, const cv::Mat &_img, const cv::Mat &_img1)
     {
         if(inputImageCnt % 2 == 0)
         {
-            mBuf.lock();
-            featureBuf.push(make_pair(t, featureFrame));
-            mBuf.unlock();
+            if(!featureBuf.push(featureFrame))
+            {
+                ROS_WARN_THROTTLE(1.0, "feature buffer full, drop image %f", t);
+                framePool.release(featureFrame);
+            }
+            notifyProcess();
         }
+        else
+            framePool.release(featureFrame);
     }
     else
     {
-        mBuf.lock();
-        featureBuf.push(make_pair(t, featureFrame));//push入featureBuf队列 这个队列的成员对象一直是一个  t是时间戳，featureframe是特征点数据组
-        mBuf.unlock();
+        featureBuf.push(featureFrame);//push入featureBuf队列 featureFrame里带有时间戳t和特征点数据
         //cout<<"size featureBuf"<<featureBuf.size()<<endl;
         TicToc processTime;
         processMeasurements();//重要，应该是计算位姿的
-        if(SHOW_MESSAGE)
+        if(DIAG(DIAG_MESSAGE))
             printf("process time_change: %f\n", processTime.toc());
     }
 
 }
 
+//PIPELINE模式下的跟踪线程
+void Estimator::processTrack()
+{
+    while (1)
+    {
+        std::unique_lock<std::mutex> lk(mTrack);
+        conTrack.wait(lk, [&]{ return !imageBuf.empty() || processExit; });
+        if (processExit)
+            return;
+        lk.unlock();
+
+        ImageInput &slot = imageBuf.front();
+        double t = slot.t;
+        cv::Mat img0 = slot.img0, img1 = slot.img1;
+        double queue_time = slot.t_queue.toc();
+        slot.img0.release();//图像由本线程持有，不留在环形缓冲区里
+        slot.img1.release();
+        lk.lock();
+        imageBuf.pop();
+        image_queue_stat.add(queue_time);
+        lk.unlock();
+        conTrack.notify_all();
+
+        TicToc t_track;
+        FeatureFrame *featureFrame = framePool.acquire();
+        featureTracker.trackImage(t, img0, img1, *featureFrame);
+        double track_time = t_track.toc();
+
+        if (SHOW_TRACK)
+        {
+            cv::Mat imgTrack = featureTracker.getTrackImage();
+            pubTrackImage(imgTrack, t);
+        }
+
+        //后端跟不上时阻塞在这里
+        lk.lock();
+        track_stat.add(track_time);
+        TicToc t_stall;
+        conTrack.wait(lk, [&]{ return (int)featureBuf.size() < PIPELINE_QUEUE_SIZE || processExit; });
+        track_stall_stat.add(t_stall.toc());
+        if (processExit)
+        {
+            framePool.release(featureFrame);
+            return;
+        }
+        lk.unlock();
+        featureBuf.push(featureFrame);
+        notifyProcess();
+    }
+}
+
+void Estimator::getTrackStats(TimeStat &image_queue, TimeStat &input_stall, TimeStat &track, TimeStat &track_stall) const
+{
+    std::lock_guard<std::mutex> lk(mTrack);
+    image_queue = image_queue_stat;
+    input_stall = input_stall_stat;
+    track = track_stat;
+    track_stall = track_stall_stat;
+}
+
 void Estimator::inputIMU(double t, const Vector3d &linearAcceleration, const Vector3d &angularVelocity)
 {
     //预测未考虑观测噪声的p、v、q值,同时将发布最新的IMU测量值消息（pvq值）
-    mBuf.lock();
-    accBuf.push(make_pair(t, linearAcceleration));
-    gyrBuf.push(make_pair(t, angularVelocity));
+    ImuSample sample;
+    sample.t = t;
+    sample.acc = linearAcceleration;
+    sample.gyr = angularVelocity;
+    if(!imuBuf.push(sample))
+    {
+        ROS_ERROR_THROTTLE(1.0, "imu buffer full, drop imu %f", t);
+        inputOverflow = true;
+    }
 //    printf("input imu with time %f \n", t);
-    mBuf.unlock();
+    notifyProcess();
 
     if (solver_flag == NON_LINEAR)
     {
@@ -228,32 +354,16 @@ void Estimator::inputIMU(double t, const Vector3d &linearAcceleration, const Vec
     }
 }
 
-void Estimator::inputWheelsIMU(double t, const Vector3d &linearAcceleration, const Vector3d &angularVelocity)
-{
-    //预测未考虑观测噪声的p、v、q值,同时将发布最新的IMU测量值消息（pvq值）
-    mBuf.lock();
-    accWheelsBuf.push(make_pair(t, linearAcceleration));
-    gyrWheelsBuf.push(make_pair(t, angularVelocity));
-//    printf("input imu with time %f \n", t);
-    mBuf.unlock();
-
-//    if (solver_flag == NON_LINEAR)
-//    {
-//        mPropagate.lock();
-//        fastPredictIMU(t, linearAcceleration, angularVelocity);//积分出  P V Q
-////        printf("fastPredictIMU \n");
-//        pubLatestOdometry(latest_P, latest_Q, latest_V, t);
-//        mPropagate.unlock();
-//    }
-}
-
 void Estimator::inputVEL(double t, const Eigen::Vector3d &velVec, const double &ang_vel)
 {
     //预测未考虑观测噪声的p、v、q值,同时将发布最新的IMU测量值消息（pvq值）
-    mBuf.lock();
-    velBuf.push(make_pair(t, velVec));
+    if(!velBuf.push(make_pair(t, velVec)))
+    {
+        ROS_ERROR_THROTTLE(1.0, "wheels buffer full, drop velocity %f", t);
+        inputOverflow = true;
+    }
 //    printf("input imu with time %f \n", t);
-    mBuf.unlock();
+    notifyProcess();
 
 //    if (solver_flag == NON_LINEAR)
 //    {
@@ -265,43 +375,43 @@ void Estimator::inputVEL(double t, const Eigen::Vector3d &velVec, const double &
 //    }
 }
 
-void Estimator::inputFeature(double t, const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &featureFrame)
+void Estimator::inputFeature(double t, const FeatureFrame &featureFrame)
 {
-    mBuf.lock();
-    featureBuf.push(make_pair(t, featureFrame));
-    mBuf.unlock();
+    FeatureFrame *frame = framePool.acquire();
+    *frame = featureFrame;//拷贝到池里的帧，容量足够时不重新分配
+    frame->t = t;
+    frame->sortById();
+    if(!featureBuf.push(frame))
+    {
+        ROS_WARN_THROTTLE(1.0, "feature buffer full, drop feature %f", t);
+        framePool.release(frame);
+    }
+    notifyProcess();
 
     if(!MULTIPLE_THREAD)
         processMeasurements();
 }
 
 
-bool Estimator::getIMUInterval(double t0, double t1, vector<pair<double, Eigen::Vector3d>> &accVector,
-                                vector<pair<double, Eigen::Vector3d>> &gyrVector)
+//返回(t0,t1]内的IMU视图,最后一个元素时间戳>=t1,不拷贝数据
+//视图在下一次imuBuf.pop之前有效
+bool Estimator::getIMUInterval(double t0, double t1, RingBuffer<ImuSample>::Span &imuSpan)
 {
-    if(accBuf.empty())
+    if(imuBuf.empty())
     {
         printf("not receive imu\n");
         return false;
     }
     //printf("get imu from %f %f\n", t0, t1);
-    //printf("imu fornt time %f   imu end time %f\n", accBuf.front().first, accBuf.back().first);
-    if(t1 <= accBuf.back().first)
+    //printf("imu fornt time %f   imu end time %f\n", imuBuf.front().t, imuBuf.back().t);
+    if(t1 <= imuBuf.back().t)
     {
-        while (accBuf.front().first <= t0)
-        {
-            accBuf.pop();
-            gyrBuf.pop();
-        }
-        while (accBuf.front().first < t1)
-        {
-            accVector.push_back(accBuf.front());
-            accBuf.pop();
-            gyrVector.push_back(gyrBuf.front());
-            gyrBuf.pop();
-        }
-        accVector.push_back(accBuf.front());
-        gyrVector.push_back(gyrBuf.front());
+        while (imuBuf.front().t <= t0)
+            imuBuf.pop();
+        size_t n = 0;
+        while (imuBuf[n].t < t1)
+            n++;
+        imuSpan = imuBuf.span(0, n + 1);
     }
     else
     {
@@ -389,7 +499,7 @@ bool Estimator::getWHEELSInterpolation(double t, vector<pair<double, Eigen::Vect
 
 bool Estimator::IMUAvailable(double t)
 {
-    if(!accBuf.empty() && t <= accBuf.back().first)
+    if(!imuBuf.empty() && t <= imuBuf.back().t)
         return true;
     else
         return false;
@@ -402,147 +512,214 @@ bool Estimator::WHEELSAvailable(double t)
         return false;
 }
 
+//缓冲区本身无锁，push之后空拿一下mBuf再notify:
+//处理线程在mBuf下检查完条件、进入wait之前，这里拿不到锁，所以不会错过唤醒
+void Estimator::notifyProcess()
+{
+    {
+        std::lock_guard<std::mutex> lock(mBuf);
+    }
+    con.notify_one();
+}
+
+//缓冲区是单生产者单消费者的，不能在回调线程里清空，只置标志由处理线程重启
+void Estimator::requestRestart()
+{
+    restartRequest = true;
+    notifyProcess();
+}
+
 void Estimator::processMeasurements()
 {
     while (1)
     {
+        //缓冲区溢出时中间丢了数据，预积分已经不对，按失败处理重启
+        if (inputOverflow.exchange(false))
+        {
+            ROS_WARN("sensor input buffer overflow!");
+            restartRequest = true;
+        }
+        if (restartRequest.exchange(false))
+        {
+            clearState();
+            setParameter();
+            ROS_WARN("system reboot!");
+        }
         //printf("process measurments\n");
-        pair<double, map<int, vector<pair<int, Eigen::Matrix<double, 7, 1> > > > > feature;
-        vector<pair<double, Eigen::Vector3d>> accVector, gyrVector;
+        FeatureFrame *feature = nullptr;//pop之后归本线程所有，processImage之后还给framePool
+        RingBuffer<ImuSample>::Span imuSpan;
         vector<pair<double, Eigen::Vector3d>> velVector,ang_velVector;
+        vector<pair<double, Eigen::Vector3d>> velVector_prev;//prevTime处的轮速
+        std::unique_lock<std::mutex> lk(mBuf);
+        TicToc t_wait;
+        if (MULTIPLE_THREAD)
+            con.wait(lk, [&]{ return !featureBuf.empty() || processExit || restartRequest; });//等待图像特征
+        if (processExit)
+            return;
+        if (restartRequest)
+            continue;
         if(!featureBuf.empty())
         {
+            double wait_feature_time = t_wait.toc();
             feature = featureBuf.front();
-            curTime = feature.first + td;
-            while(1)//等待轮速计
+            curTime = feature->t + td;
+            //等待轮速计和IMU覆盖到图像时间戳,由inputIMU/inputVEL唤醒
+            t_wait.tic();
+            double wait_wheels_time = 0, wait_imu_time = 0;
+            bool wheels_ready = !USE_WHEELS || WHEELSAvailable(curTime);
+            bool imu_ready = !USE_IMU || IMUAvailable(curTime);
+            while (!wheels_ready || !imu_ready)
             {
-                if ((!USE_WHEELS  || WHEELSAvailable(feature.first + td)))//有imu数据，且imu accBuf.back数据时间戳大于图像时间戳
-                    break;
-                else
+                if (! MULTIPLE_THREAD)
                 {
-                    printf("wait for wheels ... \n");
-                    if (! MULTIPLE_THREAD)
-                        return;
-                    std::chrono::milliseconds dura(5);
-                    std::this_thread::sleep_for(dura);
+                    printf("wait for %s ... \n", wheels_ready ? "imu" : "wheels");
+                    return;
                 }
+                con.wait(lk);
+                if (processExit)
+                    return;
+                if (restartRequest)
+                    break;
+                if (!wheels_ready && (wheels_ready = WHEELSAvailable(curTime)))
+                    wait_wheels_time = t_wait.toc();
+                if (!imu_ready && (imu_ready = IMUAvailable(curTime)))
+                    wait_imu_time = t_wait.toc();
             }
-            while(1)//等待IMU
+            if (restartRequest)
+                continue;
+            wait_feature_stat.add(wait_feature_time);
+            wait_wheels_stat.add(wait_wheels_time);
+            wait_imu_stat.add(wait_imu_time);
+            lk.unlock();
+
+            if(USE_IMU)
+                getIMUInterval(prevTime, curTime, imuSpan);//获取时间间隔内的IMU
+            if(USE_IMU && USE_WHEELS)
             {
-                if ((!USE_IMU  || IMUAvailable(feature.first + td)))//有imu数据，且imu accBuf.back数据时间戳大于图像时间戳
-                    break;
-                else
+                for(size_t i = 0; i < imuSpan.size(); i++)
                 {
-                    printf("wait for imu ... \n");
-                    if (! MULTIPLE_THREAD)
-                        return;
-                    std::chrono::milliseconds dura(5);
-                    std::this_thread::sleep_for(dura);
+                    getWHEELSInterpolation(imuSpan[i].t, velVector);//获取时间间隔内的轮速计
+                    if(i == 0 && solver_flag == NON_LINEAR)
+                        getWHEELSInterpolation(prevTime, velVector_prev);
                 }
             }
-            mBuf.lock();
-            if(USE_IMU)
-                getIMUInterval(prevTime, curTime, accVector, gyrVector);//获取时间间隔内的IMU
 //            if(USE_WHEELS)
 //            {
 //                getWHEELSInterval(prevTime, curTime, velVector,ang_velVector);//获取时间间隔内的轮速计
-//                std::cout<<"before  Vs[j]= "<<Vs[frame_count].transpose()<<"\tnorm= "<<Vs[frame_count].norm()<<endl;
+//                std::cout<<"before  Vs[j]= "<<Vs[frame_count].transpose()<<"\tnorm= "<<Vs[frame_count].norm()<<std::endl;
 //                Vs[frame_count]=velVector.front().second/Vs[frame_count].norm()*Vs[frame_count];
-//                std::cout<<"after  Vs[j]= "<<Vs[frame_count].transpose()<<"\tnorm= "<<Vs[frame_count].norm()<<endl;
+//                std::cout<<"after  Vs[j]= "<<Vs[frame_count].transpose()<<"\tnorm= "<<Vs[frame_count].norm()<<std::endl;
 //                Eigen::Vector3d velVec=velVector.front().second*Eigen::Vector3d::Identity();
 //                velVec=Rs[frame_count]*velVec;
 //                std::cout<<"velVec= "<<velVec.transpose()<<std::endl;
 //            }
 
             featureBuf.pop();//找到对应图像的imu数据后 特征点的BUFF就pop一个，且，刚开始已经赋值给feature了
-            mBuf.unlock();
+            if(PIPELINE)
+            {
+                //唤醒等待featureBuf空位的trackThread
+                mTrack.lock();
+                mTrack.unlock();
+                conTrack.notify_all();
+            }
+            TicToc t_process;
 
             if(USE_IMU && !USE_WHEELS)
             {
 //                cout<<"处理IMU前的Rs!!!!!\n"<<Rs[frame_count]<<endl;
                 if(!initFirstPoseFlag)
-                    initFirstIMUPose(accVector);//初始化IMU旋转，使其Z与g平行
-                for(size_t i = 0; i < accVector.size(); i++)
+                    initFirstIMUPose(imuSpan);//初始化IMU旋转，使其Z与g平行
+                for(size_t i = 0; i < imuSpan.size(); i++)
                 {
                     double dt;
                     if(i == 0)//第一个imu数据的时间戳减去上一次prevTime的时间戳
-                        dt = accVector[i].first - prevTime;
-                    else if (i == accVector.size() - 1)//最后一个IMU时间戳
-                        dt = curTime - accVector[i - 1].first;
+                        dt = imuSpan[i].t - prevTime;
+                    else if (i == imuSpan.size() - 1)//最后一个IMU时间戳
+                        dt = curTime - imuSpan[i - 1].t;
                     else
-                        dt = accVector[i].first - accVector[i - 1].first;//中间数据的时间戳
-                    processIMU(accVector[i].first, dt, accVector[i].second, gyrVector[i].second);//滑动窗口帧间IMU积分，
+                        dt = imuSpan[i].t - imuSpan[i - 1].t;//中间数据的时间戳
+                    processIMU(imuSpan[i].t, dt, imuSpan[i].acc, imuSpan[i].gyr);//滑动窗口帧间IMU积分，
                 }
 //                cout<<"处理IMU后的Rs\n"<<Rs[frame_count]<<endl;
-                Eigen::Vector3d acc_without_g=Rs[frame_count] * (accVector[int(accVector.size())-1].second - Bas[frame_count]) ;//- g;
-                Eigen::Vector3d r_acc_=Rs[frame_count] * (accVector[int(accVector.size())-1].second ) ;//- g;
-                double length=sqrt(pow(accVector[int(accVector.size())-1].second.x(),2)+pow(accVector[int(accVector.size())-1].second.y(),2)+pow(accVector[int(accVector.size())-1].second.z(),2));
-                if(SHOW_MESSAGE) cout<<"length="<<length<<"   acc_origion="<<accVector[int(accVector.size())-1].second.transpose()<<"       acc_without_g"<<acc_without_g.transpose()<<"  r_acc_="<<r_acc_.transpose()<<"  g="<<g.transpose()<<endl;
-                //if(abs(length-9.8)<0.05)
-                    writr_imu_data(accVector[int(accVector.size())-1].first,length,accVector[int(accVector.size())-1].second,acc_without_g,r_acc_);
-                if(SHOW_MESSAGE)
+                if(DIAG(DIAG_LOG))
+                {
+                    Eigen::Vector3d acc_without_g=Rs[frame_count] * (imuSpan.back().acc - Bas[frame_count]) ;//- g;
+                    Eigen::Vector3d r_acc_=Rs[frame_count] * (imuSpan.back().acc ) ;//- g;
+                    double length=sqrt(pow(imuSpan.back().acc.x(),2)+pow(imuSpan.back().acc.y(),2)+pow(imuSpan.back().acc.z(),2));
+                    if(DIAG(DIAG_MESSAGE)) cout<<"length="<<length<<"   acc_origion="<<imuSpan.back().acc.transpose()<<"       acc_without_g"<<acc_without_g.transpose()<<"  r_acc_="<<r_acc_.transpose()<<"  g="<<g.transpose()<<endl;
+                    //if(abs(length-9.8)<0.05)
+                    writr_imu_data(imuSpan.back().t,length,imuSpan.back().acc,acc_without_g,r_acc_);
+                }
+                if(DIAG(DIAG_MESSAGE))
                     printf("------------------------processIMU \n");
             }
             else if(USE_IMU && USE_WHEELS)
             {
 //                cout<<"处理IMU前的Rs!!!!!\n"<<Rs[frame_count]<<endl;
                 if(!initFirstPoseFlag)
-                    initFirstIMUPose(accVector);//初始化IMU旋转，使其Z与g平行
-                if(SHOW_MESSAGE)
+                    initFirstIMUPose(imuSpan);//初始化IMU旋转，使其Z与g平行
+                if(DIAG(DIAG_MESSAGE))
                     std::cout<<"before pre_integrations Vs"<<Vs[frame_count].transpose()<<"\tnorm= "<<Vs[frame_count].norm()<<std::endl;
-                for(size_t i = 0; i < accVector.size(); i++)
+                for(size_t i = 0; i < imuSpan.size(); i++)
                 {
                     double dt;
                     if(i == 0)//第一个imu数据的时间戳减去上一次prevTime的时间戳
-                        dt = accVector[i].first - prevTime;
-                    else if (i == accVector.size() - 1)//最后一个IMU时间戳
-                        dt = curTime - accVector[i - 1].first;
+                        dt = imuSpan[i].t - prevTime;
+                    else if (i == imuSpan.size() - 1)//最后一个IMU时间戳
+                        dt = curTime - imuSpan[i - 1].t;
                     else
-                        dt = accVector[i].first - accVector[i - 1].first;//中间数据的时间戳
+                        dt = imuSpan[i].t - imuSpan[i - 1].t;//中间数据的时间戳
 
-                    getWHEELSInterpolation(accVector[i].first, velVector);//获取时间间隔内的轮速计
-                    if(i==0 && solver_flag == NON_LINEAR)
+                    if(i==0 && solver_flag == NON_LINEAR && !velVector_prev.empty())
                     {
-                        vector<pair<double, Eigen::Vector3d>> velVector_temp;
-                        getWHEELSInterpolation(prevTime, velVector_temp);//获取时间间隔内的轮速计
-                        Eigen::Vector3d velVec = velVector_temp.front().second;
-                        if(SHOW_MESSAGE)
+                        Eigen::Vector3d velVec = velVector_prev.front().second;
+                        if(DIAG(DIAG_MESSAGE))
                             std::cout<<"velVec="<<velVec.transpose()<<endl;
                         velVec = Rs[frame_count] * velVec;
 //                        Vs[frame_count]=velVec;
 //                        std::cout<<"use vel Vs"<<setprecision(17)<<prevTime<<"\tvs="<<Vs[frame_count].transpose()<<"\tnorm= "<<Vs[frame_count].norm()<<std::endl;
                     }
-//                    std::cout<<"getWHEELSInterpolation "<<accVector[i].first<<"  "<<velVector[i].first<<" "<<velVector[i].second<<endl;
-                    processIMU_with_wheel(accVector[i].first, dt, accVector[i].second, gyrVector[i].second, velVector[i].second);//滑动窗口帧间IMU积分，
+//                    std::cout<<"getWHEELSInterpolation "<<imuSpan[i].t<<"  "<<velVector[i].first<<" "<<velVector[i].second<<endl;
+                    processIMU_with_wheel(imuSpan[i].t, dt, imuSpan[i].acc, imuSpan[i].gyr, velVector[i].second);//滑动窗口帧间IMU积分，
                 }
 //                cout<<"处理IMU后的Rs\n"<<Rs[frame_count]<<endl;
-                Eigen::Vector3d acc_without_g=Rs[frame_count] * (accVector[int(accVector.size())-1].second - Bas[frame_count]) ;//- g;
-                Eigen::Vector3d r_acc_=Rs[frame_count] * (accVector[int(accVector.size())-1].second ) ;//- g;
-                double length=sqrt(pow(accVector[int(accVector.size())-1].second.x(),2)+pow(accVector[int(accVector.size())-1].second.y(),2)+pow(accVector[int(accVector.size())-1].second.z(),2));
-                if(SHOW_MESSAGE)
-                    cout<<"length="<<length<<"   acc_origion="<<accVector[int(accVector.size())-1].second.transpose()<<"       acc_without_g"<<acc_without_g.transpose()<<"  r_acc_="<<r_acc_.transpose()<<"  g="<<g.transpose()<<endl;
-                //if(abs(length-9.8)<0.05)
-                writr_imu_data(accVector[int(accVector.size())-1].first,length,accVector[int(accVector.size())-1].second,acc_without_g,r_acc_);
-                writr_integrate_data(OUTPUT_FOLDER+"imu_int_origin.csv");
-                if(SHOW_MESSAGE)
+                if(DIAG(DIAG_LOG))
+                {
+                    Eigen::Vector3d acc_without_g=Rs[frame_count] * (imuSpan.back().acc - Bas[frame_count]) ;//- g;
+                    Eigen::Vector3d r_acc_=Rs[frame_count] * (imuSpan.back().acc ) ;//- g;
+                    double length=sqrt(pow(imuSpan.back().acc.x(),2)+pow(imuSpan.back().acc.y(),2)+pow(imuSpan.back().acc.z(),2));
+                    if(DIAG(DIAG_MESSAGE))
+                        cout<<"length="<<length<<"   acc_origion="<<imuSpan.back().acc.transpose()<<"       acc_without_g"<<acc_without_g.transpose()<<"  r_acc_="<<r_acc_.transpose()<<"  g="<<g.transpose()<<endl;
+                    //if(abs(length-9.8)<0.05)
+                    writr_imu_data(imuSpan.back().t,length,imuSpan.back().acc,acc_without_g,r_acc_);
+                    writr_integrate_data(log_imu_int);
+                }
+                if(DIAG(DIAG_MESSAGE))
                     printf("------------------------processIMU \n");
             }
+            //积分完成后再释放IMU数据,保留最后一个给下一帧使用
+            if(imuSpan.size() > 1)
+                imuBuf.pop(imuSpan.size() - 1);
 
             mProcess.lock();
-            processImage(feature.second, feature.first);//重要   特征点相关，时间戳// 处理图像 和IMU
-            writr_ece(OUTPUT_FOLDER+"exe.csv");//写外参
-            if(SHOW_MESSAGE){
+            budget.beginFrame(curTime - prevTime);
+            frame_solve_time = frame_margin_time = 0;
+            processImage(*feature, feature->t);//重要   特征点相关，时间戳// 处理图像 和IMU
+            if(DIAG(DIAG_LOG))
+                writr_ece(log_ece);//写外参
+            if(DIAG(DIAG_MESSAGE)){
                 std::cout<<"para_Ex_Pose "<<para_Ex_Pose[0][0]<<" "<<para_Ex_Pose[0][1] <<" "<<para_Ex_Pose[0][2] <<" "<<
                          para_Ex_Pose[0][3] <<" "<<para_Ex_Pose[0][4] <<" "<<para_Ex_Pose[0][5] <<" "<<para_Ex_Pose[0][6] <<std::endl;
             }
             prevTime = curTime;
-            if(SHOW_MESSAGE)
+            if(DIAG(DIAG_MESSAGE))
                 std::cout<<"latest_V= "<<latest_V.transpose()<<std::endl;
             printStatistics(*this, 0);//打印统计信息
 
             std_msgs::Header header;
             header.frame_id = "world";
-            header.stamp = ros::Time(feature.first);
+            header.stamp = ros::Time(feature->t);
+            framePool.release(feature);
 
             pubOdometry(*this, header);
             pubKeyPoses(*this, header);
@@ -550,89 +727,83 @@ void Estimator::processMeasurements()
             pubPointCloud(*this, header);
             pubKeyframe(*this);
             pubTF(*this, header);
+            process_stat.add(t_process.toc());
+            if (solver_flag == NON_LINEAR)
+            {
+                solve_stat.add(frame_solve_time);
+                margin_stat.add(frame_margin_time);
+                if (budget.endFrame(process_stat.last, frame_solve_time, frame_margin_time, opt_feature_cnt,
+                                    featureBuf.size(), !MULTIPLE_THREAD))
+                {
+                    ROS_WARN_THROTTLE(1.0, "frame %f missed deadline: %.1f ms > %.1f ms (solve %.1f marg %.1f), "
+                                      "%d landmarks, %zu frames queued, %d/%d missed",
+                                      header.stamp.toSec(), budget.last_process_ms, budget.frameDeadline(), frame_solve_time,
+                                      frame_margin_time, opt_feature_cnt, featureBuf.size(), budget.miss_cnt,
+                                      budget.frame_cnt);
+                }
+            }
             mProcess.unlock();
         }
 
         if (! MULTIPLE_THREAD)
             break;
-
-        std::chrono::milliseconds dura(2);
-        std::this_thread::sleep_for(dura);
     }
 }
+//结果文件，写入都在logger的后台线程里
+void Estimator::openLogFiles()
+{
+    log_imu = logger.open(OUTPUT_FOLDER+"imu_2.csv", true, 7, ",", true, LOG_BINARY);
+    log_imu_int = logger.open(OUTPUT_FOLDER+"imu_int_origin.csv", true, 7, ",", true, LOG_BINARY);
+    log_ece = logger.open(OUTPUT_FOLDER+"exe.csv", true, 7, ",", true, LOG_BINARY);
+    log_init_pose = logger.open(OUTPUT_FOLDER + "/init_tum.txt", false, 7, " ", false, LOG_BINARY);
+    log_odometry = logger.open(VINS_RESULT_PATH, true, 5, ",", true, LOG_BINARY,
+                               {"", "Ps: ", "", "", "tmp_Q: ", "", "", "", "Vs: "});
+}
+
 //存储IMU数据
 void Estimator::writr_imu_data(double time,double length_,Eigen::Vector3d acc_ori,Eigen::Vector3d acc_whithout_g,Eigen::Vector3d R_acc_)
 {
     // write result to file
-    string imu_data_path=OUTPUT_FOLDER+"imu_2.csv";
-    ofstream foutC(imu_data_path, ios::app);
-    foutC.setf(ios::fixed, ios::floatfield);
-    foutC.precision(0);
-    foutC << inputImageCnt << ",";
-    foutC.precision(7);
-    foutC << length_<<","
-          <<acc_ori.x() << ","
-          << acc_ori.y() << ","
-          << acc_ori.z() << ","
-          << acc_whithout_g.x() << ","
-          << acc_whithout_g.y() << ","
-          << acc_whithout_g.z() << ","
-          << R_acc_.x() << ","
-          << R_acc_.y() << ","
-          << R_acc_.z() << ","
-          <<Bas->x()<<","
-          <<Bas->y()<<","
-          <<Bas->z()<<","
-          <<frame_count<<","
-          <<marginalization_flag<<","
-          << endl;
-    foutC.close();
+    //第0列inputImageCnt,第14、15列frame_count,marginalization_flag按整数输出
+    logger.write(log_imu, {(double)inputImageCnt, length_,
+                           acc_ori.x(), acc_ori.y(), acc_ori.z(),
+                           acc_whithout_g.x(), acc_whithout_g.y(), acc_whithout_g.z(),
+                           R_acc_.x(), R_acc_.y(), R_acc_.z(),
+                           Bas->x(), Bas->y(), Bas->z(),
+                           (double)frame_count, (double)marginalization_flag},
+                 1u | 1u << 14 | 1u << 15);
 }
 
-void Estimator::writr_integrate_data(string path)
+void Estimator::writr_integrate_data(int log_file)
 {
     // write result to file
-    string imu_data_path=OUTPUT_FOLDER+"imu_2.csv";
-    imu_data_path = path;
-    ofstream foutC(imu_data_path, ios::app);//ios::app insert data from file end;
-    foutC.setf(ios::fixed, ios::floatfield);
-    foutC.precision(0);
-    foutC << inputImageCnt << ",";
-    foutC.precision(7);
     if(pre_integrations[frame_count]!= nullptr)
     {
 //        std::cout<<"write "<<pre_integrations[frame_count]->delta_p_i_vel<<endl;
         Eigen::Matrix3d delta_R = pre_integrations[frame_count]->delta_q.toRotationMatrix();
         Eigen::AngleAxis<double> angleaxis;
         angleaxis.fromRotationMatrix(delta_R);
-        foutC << pre_integrations[frame_count]->delta_p_i_vel[0]<<","
-              <<pre_integrations[frame_count]->delta_p_i_vel[1] << ","
-              << pre_integrations[frame_count]->delta_p_i_vel[2] << ","
-              << para_Pose[frame_count][0]<<","
-              << para_Pose[frame_count][1]<<","
-              << para_Pose[frame_count][2]<<","
-              << angleaxis.angle()*180.0f/M_PI<<","
-              << angleaxis.axis().x()<<","
-              << angleaxis.axis().y()<<","
-              << angleaxis.axis().z()<<","
-              <<frame_count<<","
-              <<marginalization_flag<<","
-              <<pre_integrations[frame_count]->delta_angleaxis.angle()*180.0f/M_PI/pre_integrations[frame_count]->sum_dt<<","
-              << endl;
-        foutC.close();
+        logger.write(log_file, {(double)inputImageCnt,
+                                pre_integrations[frame_count]->delta_p_i_vel[0],
+                                pre_integrations[frame_count]->delta_p_i_vel[1],
+                                pre_integrations[frame_count]->delta_p_i_vel[2],
+                                para_Pose[frame_count][0],
+                                para_Pose[frame_count][1],
+                                para_Pose[frame_count][2],
+                                angleaxis.angle()*180.0f/M_PI,
+                                angleaxis.axis().x(),
+                                angleaxis.axis().y(),
+                                angleaxis.axis().z(),
+                                (double)frame_count,
+                                (double)marginalization_flag,
+                                pre_integrations[frame_count]->delta_angleaxis.angle()*180.0f/M_PI/pre_integrations[frame_count]->sum_dt},
+                     1u | 1u << 11 | 1u << 12);
     }
 }
 
-void Estimator::writr_ece(string path)
+void Estimator::writr_ece(int log_file)
 {
     // write result to file
-    string imu_data_path=OUTPUT_FOLDER+"imu_2.csv";
-    imu_data_path = path;
-    ofstream foutC(imu_data_path, ios::app);//ios::app insert data from file end;
-    foutC.setf(ios::fixed, ios::floatfield);
-    foutC.precision(0);
-    foutC << inputImageCnt << ",";
-    foutC.precision(7);
     if(pre_integrations[frame_count]!= nullptr)
     {
 //        std::cout<<"write "<<pre_integrations[frame_count]->delta_p_i_vel<<endl;
@@ -643,56 +814,41 @@ void Estimator::writr_ece(string path)
 //        exe_q.w()=para_Ex_Pose[0][6];
         exe_q = ric[0];
         Eigen::Matrix3d exe_R = exe_q.toRotationMatrix();
-        Eigen::AngleAxis<double> angleaxis;
         Eigen::Vector3d Euler_exe = exe_R.eulerAngles(2,1,0);
-        foutC <<    tic[0].x()<<","
-              <<    tic[0].y() << ","
-              <<    tic[0].z()<< ","
-              <<    exe_q.x()<<","
-              <<    exe_q.y()<<","
-              <<    exe_q.z()<<","
-              <<    exe_q.w()<<","
-              << Euler_exe.x()*180.0f/M_PI<<","
-              << Euler_exe.y()*180.0f/M_PI<<","
-              << Euler_exe.z()*180.0f/M_PI<<","
-              << endl;
-        foutC.close();
+        logger.write(log_file, {(double)inputImageCnt,
+                                tic[0].x(), tic[0].y(), tic[0].z(),
+                                exe_q.x(), exe_q.y(), exe_q.z(), exe_q.w(),
+                                Euler_exe.x()*180.0f/M_PI,
+                                Euler_exe.y()*180.0f/M_PI,
+                                Euler_exe.z()*180.0f/M_PI},
+                     1u);
     }
 }
 
-void Estimator::writr_initPose(string path)
+void Estimator::writr_initPose()
 {
     // write result to file
-    ofstream foutC(path);//ios::app insert data from file end;
-    foutC.setf(ios::fixed, ios::floatfield);
-    foutC.precision(7);
+    logger.truncate(log_init_pose);
     for (int i = 0; i <= frame_count; i++)
     {
         Eigen::Quaterniond q = Quaterniond(Rs[i]);
-        foutC << Headers[i]<<" ";
-        foutC <<    Ps[i].x()<<" "
-              <<    Ps[i].y() << " "
-              <<    Ps[i].z()<< " "
-              <<    q.x()<<" "
-              <<    q.y()<<" "
-              <<    q.z()<<" "
-              <<    q.w()
-              << endl;
-    }
-    foutC.close();
+        logger.write(log_init_pose, {Headers[i],
+                                     Ps[i].x(), Ps[i].y(), Ps[i].z(),
+                                     q.x(), q.y(), q.z(), q.w()});
+    }
 }
 
 
-void Estimator::initFirstIMUPose(vector<pair<double, Eigen::Vector3d>> &accVector)
+void Estimator::initFirstIMUPose(const RingBuffer<ImuSample>::Span &imuSpan)
 {
     printf("init first imu pose\n");
     initFirstPoseFlag = true;
     //return;
     Eigen::Vector3d averAcc(0, 0, 0);
-    int n = (int)accVector.size();
-    for(size_t i = 0; i < accVector.size(); i++)
+    int n = (int)imuSpan.size();
+    for(size_t i = 0; i < imuSpan.size(); i++)
     {
-        averAcc = averAcc + accVector[i].second;
+        averAcc = averAcc + imuSpan[i].acc;
     }
     averAcc = averAcc / n;
     printf("averge acc %f %f %f\n", averAcc.x(), averAcc.y(), averAcc.z());
@@ -735,7 +891,7 @@ void Estimator::processIMU(double t, double dt, const Vector3d &linear_accelerat
 // 2.IMU 预积分类对象还没出现，创建一个
     if (!pre_integrations[frame_count])
     {
-        pre_integrations[frame_count] = new IntegrationBase{acc_0, gyr_0, Bas[frame_count], Bgs[frame_count]};
+        pre_integrations[frame_count] = integration_pool.acquire(acc_0, gyr_0, Bas[frame_count], Bgs[frame_count]);
     }
     if (frame_count != 0)
     {
@@ -758,7 +914,7 @@ void Estimator::processIMU(double t, double dt, const Vector3d &linear_accelerat
         Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);
         Ps[j] += dt * Vs[j] + 0.5 * dt * dt * un_acc;
         Vs[j] += dt * un_acc;
-        if(SHOW_MESSAGE){
+        if(DIAG(DIAG_MESSAGE)){
             std::cout<<"pre_integrations time"<<setprecision(17)<<t<<"  Vs[j]= "<<Vs[j].transpose()<<"\tnorm= "<<Vs[j].norm()
                      //        <<"\tBgs[j]= "<<Bgs[j].transpose()<<"\tBas[j]= "<<Bas[j].transpose()
                      <<endl;
@@ -782,7 +938,7 @@ void Estimator::processIMU_with_wheel(double t, double dt, const Vector3d &linea
 // 2.IMU 预积分类对象还没出现，创建一个
     if (!pre_integrations[frame_count])
     {
-        pre_integrations[frame_count] = new IntegrationBase{acc_0, gyr_0, vel_0, Bas[frame_count], Bgs[frame_count]};
+        pre_integrations[frame_count] = integration_pool.acquire(acc_0, gyr_0, vel_0, Bas[frame_count], Bgs[frame_count]);
     }
     if (frame_count != 0)
     {
@@ -863,11 +1019,11 @@ void Estimator::processIMU_with_wheel(double t, double dt, const Vector3d &linea
     vel_0 = vel;
 }
 
-void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, const double header)
+void Estimator::processImage(const FeatureFrame &image, const double header)
 {
     //image的数据类型分别表示feature_id,camera_id,点的x,y,z坐标，u,v坐标，在x,y方向上的跟踪速度
     ROS_DEBUG("new image coming ------------------------------------------");
-    ROS_DEBUG("Adding feature points %lu", image.size());
+    ROS_DEBUG("Adding feature points %lu", image.featureNum());
     //为了保证系统的实时性和准确性，需要对当前帧之前某一部分帧进行优化，而不是全部历史帧，优化帧的个数便是滑动窗口的大小。
     //不难理解，为了维持窗口大小，要去除旧的帧添加新的帧，即边缘化 Marginalization。到底是删去最旧的帧（MARGIN_OLD）还是
     //删去刚刚进来窗口倒数第二帧(MARGIN_SECOND_NEW)，就需要对 当前帧与之前帧 进行视差比较，如果是当前帧变化很小，就会删
@@ -876,7 +1032,7 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
     if (f_manager.addFeatureCheckParallax(frame_count, image, td))//关键帧计数器 关键帧特征点 td常为0  往添加f_manager成员 如右目特征点
     {
         marginalization_flag = MARGIN_OLD;//边缘化标志
-        if(SHOW_MESSAGE){
+        if(DIAG(DIAG_MESSAGE)){
             printf("keyframe\n");
             cout<<"frame_count "<<frame_count<<" td "<<td<<endl;
         }
@@ -884,7 +1040,7 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
     else
     {
         marginalization_flag = MARGIN_SECOND_NEW;
-        if(SHOW_MESSAGE){
+        if(DIAG(DIAG_MESSAGE)){
             printf("non-keyframe\n");
         }
     }
@@ -897,8 +1053,9 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
     //【2】将图像数据、时间、临时预积分值存储到图像帧类中,ImageFrame这个类的定义在initial_alignment.h中
     ImageFrame imageframe(image, header);
     imageframe.pre_integration = tmp_pre_integration;
-    all_image_frame.insert(make_pair(header, imageframe));
-    tmp_pre_integration = new IntegrationBase{acc_0, gyr_0, vel_0, Bas[frame_count], Bgs[frame_count]};
+    if (!all_image_frame.insert(make_pair(header, imageframe)).second)
+        integration_pool.release(tmp_pre_integration);//时间戳重复，没插进去
+    tmp_pre_integration = integration_pool.acquire(acc_0, gyr_0, vel_0, Bas[frame_count], Bgs[frame_count]);
 
     //[3]如果ESTIMATE_EXTRINSIC == 2表示需要在线估计imu和camera之间的外参数
     if(ESTIMATE_EXTRINSIC == 2)
@@ -962,8 +1119,7 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
                 if(result)
                 {
                     initResult = true;
-                    string init_tum = OUTPUT_FOLDER + "/init_tum.txt";
-                    writr_initPose(init_tum);
+                    writr_initPose();
 
                     ofstream stateSave(OUTPUT_FOLDER + "/init_state.txt");
 //                    stateSave.open((OUTPUT_FOLDER + "/state.txt").c_str() );
@@ -1075,7 +1231,7 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
 //        <<Ps[0].transpose()<<"\n PS_1: "<<Ps[1].transpose()<<"\nPS_2: "<<Ps[2].transpose()<<"\nPS_3: "<<Ps[3].transpose()<<"\nPS_4:"<<Ps[4].transpose()<<"\nPS_5:"<<Ps[5].transpose()
 //        <<"\nPS_6:"<<Ps[6].transpose()<<"\nPS_7:"<<Ps[7].transpose()<<"\nPS_8:"<<Ps[8].transpose()<<"\nPS_9:"<<Ps[9].transpose()<<"\nPS_10:"<<Ps[10].transpose()<<"\n---------PS------------"<<std::endl;
         optimization();//优化_used
-//        writr_integrate_data(OUTPUT_FOLDER+"imu_int_after_opt.csv");
+//        writr_integrate_data(logger.open(OUTPUT_FOLDER+"imu_int_after_opt.csv", true, 7));
         set<int> removeIndex;
         outliersRejection(removeIndex);
         f_manager.removeOutlier(removeIndex);
@@ -1209,21 +1365,19 @@ bool Estimator::initialStructure()
         frame_it->second.is_key_frame = false;
         vector<cv::Point3f> pts_3_vector;
         vector<cv::Point2f> pts_2_vector;
-        for (auto &id_pts : frame_it->second.points)
+        const FeatureFrame &frame_pts = frame_it->second.points;
+        for (size_t k = 0; k < frame_pts.size(); k++)
         {
-            int feature_id = id_pts.first;
-            for (auto &i_p : id_pts.second)
+            int feature_id = frame_pts.ids[k];
+            it = sfm_tracked_points.find(feature_id);
+            if(it != sfm_tracked_points.end())
             {
-                it = sfm_tracked_points.find(feature_id);
-                if(it != sfm_tracked_points.end())
-                {
-                    Vector3d world_pts = it->second;
-                    cv::Point3f pts_3(world_pts(0), world_pts(1), world_pts(2));
-                    pts_3_vector.push_back(pts_3);
-                    Vector2d img_pts = i_p.second.head<2>();
-                    cv::Point2f pts_2(img_pts(0), img_pts(1));
-                    pts_2_vector.push_back(pts_2);
-                }
+                Vector3d world_pts = it->second;
+                cv::Point3f pts_3(world_pts(0), world_pts(1), world_pts(2));
+                pts_3_vector.push_back(pts_3);
+                Vector2d img_pts = frame_pts.pts[k].head<2>();
+                cv::Point2f pts_2(img_pts(0), img_pts(1));
+                pts_2_vector.push_back(pts_2);
             }
         }
         cv::Mat K = (cv::Mat_<double>(3, 3) << 1, 0, 0, 0, 1, 0, 0, 0, 1);
@@ -1358,21 +1512,19 @@ bool Estimator::initialSfm()
         frame_it->second.is_key_frame = false;
         vector<cv::Point3f> pts_3_vector;
         vector<cv::Point2f> pts_2_vector;
-        for (auto &id_pts : frame_it->second.points)
+        const FeatureFrame &frame_pts = frame_it->second.points;
+        for (size_t k = 0; k < frame_pts.size(); k++)
         {
-            int feature_id = id_pts.first;
-            for (auto &i_p : id_pts.second)
+            int feature_id = frame_pts.ids[k];
+            it = sfm_tracked_points.find(feature_id);
+            if(it != sfm_tracked_points.end())
             {
-                it = sfm_tracked_points.find(feature_id);
-                if(it != sfm_tracked_points.end())
-                {
-                    Vector3d world_pts = it->second;
-                    cv::Point3f pts_3(world_pts(0), world_pts(1), world_pts(2));
-                    pts_3_vector.push_back(pts_3);
-                    Vector2d img_pts = i_p.second.head<2>();
-                    cv::Point2f pts_2(img_pts(0), img_pts(1));
-                    pts_2_vector.push_back(pts_2);
-                }
+                Vector3d world_pts = it->second;
+                cv::Point3f pts_3(world_pts(0), world_pts(1), world_pts(2));
+                pts_3_vector.push_back(pts_3);
+                Vector2d img_pts = frame_pts.pts[k].head<2>();
+                cv::Point2f pts_2(img_pts(0), img_pts(1));
+                pts_2_vector.push_back(pts_2);
             }
         }
         cv::Mat K = (cv::Mat_<double>(3, 3) << 1, 0, 0, 0, 1, 0, 0, 0, 1);
@@ -1721,21 +1873,93 @@ bool Estimator::failureDetection()
     return false;
 }
 
+// 第一次调用时创建problem并添加所有滑窗参数块，之后只更新固定/可变状态
+void Estimator::prepareProblem()
+{
+    if (problem)
+        return;
+    ceres::Problem::Options problem_options;
+    problem_options.enable_fast_removal = true;//每帧要删全部残差块
+    problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+#if defined(VINS_USE_EVALUATION_CALLBACK) && CERES_VERSION_MAJOR >= 2
+    problem_options.evaluation_callback = &frame_cache;
+#endif
+    problem = new ceres::Problem(problem_options);
+
+    for (int i = 0; i < WINDOW_SIZE + 1; i++)
+    {
+        pose_parameterization[i] = new PoseLocalParameterization();
+        problem->AddParameterBlock(para_Pose[i], SIZE_POSE, pose_parameterization[i]);
+        if(USE_IMU)
+            problem->AddParameterBlock(para_SpeedBias[i], SIZE_SPEEDBIAS);
+    }
+    if(!USE_IMU)
+        problem->SetParameterBlockConstant(para_Pose[0]);
+    for (int i = 0; i < NUM_OF_CAM; i++)
+        problem->AddParameterBlock(para_Ex_Pose[i], SIZE_POSE, new PoseLocalParameterization());
+    problem->AddParameterBlock(para_Td[0], 1);
+    //para_Feature在第一次AddResidualBlock时加入，之后一直保留
+}
+
+// 滑窗后同一参数块对应的帧和特征点都变了，残差块不能留到下一帧。
+// 没有残差块的参数块ceres求解时会忽略，不用删
+void Estimator::removeResidualBlocks()
+{
+    if (!problem)
+        return;
+    residual_block_ids.clear();
+    problem->GetResidualBlocks(&residual_block_ids);
+    for (auto &id : residual_block_ids)
+        problem->RemoveResidualBlock(id);
+    residual_block_ids.clear();
+}
+
+void Estimator::resetProblem()
+{
+    if (problem)
+        delete problem;
+    problem = nullptr;
+}
+
+// IMU因子里bias的变化一律用预积分雅可比做一阶修正，迭代中不重新积分。
+// 上一次优化后bias离线性化点超过BIAS_ACC_THRESHOLD/BIAS_GYR_THRESHOLD的那几段在建新问题前重新积分，
+// 各段互相独立，放到线程池里并行
+void Estimator::repropagateDriftedBias()
+{
+    if (!USE_IMU)
+        return;
+    repropagate_index.clear();
+    for (int j = 1; j <= frame_count; j++)
+    {
+        if (pre_integrations[j] && pre_integrations[j]->biasDrifted(Bas[j - 1], Bgs[j - 1]))
+            repropagate_index.push_back(j);
+    }
+    if (repropagate_index.empty())
+        return;
+    bias_repropagate_cnt += repropagate_index.size();
+    ROS_DEBUG("repropagate %d preintegrations on bias drift", (int)repropagate_index.size());
+    MarginalizationInfo::threadPool().parallelFor(repropagate_index.size(), [this](int k)
+    {
+        int j = repropagate_index[k];
+        pre_integrations[j]->repropagate(Bas[j - 1], Bgs[j - 1]);
+    });
+}
+
 void Estimator::optimization()
 {
     TicToc t_whole, t_prepare;
     vector2double();
 
-    //初始化ceres
-    ceres::Problem problem;//创建一个ceres Problem实例, loss_function定义为CauchyLoss.
-    ceres::LossFunction *loss_function;
-    //loss_function = NULL;
-    loss_function = new ceres::HuberLoss(1.0);
-//    loss_function = new ceres::CauchyLoss(1.0 / FOCAL_LENGTH);
-    //ceres::LossFunction* loss_function = new ceres::HuberLoss(1.0);
+    //problem和loss_function跨帧复用，见prepareProblem
+    prepareProblem();
+    repropagateDriftedBias();
     double cnt_1 = 0, cnt_5 = 0, cnt_large_5 = 0;
-    if(1){
-        cv::Mat imgTrack = featureTracker.getTrackImage();
+    //重投影误差统计cnt_1在IMU_FACTOR==2时要用来调节轮速计因子，画图只在DIAG_VISUAL时做
+    bool draw_residual = DIAG(DIAG_VISUAL);
+    if(IMU_FACTOR == 2 || draw_residual){
+        cv::Mat imgTrack;
+        if (draw_residual)
+            imgTrack = featureTracker.getTrackImage();
         int f_m_cnt = 0;
         int feature_index = -1;
         for (auto &it_per_id: f_manager.feature) {
@@ -1779,33 +2003,33 @@ void Estimator::optimization()
                     Eigen::Vector2d residual;
                     double dep_j = pts_camera_j.z();
                     residual = (pts_camera_j / dep_j).head<2>() - pts_j_td.head<2>();
-                    Eigen::Matrix3d PI;
                     residual = ProjectionTwoFrameOneCamFactor::sqrt_info * residual;
-                    PI<< 8.1690378992770002e+02, 0, 6.0850726281690004e+02, 0, 8.1156803828490001e+02, 2.6347599764440002e+02, 0, 0, 1;
-                    if (0) {
-                        std::cout << "cam residual: (res_x res_y) : " << residual.transpose() << " \tin :"
-                                  << (PI * pts_j).transpose() << std::endl;
-                    }
-                    Eigen::Vector3d Pt = (PI * pts_j);
                     double r = residual.norm();
-                    cv::Point2f rightPt;
-                    rightPt.x = int(Pt.x());
-                    rightPt.y = int(Pt.y());
-                    if (r < 1) {
-                        cv::circle(imgTrack, rightPt, 1, cv::Scalar(0, 255, 0), 2);
+                    if (r < 1)
                         cnt_1++;
-                    } else if (r < 5) {
-                        cv::circle(imgTrack, rightPt, r, cv::Scalar(0, 255, 255), 2);
+                    else if (r < 5)
                         cnt_5++;
-                    } else {
+                    else
                         cnt_large_5++;
-                        cv::circle(imgTrack, rightPt, r, cv::Scalar(0, 0, 0), 2);
+                    if (draw_residual) {
+                        Eigen::Matrix3d PI;
+                        PI<< 8.1690378992770002e+02, 0, 6.0850726281690004e+02, 0, 8.1156803828490001e+02, 2.6347599764440002e+02, 0, 0, 1;
+                        Eigen::Vector3d Pt = (PI * pts_j);
+                        cv::Point2f rightPt;
+                        rightPt.x = int(Pt.x());
+                        rightPt.y = int(Pt.y());
+                        if (r < 1)
+                            cv::circle(imgTrack, rightPt, 1, cv::Scalar(0, 255, 0), 2);
+                        else if (r < 5)
+                            cv::circle(imgTrack, rightPt, r, cv::Scalar(0, 255, 255), 2);
+                        else
+                            cv::circle(imgTrack, rightPt, r, cv::Scalar(0, 0, 0), 2);
                     }
                 }
                 f_m_cnt++;
             }
         }
-        if (1)//SHOW_MESSAGE)
+        if (draw_residual)
         {
             cv::putText(imgTrack, "cnt_1: " + to_string(cnt_1), cv::Point2f(10, 30), CV_FONT_HERSHEY_SIMPLEX, 0.5,
                         cv::Scalar(0, 0, 255));
@@ -1825,50 +2049,39 @@ void Estimator::optimization()
         }
     }
 
-    //加入优化变量  位姿 速度
-    for (int i = 0; i < frame_count + 1; i++)
-    {
-        bool show=false;
-        if(i==frame_count-1 && SHOW_MESSAGE) show = true;
-        ceres::LocalParameterization *local_parameterization = new PoseLocalParameterization(show);//本地参数化
-        problem.AddParameterBlock(para_Pose[i], SIZE_POSE, local_parameterization);//参数_位姿
-        if(USE_IMU)
-        {
-            problem.AddParameterBlock(para_SpeedBias[i], SIZE_SPEEDBIAS);
-        }
-    }
-    if(!USE_IMU)
-        problem.SetParameterBlockConstant(para_Pose[0]);//这个函数是设置参数块为常数  将帧头设置为零
-
+    //优化变量 位姿 速度已在prepareProblem中加入，frame_count之后的帧没有残差块，不参与优化
+    for (int i = 0; i < WINDOW_SIZE + 1; i++)
+        pose_parameterization[i]->show = (i==frame_count-1 && DIAG(DIAG_MESSAGE));
+    //!USE_IMU时帧头固定，在prepareProblem中设置
 
-    //加入相机外参
+    //相机外参
     for (int i = 0; i < NUM_OF_CAM; i++)
     {
-        ceres::LocalParameterization *local_parameterization = new PoseLocalParameterization();
-        problem.AddParameterBlock(para_Ex_Pose[i], SIZE_POSE, local_parameterization);
         if ((ESTIMATE_EXTRINSIC && frame_count == WINDOW_SIZE && Vs[0].norm() > 0.2) || openExEstimation)
         {
-            if(SHOW_MESSAGE)
+            if(DIAG(DIAG_MESSAGE))
                 ROS_INFO("estimate extinsic param");
             openExEstimation = 1;
+            problem->SetParameterBlockVariable(para_Ex_Pose[i]);
         }
         else
         {
-            if(SHOW_MESSAGE)
+            if(DIAG(DIAG_MESSAGE))
                 ROS_INFO("fix extinsic param");
-            problem.SetParameterBlockConstant(para_Ex_Pose[i]);
+            problem->SetParameterBlockConstant(para_Ex_Pose[i]);
         }
     }
-    problem.AddParameterBlock(para_Td[0], 1);
 
     if (!ESTIMATE_TD || Vs[0].norm() < 0.2)
-        problem.SetParameterBlockConstant(para_Td[0]);//将imu和图像时间戳偏差设为定值
+        problem->SetParameterBlockConstant(para_Td[0]);//将imu和图像时间戳偏差设为定值
+    else
+        problem->SetParameterBlockVariable(para_Td[0]);
 
     if (last_marginalization_info && last_marginalization_info->valid)
     {
         // construct new marginlization_factor
         MarginalizationFactor *marginalization_factor = new MarginalizationFactor(last_marginalization_info);//边缘化
-        problem.AddResidualBlock(marginalization_factor, NULL,
+        problem->AddResidualBlock(marginalization_factor, NULL,
                                  last_marginalization_parameter_blocks);
     }
     if(USE_IMU)
@@ -1878,7 +2091,7 @@ void Estimator::optimization()
             int j = i + 1;
             if (pre_integrations[j]->sum_dt > 10.0)
                 continue;
-            if(SHOW_MESSAGE)
+            if(DIAG(DIAG_MESSAGE))
             {
                 std::cout<<"frame_count: "<<i<<"\t sumdt="<<setprecision(5)<<pre_integrations[j]->sum_dt
                          <<"\t pre del_p_vel="<<pre_integrations[j]->delta_p_i_vel.transpose()<<"\tdelta_v="<<pre_integrations[j]->delta_v.transpose()
@@ -1887,14 +2100,14 @@ void Estimator::optimization()
                 std::cout << "covariance_enc_j\n" << pre_integrations[j]->covariance_enc << std::endl;
             }
             bool show=false;
-            if(i==frame_count-2 && SHOW_MESSAGE) show = true;
+            if(i==frame_count-2 && DIAG(DIAG_MESSAGE)) show = true;
             if (IMU_FACTOR == 0) {
                 IMUFactor *imu_factor = new IMUFactor(pre_integrations[j], show);
-                problem.AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
+                problem->AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
                                          para_SpeedBias[j]);
             } else if (IMU_FACTOR == 1) {
                 IMUFactor_origin *imu_factor = new IMUFactor_origin(pre_integrations[j]);
-                problem.AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
+                problem->AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
                                          para_SpeedBias[j]);
             } else {
                 double wheelVel = 0;
@@ -1914,27 +2127,41 @@ void Estimator::optimization()
                     decrease=0;
 //                std::cout<<"decrease:"<<decrease<<"\tangVEl:"<<angVElDif<<std::endl;
                 IMUEncoderFactor *imu_factor = new IMUEncoderFactor(pre_integrations[j], show,decrease*2);
-                problem.AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
+                problem->AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
                                          para_SpeedBias[j]);
             }
 //            IMUEncoderFactor *imu_factor = new IMUEncoderFactor(pre_integrations[j], show);
-//            problem.AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
+//            problem->AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
 //                                     para_SpeedBias[j]);
         }
     }
 //    if(0)
     if(0)
     {
-//        problem.SetParameterBlockConstant(para_Pose[0]);//将imu和图像时间戳偏差设为定值
+//        problem->SetParameterBlockConstant(para_Pose[0]);//将imu和图像时间戳偏差设为定值
         for (int i = 0; i < frame_count; i++)
         {
             int j = i + 1;
             if (pre_integrations[j]->sum_dt > 10.0)
                 continue;
             WHEELSFactor *wheels_factor = new WHEELSFactor(pre_integrations[j]);
-            problem.AddResidualBlock(wheels_factor, NULL,para_Pose[i], para_Pose[j]);
+            problem->AddResidualBlock(wheels_factor, NULL,para_Pose[i], para_Pose[j]);
+        }
+    }
+    //超时或积压时只把跟踪最长的feature_budget个路标点加入优化，其余的深度本帧不更新
+    int min_len = 0, tie_quota = -1;
+    if (budget.featureBudget() >= 0)
+    {
+        vector<int> track_cnt(WINDOW_SIZE + 2, 0);
+        for (auto &it_per_id : f_manager.feature)
+        {
+            int len = it_per_id.feature_per_frame.size();
+            if (len >= 4)
+                track_cnt[std::min(len, WINDOW_SIZE + 1)]++;
         }
+        budget.selectThreshold(track_cnt, min_len, tie_quota);
     }
+    opt_feature_cnt = 0;
     int f_m_cnt = 0;
     int feature_index = -1;
     for (auto &it_per_id : f_manager.feature)
@@ -1944,6 +2171,15 @@ void Estimator::optimization()
             continue;
 
         ++feature_index;
+        if (it_per_id.used_num < min_len)
+            continue;
+        if (it_per_id.used_num == min_len && tie_quota >= 0)
+        {
+            if (tie_quota == 0)
+                continue;
+            tie_quota--;
+        }
+        opt_feature_cnt++;
 
         int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
 
@@ -1958,7 +2194,8 @@ void Estimator::optimization()
                 Vector3d pts_j = it_per_frame.point;
                 ProjectionTwoFrameOneCamFactor *f_td = new ProjectionTwoFrameOneCamFactor(pts_i, pts_j, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocity,
                                                                                           it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                problem.AddResidualBlock(f_td, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index], para_Td[0]);
+                f_td->setFrameCache(&frame_cache, imu_i, imu_j);
+                problem->AddResidualBlock(f_td, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index], para_Td[0]);
             }
 
             if(STEREO && it_per_frame.is_stereo)
@@ -1968,13 +2205,13 @@ void Estimator::optimization()
                 {
                     ProjectionTwoFrameTwoCamFactor *f = new ProjectionTwoFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
                                                                                            it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                    problem.AddResidualBlock(f, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]);
+                    problem->AddResidualBlock(f, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]);
                 }
                 else
                 {
                     ProjectionOneFrameTwoCamFactor *f = new ProjectionOneFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
                                                                                            it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                    problem.AddResidualBlock(f, loss_function, para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]);
+                    problem->AddResidualBlock(f, loss_function, para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]);
                 }
 
             }
@@ -1988,23 +2225,32 @@ void Estimator::optimization()
     ceres::Solver::Options options;
 
     options.linear_solver_type = ceres::DENSE_SCHUR;
-    //options.num_threads = 2;
+    //DIAG_MESSAGE时因子的Evaluate里会打印调试信息，单线程保证输出不交错
+    options.num_threads = DIAG(DIAG_MESSAGE) ? 1 : SOLVER_THREADS;
+#if CERES_VERSION_MAJOR < 2
+    options.num_linear_solver_threads = options.num_threads;//ceres 2.0之前线性求解的线程数单独设置
+#endif
     options.trust_region_strategy_type = ceres::DOGLEG;
     options.max_num_iterations = NUM_ITERATIONS;
     //options.use_explicit_schur_complement = true;
-    if(SHOW_MESSAGE)
+    if(DIAG(DIAG_MESSAGE))
         options.minimizer_progress_to_stdout = true;
     //options.use_nonmonotonic_steps = true;
-//    if (marginalization_flag == MARGIN_OLD)
-//        options.max_solver_time_in_seconds = SOLVER_TIME * 4.0 / 5.0;
-//    else
-//        options.max_solver_time_in_seconds = SOLVER_TIME;
+    //按本帧剩余时间限制求解时间，超时时ceres返回当前最好的结果
+    options.max_solver_time_in_seconds = budget.solverTime(SOLVER_TIME, !MULTIPLE_THREAD);
     TicToc t_solver;
     ceres::Solver::Summary summary;
-    ceres::Solve(options, &problem, &summary);
+    frame_cache.reset();
+#if defined(VINS_USE_EVALUATION_CALLBACK) && CERES_VERSION_MAJOR < 2
+    options.evaluation_callback = &frame_cache;
+#endif
+    ceres::Solve(options, problem, &summary);
+    frame_cache.reset();
+    frame_solve_time = t_solver.toc();
+    removeResidualBlocks();
 //    cout << summary.BriefReport() << endl;
     ROS_DEBUG("Iterations : %d", static_cast<int>(summary.iterations.size()));
-    if(SHOW_MESSAGE)
+    if(DIAG(DIAG_MESSAGE))
     {
         std::cout << "summary.BriefReport()\n" << summary.BriefReport() << "\n";
 //    std::cout << summary.message << "\n";
@@ -2227,6 +2473,7 @@ void Estimator::optimization()
 
         }
     }
+    frame_margin_time = t_whole_marginalization.toc();
     //printf("whole marginalization costs: %f \n", t_whole_marginalization.toc());
     //printf("whole time for ceres: %f \n", t_whole.toc());
 }
@@ -2236,56 +2483,38 @@ void Estimator::optimizationBias() //TODO 添加优化bias的滑动窗口
     TicToc t_whole, t_prepare;
     vector2double();
 
-    //初始化ceres
-    ceres::Problem problem;//创建一个ceres Problem实例, loss_function定义为CauchyLoss.
-    ceres::LossFunction *loss_function;
-    //loss_function = NULL;
-    loss_function = new ceres::HuberLoss(1.0);
-    //loss_function = new ceres::CauchyLoss(1.0 / FOCAL_LENGTH);
-    //ceres::LossFunction* loss_function = new ceres::HuberLoss(1.0);
-
-    //加入优化变量  位姿 速度
-    for (int i = 0; i < frame_count + 1; i++)
-    {
-        bool show=false;
-        if(i==frame_count-1) show = true;
-        ceres::LocalParameterization *local_parameterization = new PoseLocalParameterization(show);//本地参数化
-        problem.AddParameterBlock(para_Pose[i], SIZE_POSE, local_parameterization);//参数_位姿
-        if(USE_IMU)
-        {
-            problem.AddParameterBlock(para_SpeedBias[i], SIZE_SPEEDBIAS);
-        }
-    }
-    if(!USE_IMU)
-        problem.SetParameterBlockConstant(para_Pose[0]);//这个函数是设置参数块为常数  将帧头设置为零
+    prepareProblem();
+    repropagateDriftedBias();
 
+    for (int i = 0; i < WINDOW_SIZE + 1; i++)
+        pose_parameterization[i]->show = (i==frame_count-1);
 
-    //加入相机外参
+    //相机外参
     for (int i = 0; i < NUM_OF_CAM; i++)
     {
-        ceres::LocalParameterization *local_parameterization = new PoseLocalParameterization();
-        problem.AddParameterBlock(para_Ex_Pose[i], SIZE_POSE, local_parameterization);
         if ((ESTIMATE_EXTRINSIC && frame_count == WINDOW_SIZE && Vs[0].norm() > 0.2) || openExEstimation)
         {
             ROS_INFO("estimate extinsic param");
             openExEstimation = 1;
+            problem->SetParameterBlockVariable(para_Ex_Pose[i]);
         }
         else
         {
             ROS_INFO("fix extinsic param");
-            problem.SetParameterBlockConstant(para_Ex_Pose[i]);
+            problem->SetParameterBlockConstant(para_Ex_Pose[i]);
         }
     }
-    problem.AddParameterBlock(para_Td[0], 1);
 
     if (!ESTIMATE_TD || Vs[0].norm() < 0.2)
-        problem.SetParameterBlockConstant(para_Td[0]);//将imu和图像时间戳偏差设为定值
+        problem->SetParameterBlockConstant(para_Td[0]);//将imu和图像时间戳偏差设为定值
+    else
+        problem->SetParameterBlockVariable(para_Td[0]);
 
     if (last_marginalization_info && last_marginalization_info->valid)
     {
         // construct new marginlization_factor
         MarginalizationFactor *marginalization_factor = new MarginalizationFactor(last_marginalization_info);//边缘化
-        problem.AddResidualBlock(marginalization_factor, NULL,
+        problem->AddResidualBlock(marginalization_factor, NULL,
                                  last_marginalization_parameter_blocks);
     }
     if(USE_IMU)
@@ -2295,7 +2524,7 @@ void Estimator::optimizationBias() //TODO 添加优化bias的滑动窗口
             int j = i + 1;
             if (pre_integrations[j]->sum_dt > 10.0)
                 continue;
-            if(SHOW_MESSAGE)
+            if(DIAG(DIAG_MESSAGE))
             {
                 std::cout<<"frame_count: "<<i<<"\t sumdt="<<setprecision(5)<<pre_integrations[j]->sum_dt
                          <<"\t pre del_p_vel="<<pre_integrations[j]->delta_p_i_vel.transpose()<<"\tdelta_v="<<pre_integrations[j]->delta_v.transpose()
@@ -2305,33 +2534,33 @@ void Estimator::optimizationBias() //TODO 添加优化bias的滑动窗口
             if(i==frame_count-1) show = true;
             if (IMU_FACTOR == 0) {
                 IMUFactor *imu_factor = new IMUFactor(pre_integrations[j], show);
-                problem.AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
+                problem->AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
                                          para_SpeedBias[j]);
             } else if (IMU_FACTOR == 1) {
                 IMUFactor_origin *imu_factor = new IMUFactor_origin(pre_integrations[j]);
-                problem.AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
+                problem->AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
                                          para_SpeedBias[j]);
             } else {
                 IMUEncoderFactor *imu_factor = new IMUEncoderFactor(pre_integrations[j], show);
-                problem.AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
+                problem->AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
                                          para_SpeedBias[j]);
             }
 //            IMUEncoderFactor *imu_factor = new IMUEncoderFactor(pre_integrations[j], show);
-//            problem.AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
+//            problem->AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j],
 //                                     para_SpeedBias[j]);
         }
     }
 //    if(0)
     if(0)
     {
-//        problem.SetParameterBlockConstant(para_Pose[0]);//将imu和图像时间戳偏差设为定值
+//        problem->SetParameterBlockConstant(para_Pose[0]);//将imu和图像时间戳偏差设为定值
         for (int i = 0; i < frame_count; i++)
         {
             int j = i + 1;
             if (pre_integrations[j]->sum_dt > 10.0)
                 continue;
             WHEELSFactor *wheels_factor = new WHEELSFactor(pre_integrations[j]);
-            problem.AddResidualBlock(wheels_factor, NULL,para_Pose[i], para_Pose[j]);
+            problem->AddResidualBlock(wheels_factor, NULL,para_Pose[i], para_Pose[j]);
         }
     }
 
@@ -2358,7 +2587,8 @@ void Estimator::optimizationBias() //TODO 添加优化bias的滑动窗口
                 Vector3d pts_j = it_per_frame.point;
                 ProjectionTwoFrameOneCamFactor *f_td = new ProjectionTwoFrameOneCamFactor(pts_i, pts_j, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocity,
                                                                                           it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                problem.AddResidualBlock(f_td, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index], para_Td[0]);
+                f_td->setFrameCache(&frame_cache, imu_i, imu_j);
+                problem->AddResidualBlock(f_td, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index], para_Td[0]);
             }
 
             if(STEREO && it_per_frame.is_stereo)
@@ -2368,13 +2598,13 @@ void Estimator::optimizationBias() //TODO 添加优化bias的滑动窗口
                 {
                     ProjectionTwoFrameTwoCamFactor *f = new ProjectionTwoFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
                                                                                            it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                    problem.AddResidualBlock(f, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]);
+                    problem->AddResidualBlock(f, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]);
                 }
                 else
                 {
                     ProjectionOneFrameTwoCamFactor *f = new ProjectionOneFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
                                                                                            it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                    problem.AddResidualBlock(f, loss_function, para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]);
+                    problem->AddResidualBlock(f, loss_function, para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]);
                 }
 
             }
@@ -2388,7 +2618,11 @@ void Estimator::optimizationBias() //TODO 添加优化bias的滑动窗口
     ceres::Solver::Options options;
 
     options.linear_solver_type = ceres::DENSE_SCHUR;
-    //options.num_threads = 2;
+    //DIAG_MESSAGE时因子的Evaluate里会打印调试信息，单线程保证输出不交错
+    options.num_threads = DIAG(DIAG_MESSAGE) ? 1 : SOLVER_THREADS;
+#if CERES_VERSION_MAJOR < 2
+    options.num_linear_solver_threads = options.num_threads;//ceres 2.0之前线性求解的线程数单独设置
+#endif
     options.trust_region_strategy_type = ceres::DOGLEG;
     options.max_num_iterations = NUM_ITERATIONS;
     //options.use_explicit_schur_complement = true;
@@ -2400,14 +2634,20 @@ void Estimator::optimizationBias() //TODO 添加优化bias的滑动窗口
 //        options.max_solver_time_in_seconds = SOLVER_TIME;
     TicToc t_solver;
     ceres::Solver::Summary summary;
-    ceres::Solve(options, &problem, &summary);
+    frame_cache.reset();
+#if defined(VINS_USE_EVALUATION_CALLBACK) && CERES_VERSION_MAJOR < 2
+    options.evaluation_callback = &frame_cache;
+#endif
+    ceres::Solve(options, problem, &summary);
+    frame_cache.reset();
+    removeResidualBlocks();
 //    cout << summary.BriefReport() << endl;
     ROS_DEBUG("Iterations : %d", static_cast<int>(summary.iterations.size()));
-    if(SHOW_MESSAGE)
+    if(DIAG(DIAG_MESSAGE))
         std::cout << "summary.BriefReport()\n" << summary.BriefReport() << "\n";
 //    std::cout << summary.message << "\n";
 //    std::cout << summary.FullReport() << "\n";
-    if(SHOW_MESSAGE)
+    if(DIAG(DIAG_MESSAGE))
         printf("solver costs: %f \n", t_solver.toc());
 
     double2vector();
@@ -2669,8 +2909,8 @@ void Estimator::slideWindow()
                 Bgs[WINDOW_SIZE] = Bgs[WINDOW_SIZE - 1];
 
                 //重新更新预积分的变量
-                delete pre_integrations[WINDOW_SIZE];
-                pre_integrations[WINDOW_SIZE] = new IntegrationBase{acc_0, gyr_0,vel_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]};
+                integration_pool.release(pre_integrations[WINDOW_SIZE]);
+                pre_integrations[WINDOW_SIZE] = integration_pool.acquire(acc_0, gyr_0, vel_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]);
 
                 dt_buf[WINDOW_SIZE].clear();
                 linear_acceleration_buf[WINDOW_SIZE].clear();
@@ -2682,7 +2922,11 @@ void Estimator::slideWindow()
             {
                 map<double, ImageFrame>::iterator it_0;
                 it_0 = all_image_frame.find(t_0);
-                delete it_0->second.pre_integration;
+                //t_0之前的帧连同预积分一起删掉，t_0这一帧留在最前面，它的预积分已经用不到了
+                for (auto it = all_image_frame.begin(); it != it_0; ++it)
+                    integration_pool.release(it->second.pre_integration);
+                integration_pool.release(it_0->second.pre_integration);
+                it_0->second.pre_integration = nullptr;
                 all_image_frame.erase(all_image_frame.begin(), it_0);
             }
             slideWindowOld();
@@ -2729,8 +2973,8 @@ void Estimator::slideWindow()
                     Bgs[frame_count - 1] = Bgs[frame_count];
                 }
 
-                delete pre_integrations[WINDOW_SIZE];
-                pre_integrations[WINDOW_SIZE] = new IntegrationBase{acc_0, gyr_0, vel_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]};
+                integration_pool.release(pre_integrations[WINDOW_SIZE]);
+                pre_integrations[WINDOW_SIZE] = integration_pool.acquire(acc_0, gyr_0, vel_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]);
 
                 dt_buf[WINDOW_SIZE].clear();
                 linear_acceleration_buf[WINDOW_SIZE].clear();
@@ -2921,18 +3165,12 @@ void Estimator::updateLatestStates()
     latest_Bg = Bgs[frame_count];
     latest_acc_0 = acc_0;
     latest_gyr_0 = gyr_0;
-    mBuf.lock();
-    queue<pair<double, Eigen::Vector3d>> tmp_accBuf = accBuf;
-    queue<pair<double, Eigen::Vector3d>> tmp_gyrBuf = gyrBuf;
-    mBuf.unlock();
-    while(!tmp_accBuf.empty())
-    {
-        double t = tmp_accBuf.front().first;
-        Eigen::Vector3d acc = tmp_accBuf.front().second;
-        Eigen::Vector3d gyr = tmp_gyrBuf.front().second;
-        fastPredictIMU(t, acc, gyr);
-        tmp_accBuf.pop();
-        tmp_gyrBuf.pop();
+    //只在处理线程调用,直接遍历imuBuf中尚未使用的数据
+    size_t n = imuBuf.size();
+    for(size_t i = 0; i < n; i++)
+    {
+        const ImuSample &sample = imuBuf[i];
+        fastPredictIMU(sample.t, sample.acc, sample.gyr);
     }
     mPropagate.unlock();
 }
@@ -11,6 +11,8 @@
  
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <std_msgs/Header.h>
 #include <std_msgs/Float32.h>
 #include <ceres/ceres.h>
@@ -22,8 +24,12 @@
 
 #include "parameters.h"
 #include "feature_manager.h"
+#include "solver_budget.h"
+#include "integration_pool.h"
 #include "../utility/utility.h"
 #include "../utility/tic_toc.h"
+#include "../utility/ring_buffer.h"
+#include "../utility/async_logger.h"
 #include "../initial/solve_5pts.h"
 #include "../initial/initial_sfm.h"
 #include "../initial/initial_alignment.h"
@@ -39,6 +45,21 @@
 #include "../featureTracker/feature_tracker.h"
 
 #include "../factor/wheels_factor.h"
+
+struct ImuSample
+{
+    double t;
+    Eigen::Vector3d acc;
+    Eigen::Vector3d gyr;
+};
+
+struct ImageInput
+{
+    double t;
+    cv::Mat img0, img1;
+    TicToc t_queue;//入队计时
+};
+
 class Estimator
 {
   public:
@@ -49,18 +70,21 @@ class Estimator
     // interface
     void initFirstPose(Eigen::Vector3d p, Eigen::Matrix3d r);
     void inputIMU(double t, const Vector3d &linearAcceleration, const Vector3d &angularVelocity);
-    void inputWheelsIMU(double t, const Vector3d &linearAcceleration, const Vector3d &angularVelocity);
     void inputVEL(double t, const Eigen::Vector3d &velVec, const double &ang_vel);//输入里程计
-    void inputFeature(double t, const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &featureFrame);
+    void inputFeature(double t, const FeatureFrame &featureFrame);
     void inputImage(double t, const cv::Mat &_img, const cv::Mat &_img1 = cv::Mat());
     void processIMU(double t, double dt, const Vector3d &linear_acceleration, const Vector3d &angular_velocity);
     void processIMU_with_wheel(double t, double dt, const Vector3d &linear_acceleration, const Vector3d &angular_velocity,const Eigen::Vector3d vel);
-    void processImage(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, const double header);
+    void processImage(const FeatureFrame &image, const double header);
     void processMeasurements();
+    void notifyProcess();
+    void requestRestart();
+    void processTrack();
+    void getTrackStats(TimeStat &image_queue, TimeStat &input_stall, TimeStat &track, TimeStat &track_stall) const;
     void changeSensorType(int use_imu, int use_stereo);
 
     // internal
-    void clearState();
+    void clearState();//会清空传感器缓冲区，只能在处理线程(或线程启动前)调用，其它线程用requestRestart
     bool initialStructure();
     bool initialSfm();//纯视觉sfm
     bool visualInitialAlign();
@@ -70,11 +94,14 @@ class Estimator
     void slideWindowOld();
     void optimization();
     void optimizationBias();
+    void prepareProblem();
+    void removeResidualBlocks();
+    void repropagateDriftedBias();
+    void resetProblem();
     void vector2double();
     void double2vector();
     bool failureDetection();
-    bool getIMUInterval(double t0, double t1, vector<pair<double, Eigen::Vector3d>> &accVector, 
-                                              vector<pair<double, Eigen::Vector3d>> &gyrVector);
+    bool getIMUInterval(double t0, double t1, RingBuffer<ImuSample>::Span &imuSpan);
     bool getWHEELSInterval(double t0, double t1, vector<pair<double, Eigen::Vector3d>> &velVector,
                                                  vector<pair<double, double>> &ang_velVector);
     bool getWHEELSInterpolation( double t, vector<pair<double, Eigen::Vector3d>> &imuVelVector);//插值
@@ -94,11 +121,12 @@ class Estimator
     bool IMUAvailable(double t);
     bool WHEELSAvailable(double t);
     void writr_imu_data(double time,double length_,Eigen::Vector3d acc_ori,Eigen::Vector3d acc_whithout_g,Eigen::Vector3d R_acc_);
-    void writr_integrate_data(string path);
-    void writr_ece(string path);
-    void writr_initPose(string path);//写初始化完成后的位姿
+    void writr_integrate_data(int log_file);
+    void writr_ece(int log_file);
+    void writr_initPose();//写初始化完成后的位姿
+    void openLogFiles();
     //void writr_imu_data(Eigen::Vector3d acc_ori,Eigen::Vector3d acc_whithout_g,Eigen::Vector3d R_acc_);//自己写的 存储IMU数据
-    void initFirstIMUPose(vector<pair<double, Eigen::Vector3d>> &accVector);
+    void initFirstIMUPose(const RingBuffer<ImuSample>::Span &imuSpan);
 
     enum SolverFlag
     {
@@ -115,15 +143,27 @@ class Estimator
     std::mutex mProcess;
     std::mutex mBuf;
     std::mutex mPropagate;
-    queue<pair<double, Eigen::Vector3d>> accBuf;
-    queue<pair<double, Eigen::Vector3d>> gyrBuf;
+    std::condition_variable con;//数据到达时唤醒processMeasurements,mBuf只配合con使用,不保护下面的缓冲区
+    std::atomic<bool> processExit;
+    std::atomic<bool> inputOverflow;//IMU/轮速计缓冲区满丢过数据，处理线程看到后重启系统
+    std::atomic<bool> restartRequest;//其它线程请求重启，由处理线程执行clearState
+    //传感器缓冲区: 回调线程push,处理线程读取/pop,均不加锁
+    RingBuffer<ImuSample> imuBuf;
+    RingBuffer<pair<double, Eigen::Vector3d>> velBuf;
     queue<pair<double, Eigen::Vector3d>> imuVelBuf; //imu对应轮式计的速度
-    queue<pair<double, Eigen::Vector3d>> accWheelsBuf;//给轮速计提供IMU数据
-    queue<pair<double, Eigen::Vector3d>> gyrWheelsBuf;
-    queue<pair<double, Eigen::Vector3d>> velBuf;
     queue<pair<double, double>> ang_velBuf;
     pair<double, Eigen::Vector3d> temp_vel;//保存的临时的速度
-    queue<pair<double, map<int, vector<pair<int, Eigen::Matrix<double, 7, 1> > > > > > featureBuf;
+    // 特征帧在trackImage里填好，经featureBuf传给processImage，用完还回framePool，稳定后不再分配内存
+    FeatureFramePool framePool;
+    RingBuffer<FeatureFrame *> featureBuf;
+
+    // PIPELINE模式:
+    //   inputImage -> imageBuf -> trackThread(trackImage) -> featureBuf -> processThread(processImage)
+    // 跟踪第k+1帧的同时后端优化第k帧。两级队列长度都限制为PIPELINE_QUEUE_SIZE，
+    // 后端跟不上时trackThread阻塞，继而inputImage阻塞(反压)，不再隔帧丢图。
+    RingBuffer<ImageInput> imageBuf;
+    mutable std::mutex mTrack;//也保护下面跟踪相关的TimeStat
+    std::condition_variable conTrack;
     double prevTime, curTime;
     bool openExEstimation;
 
@@ -154,6 +194,8 @@ class Estimator
     Vector3d back_P0, last_P, last_P0;
     double Headers[(WINDOW_SIZE + 1)];
 
+    //pre_integrations、all_image_frame和tmp_pre_integration里的预积分都从integration_pool里取，用完还回去
+    IntegrationPool integration_pool;
     IntegrationBase *pre_integrations[(WINDOW_SIZE + 1)];
     Vector3d acc_0, gyr_0,vel_0;
 
@@ -191,6 +233,14 @@ class Estimator
 
     int loop_window_index;
 
+    // 滑窗优化的ceres::Problem跨帧复用: 参数块(地址固定)和本地参数化只在第一次添加，
+    // 每帧只加本帧的残差块，求解完删掉。传感器配置变化或重启时resetProblem
+    ceres::Problem *problem;
+    ceres::LossFunction *loss_function;//problem不接管，边缘化的ResidualBlockInfo也用它
+    PoseLocalParameterization *pose_parameterization[WINDOW_SIZE + 1];//只用来切换show
+    vector<ceres::ResidualBlockId> residual_block_ids;
+    ProjectionFrameCache frame_cache;//投影因子按帧对共用的旋转/平移，求解时由ceres回调更新
+
     MarginalizationInfo *last_marginalization_info;
     vector<double *> last_marginalization_parameter_blocks;
 
@@ -217,4 +267,22 @@ class Estimator
 
     double first_image_time=0;
     double init_end_image_time=0;
+
+    //每帧等待各传感器数据的时间(ms)
+    TimeStat wait_feature_stat, wait_imu_stat, wait_wheels_stat;
+    //流水线各阶段耗时(ms): 图像排队, inputImage反压等待, 跟踪, 跟踪反压等待, 后端处理
+    //前四个由输入/跟踪线程在mTrack下写，其它线程用getTrackStats读
+    TimeStat image_queue_stat, input_stall_stat, track_stat, track_stall_stat, process_stat;
+    //后端时间预算: 本帧求解/边缘化耗时(ms)，实际加入优化的路标点数
+    SolverBudget budget;
+    TimeStat solve_stat, margin_stat;
+    double frame_solve_time, frame_margin_time;
+    int opt_feature_cnt;
+    //bias偏离线性化点超过阈值而重新积分的次数
+    int bias_repropagate_cnt;
+    vector<int> repropagate_index;
+
+    //结果和调试数据由后台线程写文件，pubOdometry只拿到const Estimator&，所以是mutable
+    mutable AsyncLogger logger;
+    int log_imu, log_imu_int, log_ece, log_init_pose, log_odometry;
 };
@@ -0,0 +1,153 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <cassert>
+#include <eigen3/Eigen/Dense>
+
+// 一帧图像的特征点观测，代替原来的 map<feature_id, vector<pair<camera_id, xyz_uv_velocity>>>。
+// 每个观测一项，ids/cams/pts三个数组平行存放；sortById之后按(feature_id, camera_id)升序，
+// 同一个特征点的左右目观测相邻，遍历顺序和原来的map一致。
+// clear()只清空长度不释放内存，从FeatureFramePool反复取用时不再有逐点的内存分配。
+class FeatureFrame
+{
+  public:
+    FeatureFrame() : t(0) {}
+
+    // 只拷贝观测数据，排序用的缓存不拷贝
+    FeatureFrame(const FeatureFrame &other) : t(other.t), ids(other.ids), cams(other.cams), pts(other.pts) {}
+
+    FeatureFrame &operator=(const FeatureFrame &other)
+    {
+        t = other.t;
+        ids = other.ids;
+        cams = other.cams;
+        pts = other.pts;
+        return *this;
+    }
+
+    void clear()
+    {
+        ids.clear();
+        cams.clear();
+        pts.clear();
+    }
+
+    void reserve(size_t n)
+    {
+        ids.reserve(n);
+        cams.reserve(n);
+        pts.reserve(n);
+    }
+
+    // xyz_uv_velocity: 归一化坐标x y z, 像素坐标u v, 速度vx vy
+    void push_back(int feature_id, int camera_id, const Eigen::Matrix<double, 7, 1> &xyz_uv_velocity)
+    {
+        ids.push_back(feature_id);
+        cams.push_back(camera_id);
+        pts.push_back(xyz_uv_velocity);
+    }
+
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+
+    // 特征点个数(左右目算一个)
+    size_t featureNum() const
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < ids.size(); i++)
+            if (i == 0 || ids[i] != ids[i - 1])
+                n++;
+        return n;
+    }
+
+    void sortById()
+    {
+        size_t n = ids.size();
+        bool sorted = true;
+        for (size_t i = 1; i < n && sorted; i++)
+            sorted = key(i - 1) <= key(i);
+        if (sorted)
+            return;
+        order.resize(n);
+        for (size_t i = 0; i < n; i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [this](int a, int b) { return key(a) < key(b); });
+        tmp_ids = ids;
+        tmp_cams = cams;
+        tmp_pts = pts;
+        for (size_t i = 0; i < n; i++)
+        {
+            ids[i] = tmp_ids[order[i]];
+            cams[i] = tmp_cams[order[i]];
+            pts[i] = tmp_pts[order[i]];
+        }
+    }
+
+    double t;
+    std::vector<int> ids;
+    std::vector<int> cams;
+    std::vector<Eigen::Matrix<double, 7, 1>> pts;
+
+  private:
+    long long key(size_t i) const { return (long long)ids[i] * 2 + cams[i]; }
+
+    // sortById用的缓存，跟着帧一起复用
+    std::vector<int> order;
+    std::vector<int> tmp_ids, tmp_cams;
+    std::vector<Eigen::Matrix<double, 7, 1>> tmp_pts;
+};
+
+// FeatureFrame的空闲链表，跟踪线程acquire，处理完processImage后release
+// 进入featureBuf之后帧归处理线程所有，只有处理线程能release(包括clearState清空队列时)
+class FeatureFramePool
+{
+  public:
+    FeatureFramePool() : alloc_cnt(0) {}
+
+    FeatureFrame *acquire()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (free_list.empty())
+        {
+            frames.emplace_back(new FeatureFrame());
+            frames.back()->reserve(2 * MAX_FEATURE_PER_FRAME);
+            alloc_cnt++;
+            return frames.back().get();
+        }
+        FeatureFrame *frame = free_list.back();
+        free_list.pop_back();
+        return frame;
+    }
+
+    void release(FeatureFrame *frame)
+    {
+        if (frame == nullptr)
+            return;
+        frame->clear();
+        std::lock_guard<std::mutex> lock(m);
+        //重复release会让两次acquire拿到同一帧
+        assert(std::find(free_list.begin(), free_list.end(), frame) == free_list.end());
+        free_list.push_back(frame);
+    }
+
+    int allocCount() const { return alloc_cnt; }
+
+  private:
+    static const int MAX_FEATURE_PER_FRAME = 512;
+    std::mutex m;
+    std::vector<std::unique_ptr<FeatureFrame>> frames;
+    std::vector<FeatureFrame *> free_list;
+    int alloc_cnt;
+};
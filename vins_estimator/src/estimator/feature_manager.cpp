@@ -15,10 +15,12 @@ int FeaturePerId::endFrame()
 }
 
 FeatureManager::FeatureManager(Matrix3d _Rs[])
-    : Rs(_Rs)
+    : Rs(_Rs), pool(nullptr)
 {
     for (int i = 0; i < NUM_OF_CAM; i++)
         ric[i].setIdentity();
+    feature.reserve(NUM_OF_F);
+    feature_index.reserve(NUM_OF_F);
 }
 
 void FeatureManager::setRic(Matrix3d _ric[])
@@ -29,9 +31,44 @@ void FeatureManager::setRic(Matrix3d _ric[])
     }
 }
 
+void FeatureManager::setThreadPool(ThreadPool *_pool)
+{
+    pool = _pool;
+}
+
 void FeatureManager::clearState()
 {
     feature.clear();
+    feature_index.clear();
+}
+
+FeaturePerId *FeatureManager::getFeature(int feature_id)
+{
+    auto it = feature_index.find(feature_id);
+    if (it == feature_index.end())
+        return nullptr;
+    return &feature[it->second];
+}
+
+// keep返回false的特征点被删除，其余的按原顺序前移，同时更新feature_index
+void FeatureManager::compactFeatures(const std::function<bool(FeaturePerId &)> &keep)
+{
+    size_t j = 0;
+    for (size_t i = 0; i < feature.size(); i++)
+    {
+        if (!keep(feature[i]))
+        {
+            feature_index.erase(feature[i].feature_id);
+            continue;
+        }
+        if (i != j)
+        {
+            feature[j] = std::move(feature[i]);
+            feature_index[feature[j].feature_id] = j;
+        }
+        j++;
+    }
+    feature.erase(feature.begin() + j, feature.end());
 }
 
 int FeatureManager::getFeatureCount()
@@ -48,10 +85,10 @@ int FeatureManager::getFeatureCount()
     return cnt;
 }
 
-//关键帧的帧号，const map<特征点的id pair<相机的id ，特征点相关数据>>,td:(初始化时间偏移量图像时间戳和imu时间戳对齐作用 ，常为0)
-bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, double td)
+//关键帧的帧号，FeatureFrame按特征点id排好序，同一id的左目(camera_id=0)在前、右目(camera_id=1)在后,td:(初始化时间偏移量图像时间戳和imu时间戳对齐作用 ，常为0)
+bool FeatureManager::addFeatureCheckParallax(int frame_count, const FeatureFrame &image, double td)
 {
-    ROS_DEBUG("input feature: %d", (int)image.size());
+    ROS_DEBUG("input feature: %d", (int)image.featureNum());
     ROS_DEBUG("num of feature: %d", getFeatureCount());
     double parallax_sum = 0;//    //所有特征点视差总和
     int parallax_num = 0;    // 满足某些条件的特征点个数
@@ -59,32 +96,31 @@ bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vec
     last_average_parallax = 0;
     new_feature_num = 0;
     long_track_num = 0;
-    for (auto &id_pts : image)
+    for (size_t i = 0; i < image.size(); i++)
     {
-        FeaturePerFrame f_per_fra(id_pts.second[0].second, td);//每一帧的特征点        //特征点管理器，存储特征点格式：首先按照特征点ID，一个一个存储，每个ID会包含其在不同帧上的位置
-        assert(id_pts.second[0].first == 0);//如果相机的id不为0就判断出错
-        if(id_pts.second.size() == 2)//判断是否有右目
+        FeaturePerFrame f_per_fra(image.pts[i], td);//每一帧的特征点        //特征点管理器，存储特征点格式：首先按照特征点ID，一个一个存储，每个ID会包含其在不同帧上的位置
+        assert(image.cams[i] == 0);//如果相机的id不为0就判断出错
+        int feature_id = image.ids[i];//特征点的序号
+        if(i + 1 < image.size() && image.ids[i + 1] == feature_id)//判断是否有右目
         {
-            f_per_fra.rightObservation(id_pts.second[1].second);//右目每一帧的特征点 添加特征点
-            assert(id_pts.second[1].first == 1);
+            i++;
+            f_per_fra.rightObservation(image.pts[i]);//右目每一帧的特征点 添加特征点
+            assert(image.cams[i] == 1);
         }
 
-        int feature_id = id_pts.first;//特征点的序号
         // 找有没有相同ID特征点
-        auto it = find_if(feature.begin(), feature.end(), [feature_id](const FeaturePerId &it)       // find_if 函数，找到一个interator使第三个仿函数参数为真
-                          {
-            return it.feature_id == feature_id;
-                          });
+        FeaturePerId *it = getFeature(feature_id);
 
-        if (it == feature.end())
+        if (it == nullptr)
         {
             //如果没有找到此ID，就在管理器中增加此特征点 先存入id等
+            feature_index[feature_id] = feature.size();
             feature.push_back(FeaturePerId(feature_id, frame_count));//输入特征点序号 关键帧序号 默认used_num(0), estimated_depth(-1.0), solve_flag(0)
             //在 feature的最后一个数据组中的feature_per_frame（与上一步的id对应）压入特征点数据。
             feature.back().feature_per_frame.push_back(f_per_fra);
             new_feature_num++;
         }
-        else if (it->feature_id == feature_id)
+        else
         {
             //如果找到了相同ID特征点，就在其FeaturePerFrame内增加此特征点在此帧的位置以及其他信息，然后增加last_track_num，说明此帧有多少个相同特征点被跟踪到
             it->feature_per_frame.push_back(f_per_fra);
@@ -169,13 +205,10 @@ void FeatureManager::setDepth(const VectorXd &x)
 
 void FeatureManager::removeFailures()
 {
-    for (auto it = feature.begin(), it_next = feature.begin();
-         it != feature.end(); it = it_next)
-    {
-        it_next++;
-        if (it->solve_flag == 2)
-            feature.erase(it);
-    }
+    compactFeatures([](FeaturePerId &it)
+                    {
+        return it.solve_flag != 2;
+                    });
 }
 
 void FeatureManager::clearDepth()
@@ -272,7 +305,7 @@ void FeatureManager::initFramePoseByPnP(int frameCnt, Vector3d Ps[], Matrix3d Rs
     {
         vector<cv::Point2f> pts2D;
         vector<cv::Point3f> pts3D;
-        for (auto &it_per_id : feature)//list<FeaturePerId> feature 链表循环;
+        for (auto &it_per_id : feature)//vector<FeaturePerId> feature 按slot顺序遍历;
         {
             if (it_per_id.estimated_depth > 0)
             {
@@ -325,157 +358,94 @@ void FeatureManager::initFramePoseByPnP(int frameCnt, Vector3d Ps[], Matrix3d Rs
     }
 }
 
-void FeatureManager::triangulate(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[])
+// 两视图中点法: 在第0个相机坐标系下求两条视线的最近点，返回中点的深度。视线平行时返回-1
+// R01, t01为相机1到相机0的变换
+double FeatureManager::triangulateMidpoint(const Eigen::Matrix3d &R01, const Eigen::Vector3d &t01,
+                                           const Eigen::Vector2d &point0, const Eigen::Vector2d &point1)
 {
-    int i=0;
-    for (auto &it_per_id : feature)//feature list<FeaturePerId>
-    {
-        //i++;cout<<"i="<<i<<endl;
-        if (it_per_id.estimated_depth > 0)
-            continue;
-
-        if(STEREO && it_per_id.feature_per_frame[0].is_stereo)
-        {
-            //cout<<"size="<<it_per_id.feature_per_frame.size()<<"  isstereo="<<it_per_id.feature_per_frame[0].is_stereo<<endl;
-            int imu_i = it_per_id.start_frame;
-            Eigen::Matrix<double, 3, 4> leftPose;
-            Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[0];//利用imu的位姿计算左相机位姿t
-            Eigen::Matrix3d R0 = Rs[imu_i] * ric[0];//利用imu的位姿计算左相机位姿r
-            leftPose.leftCols<3>() = R0.transpose();//左边三列
-            leftPose.rightCols<1>() = -R0.transpose() * t0;
-//            cout << "left pose \n" << leftPose << "\n"<<"  row(2)=\n"<<leftPose.row(2)<<endl;
-            Eigen::Matrix<double, 3, 4> rightPose;
-            Eigen::Vector3d t1 = Ps[imu_i] + Rs[imu_i] * tic[1];//利用imu的位姿计算右相机位姿
-            Eigen::Matrix3d R1 = Rs[imu_i] * ric[1];//利用imu的位姿计算右相机位姿
-            rightPose.leftCols<3>() = R1.transpose();
-            rightPose.rightCols<1>() = -R1.transpose() * t1;
-            //cout << "right pose \n" << rightPose << endl;
-
-            Eigen::Vector2d point0, point1;
-            Eigen::Vector3d point3d ;
-            point0 = it_per_id.feature_per_frame[0].point.head(2);
-            point1 = it_per_id.feature_per_frame[0].pointRight.head(2);
-//            cout << "point0 " << point0.transpose()
-//            <<"  uv u="<<it_per_id.feature_per_frame[0].uv.x()<<"v="<<it_per_id.feature_per_frame[0].uv.y()<< endl;
-//            cout << "point1 " << point1.transpose()
-//            <<"  uv u="<<it_per_id.feature_per_frame[0].uvRight.x()<<"v="<<it_per_id.feature_per_frame[0].uvRight.y()<< endl;
-
-            triangulatePoint(leftPose, rightPose, point0, point1, point3d);//利用svd方法三角化
-            Eigen::Vector3d localPoint;//得到imu坐标系下的三维点坐标
-            //换到IMU坐标系
-            localPoint = leftPose.leftCols<3>() * point3d + leftPose.rightCols<1>();
-            double depth = localPoint.z();
-//            cout<<"depth "<<depth<<endl;
-            double depth_stereo=7.188560000000*53.7165718864418/
-                    (it_per_id.feature_per_frame[0].uv.x()-it_per_id.feature_per_frame[0].uvRight.x());
-//            cout<<"depth_stereo "<<depth_stereo<<endl;
-//            cout<<"depth_in_left_fram "<<point3d.z()<<endl;
-            if (depth > 0)
-                it_per_id.estimated_depth = depth;
-            else
-                it_per_id.estimated_depth = INIT_DEPTH;//INIT_DEPTH=5.0
-            /*
-            Vector3d ptsGt = pts_gt[it_per_id.feature_id];
-            printf("stereo %d pts: %f %f %f gt: %f %f %f \n",it_per_id.feature_id, point3d.x(), point3d.y(), point3d.z(),
-                                                            ptsGt.x(), ptsGt.y(), ptsGt.z());
-            */
-            continue;
-        }
-        else if(it_per_id.feature_per_frame.size() > 1)
-        {
-//            cout<<"size="<<it_per_id.feature_per_frame.size()<<"  isstereo="<<it_per_id.feature_per_frame[0].is_stereo<<endl;
-            int imu_i = it_per_id.start_frame;
-            Eigen::Matrix<double, 3, 4> leftPose;
-            Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[0];
-            Eigen::Matrix3d R0 = Rs[imu_i] * ric[0];
-            leftPose.leftCols<3>() = R0.transpose();
-            leftPose.rightCols<1>() = -R0.transpose() * t0;
-
-            imu_i++;
-            Eigen::Matrix<double, 3, 4> rightPose;
-            Eigen::Vector3d t1 = Ps[imu_i] + Rs[imu_i] * tic[0];
-            Eigen::Matrix3d R1 = Rs[imu_i] * ric[0];
-            rightPose.leftCols<3>() = R1.transpose();
-            rightPose.rightCols<1>() = -R1.transpose() * t1;
-
-            Eigen::Vector2d point0, point1;
-            Eigen::Vector3d point3d;
-            point0 = it_per_id.feature_per_frame[0].point.head(2);
-            point1 = it_per_id.feature_per_frame[1].point.head(2);
-//            cout << "           point0 " << point0.transpose()
-//                 <<"  uv u="<<it_per_id.feature_per_frame[0].uv.x()<<"v="<<it_per_id.feature_per_frame[0].uv.y()<< endl;
-//            cout << "           point1 " << point1.transpose()
-//                 <<"  uv u="<<it_per_id.feature_per_frame[0].uvRight.x()<<"v="<<it_per_id.feature_per_frame[0].uvRight.y()<< endl;
-
-            triangulatePoint(leftPose, rightPose, point0, point1, point3d);
-            Eigen::Vector3d localPoint;
-            localPoint = leftPose.leftCols<3>() * point3d + leftPose.rightCols<1>();
-            double depth = localPoint.z();
-//            cout<<"depth_size>1 "<<depth<<endl;
-            if (depth > 0)
-                it_per_id.estimated_depth = depth;
-            else
-                it_per_id.estimated_depth = INIT_DEPTH;
-            /*
-            Vector3d ptsGt = pts_gt[it_per_id.feature_id];
-            printf("motion  %d pts: %f %f %f gt: %f %f %f \n",it_per_id.feature_id, point3d.x(), point3d.y(), point3d.z(),
-                                                            ptsGt.x(), ptsGt.y(), ptsGt.z());
-            */
-            continue;
-        }
-        it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (it_per_id.used_num < 4)
-            continue;
-
-        int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
-
-        Eigen::MatrixXd svd_A(2 * it_per_id.feature_per_frame.size(), 4);
-        int svd_idx = 0;
-
-        Eigen::Matrix<double, 3, 4> P0;
-        Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[0];
-        Eigen::Matrix3d R0 = Rs[imu_i] * ric[0];
-        P0.leftCols<3>() = Eigen::Matrix3d::Identity();
-        P0.rightCols<1>() = Eigen::Vector3d::Zero();
-
-        for (auto &it_per_frame : it_per_id.feature_per_frame)
-        {
-            imu_j++;
-
-            Eigen::Vector3d t1 = Ps[imu_j] + Rs[imu_j] * tic[0];
-            Eigen::Matrix3d R1 = Rs[imu_j] * ric[0];
-            Eigen::Vector3d t = R0.transpose() * (t1 - t0);
-            Eigen::Matrix3d R = R0.transpose() * R1;
-            Eigen::Matrix<double, 3, 4> P;
-            P.leftCols<3>() = R.transpose();
-            P.rightCols<1>() = -R.transpose() * t;
-            Eigen::Vector3d f = it_per_frame.point.normalized();
-            svd_A.row(svd_idx++) = f[0] * P.row(2) - f[2] * P.row(0);
-            svd_A.row(svd_idx++) = f[1] * P.row(2) - f[2] * P.row(1);
-
-            if (imu_i == imu_j)
-                continue;
-        }
-        ROS_ASSERT(svd_idx == svd_A.rows());
-        Eigen::Vector4d svd_V = Eigen::JacobiSVD<Eigen::MatrixXd>(svd_A, Eigen::ComputeThinV).matrixV().rightCols<1>();
-        double svd_method = svd_V[2] / svd_V[3];
-        //it_per_id->estimated_depth = -b / A;
-        //it_per_id->estimated_depth = svd_V[2] / svd_V[3];
+    Eigen::Vector3d d0(point0.x(), point0.y(), 1.0);
+    Eigen::Vector3d d1 = R01 * Eigen::Vector3d(point1.x(), point1.y(), 1.0);
+    double a = d0.dot(d0), b = d0.dot(d1), c = d1.dot(d1);
+    double d = d0.dot(t01), e = d1.dot(t01);
+    double denom = a * c - b * b;
+    if (denom < 1e-12 * a * c)
+        return -1;
+    double s0 = (c * d - b * e) / denom;
+    double s1 = (b * d - a * e) / denom;
+    return 0.5 * (s0 + t01.z() + s1 * d1.z());
+}
 
-        it_per_id.estimated_depth = svd_method;
-        //it_per_id->estimated_depth = INIT_DEPTH;
+void FeatureManager::triangulateFeature(FeaturePerId &it_per_id, const Matrix3d Rc[][2], const Vector3d tc[][2])
+{
+    if(STEREO && it_per_id.feature_per_frame[0].is_stereo)
+    {
+        //同一帧左右目，imu位姿乘外参得到两个相机的位姿
+        int imu_i = it_per_id.start_frame;
+        Eigen::Matrix3d R01 = Rc[imu_i][0].transpose() * Rc[imu_i][1];
+        Eigen::Vector3d t01 = Rc[imu_i][0].transpose() * (tc[imu_i][1] - tc[imu_i][0]);
+        double depth = triangulateMidpoint(R01, t01, it_per_id.feature_per_frame[0].point.head(2),
+                                           it_per_id.feature_per_frame[0].pointRight.head(2));
+        if (depth > 0)
+            it_per_id.estimated_depth = depth;
+        else
+            it_per_id.estimated_depth = INIT_DEPTH;//INIT_DEPTH=5.0
+    }
+    else if(it_per_id.feature_per_frame.size() > 1)
+    {
+        //起始帧和下一帧的左目
+        int imu_i = it_per_id.start_frame;
+        int imu_j = imu_i + 1;
+        Eigen::Matrix3d R01 = Rc[imu_i][0].transpose() * Rc[imu_j][0];
+        Eigen::Vector3d t01 = Rc[imu_i][0].transpose() * (tc[imu_j][0] - tc[imu_i][0]);
+        double depth = triangulateMidpoint(R01, t01, it_per_id.feature_per_frame[0].point.head(2),
+                                           it_per_id.feature_per_frame[1].point.head(2));
+        if (depth > 0)
+            it_per_id.estimated_depth = depth;
+        else
+            it_per_id.estimated_depth = INIT_DEPTH;
+    }
+    //只有一次观测的点无法三角化，留到下一帧
+}
 
-        if (it_per_id.estimated_depth < 0.1)
+void FeatureManager::triangulate(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[])
+{
+    //已有深度的特征点不再三角化，其余的各自独立，可以并行
+    triangulate_index.clear();
+    for (int i = 0; i < (int)feature.size(); i++)
+        if (feature[i].estimated_depth <= 0)
+            triangulate_index.push_back(i);
+    if (triangulate_index.empty())
+        return;
+
+    //滑窗内每帧的相机位姿只算一次
+    Matrix3d Rc[WINDOW_SIZE + 1][2];
+    Vector3d tc[WINDOW_SIZE + 1][2];
+    for (int k = 0; k <= frameCnt; k++)
+        for (int c = 0; c < NUM_OF_CAM; c++)
         {
-            it_per_id.estimated_depth = INIT_DEPTH;
+            Rc[k][c] = Rs[k] * ric[c];
+            tc[k][c] = Ps[k] + Rs[k] * tic[c];
         }
 
-    }
+    const int chunk = 32;
+    int n = triangulate_index.size();
+    auto job = [&](int c)
+    {
+        int end = std::min(n, (c + 1) * chunk);
+        for (int i = c * chunk; i < end; i++)
+            triangulateFeature(feature[triangulate_index[i]], Rc, tc);
+    };
+    int num_chunks = (n + chunk - 1) / chunk;
+    if (pool)
+        pool->parallelFor(num_chunks, job);
+    else
+        for (int c = 0; c < num_chunks; c++)
+            job(c);
 }
 void FeatureManager::triangulate_sfm(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[])
 {
     int i=0;
-    for (auto &it_per_id : feature)//feature list<FeaturePerId>
+    for (auto &it_per_id : feature)//feature vector<FeaturePerId>
     {
         //i++;cout<<"i="<<i<<endl;
         if (it_per_id.estimated_depth > 0)
@@ -622,99 +592,79 @@ void FeatureManager::triangulate_sfm(int frameCnt, Vector3d Ps[], Matrix3d Rs[],
 
 void FeatureManager::removeOutlier(set<int> &outlierIndex)
 {
-    std::set<int>::iterator itSet;
-    for (auto it = feature.begin(), it_next = feature.begin();
-         it != feature.end(); it = it_next)
-    {
-        it_next++;
-        int index = it->feature_id;
-        itSet = outlierIndex.find(index);
-        if(itSet != outlierIndex.end())
-        {
-            feature.erase(it);
-            //printf("remove outlier %d \n", index);
-        }
-    }
+    if (outlierIndex.empty())
+        return;
+    compactFeatures([&](FeaturePerId &it)
+                    {
+        return outlierIndex.find(it.feature_id) == outlierIndex.end();
+                    });
 }
 
 void FeatureManager::removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3d marg_P, Eigen::Matrix3d new_R, Eigen::Vector3d new_P)
 {
-    for (auto it = feature.begin(), it_next = feature.begin();
-         it != feature.end(); it = it_next)
-    {
-        it_next++;
-
-        if (it->start_frame != 0)
-            it->start_frame--;
+    compactFeatures([&](FeaturePerId &it)
+                    {
+        if (it.start_frame != 0)
+            it.start_frame--;
         else
         {
-            Eigen::Vector3d uv_i = it->feature_per_frame[0].point;  
-            it->feature_per_frame.erase(it->feature_per_frame.begin());
-            if (it->feature_per_frame.size() < 2)
-            {
-                feature.erase(it);
-                continue;
-            }
+            Eigen::Vector3d uv_i = it.feature_per_frame[0].point;  
+            it.feature_per_frame.erase(it.feature_per_frame.begin());
+            if (it.feature_per_frame.size() < 2)
+                return false;
+            Eigen::Vector3d pts_i = uv_i * it.estimated_depth;
+            Eigen::Vector3d w_pts_i = marg_R * pts_i + marg_P;
+            Eigen::Vector3d pts_j = new_R.transpose() * (w_pts_i - new_P);
+            double dep_j = pts_j(2);
+            if (dep_j > 0)
+                it.estimated_depth = dep_j;
             else
-            {
-                Eigen::Vector3d pts_i = uv_i * it->estimated_depth;
-                Eigen::Vector3d w_pts_i = marg_R * pts_i + marg_P;
-                Eigen::Vector3d pts_j = new_R.transpose() * (w_pts_i - new_P);
-                double dep_j = pts_j(2);
-                if (dep_j > 0)
-                    it->estimated_depth = dep_j;
-                else
-                    it->estimated_depth = INIT_DEPTH;
-            }
+                it.estimated_depth = INIT_DEPTH;
         }
         // remove tracking-lost feature after marginalize
         /*
-        if (it->endFrame() < WINDOW_SIZE - 1)
-        {
-            feature.erase(it);
-        }
+        if (it.endFrame() < WINDOW_SIZE - 1)
+            return false;
         */
-    }
+        return true;
+                    });
 }
 
 void FeatureManager::removeBack()
 {
-    for (auto it = feature.begin(), it_next = feature.begin();
-         it != feature.end(); it = it_next)
-    {
-        it_next++;
-
-        if (it->start_frame != 0)
-            it->start_frame--;
+    compactFeatures([](FeaturePerId &it)
+                    {
+        if (it.start_frame != 0)
+            it.start_frame--;
         else
         {
-            it->feature_per_frame.erase(it->feature_per_frame.begin());
-            if (it->feature_per_frame.size() == 0)
-                feature.erase(it);
+            it.feature_per_frame.erase(it.feature_per_frame.begin());
+            if (it.feature_per_frame.size() == 0)
+                return false;
         }
-    }
+        return true;
+                    });
 }
 
 void FeatureManager::removeFront(int frame_count)
 {
-    for (auto it = feature.begin(), it_next = feature.begin(); it != feature.end(); it = it_next)
-    {
-        it_next++;
-
-        if (it->start_frame == frame_count)
+    compactFeatures([&](FeaturePerId &it)
+                    {
+        if (it.start_frame == frame_count)
         {
-            it->start_frame--;
+            it.start_frame--;
         }
         else
         {
-            int j = WINDOW_SIZE - 1 - it->start_frame;
-            if (it->endFrame() < frame_count - 1)
-                continue;
-            it->feature_per_frame.erase(it->feature_per_frame.begin() + j);
-            if (it->feature_per_frame.size() == 0)
-                feature.erase(it);
+            int j = WINDOW_SIZE - 1 - it.start_frame;
+            if (it.endFrame() < frame_count - 1)
+                return true;
+            it.feature_per_frame.erase(it.feature_per_frame.begin() + j);
+            if (it.feature_per_frame.size() == 0)
+                return false;
         }
-    }
+        return true;
+                    });
 }
 
 double FeatureManager::compensatedParallax2(const FeaturePerId &it_per_id, int frame_count)
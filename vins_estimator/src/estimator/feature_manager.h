@@ -14,6 +14,8 @@
 #include <algorithm>
 #include <vector>
 #include <numeric>
+#include <functional>
+#include <unordered_map>
 using namespace std;
 
 #include <eigen3/Eigen/Dense>
@@ -23,7 +25,9 @@ using namespace Eigen;
 #include <ros/assert.h>
 
 #include "parameters.h"
+#include "feature_frame.h"
 #include "../utility/tic_toc.h"
+#include "vins_common/thread_pool.h"
 
 class FeaturePerFrame
 {
@@ -61,7 +65,7 @@ class FeaturePerFrame
 class FeaturePerId
 {
   public:
-    const int feature_id;
+    int feature_id;
     int start_frame;
     vector<FeaturePerFrame> feature_per_frame;
     int used_num;
@@ -72,6 +76,7 @@ class FeaturePerId
         : feature_id(_feature_id), start_frame(_start_frame),
           used_num(0), estimated_depth(-1.0), solve_flag(0)
     {
+        feature_per_frame.reserve(WINDOW_SIZE + 1);
     }
 
     int endFrame();
@@ -83,9 +88,10 @@ class FeatureManager
     FeatureManager(Matrix3d _Rs[]);
 
     void setRic(Matrix3d _ric[]);
+    void setThreadPool(ThreadPool *_pool);
     void clearState();
     int getFeatureCount();
-    bool addFeatureCheckParallax(int frame_count, const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, double td);
+    bool addFeatureCheckParallax(int frame_count, const FeatureFrame &image, double td);
     vector<pair<Vector3d, Vector3d>> getCorresponding(int frame_count_l, int frame_count_r);
     //void updateDepth(const VectorXd &x);
     void setDepth(const VectorXd &x);
@@ -96,6 +102,8 @@ class FeatureManager
     void triangulate_sfm(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[]);
     void triangulatePoint(Eigen::Matrix<double, 3, 4> &Pose0, Eigen::Matrix<double, 3, 4> &Pose1,
                             Eigen::Vector2d &point0, Eigen::Vector2d &point1, Eigen::Vector3d &point_3d);
+    static double triangulateMidpoint(const Eigen::Matrix3d &R01, const Eigen::Vector3d &t01,
+                                      const Eigen::Vector2d &point0, const Eigen::Vector2d &point1);
     void initFramePoseByPnP(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[]);
     bool solvePoseByPnP(Eigen::Matrix3d &R_initial, Eigen::Vector3d &P_initial, 
                             vector<cv::Point2f> &pts2D, vector<cv::Point3f> &pts3D);
@@ -103,7 +111,11 @@ class FeatureManager
     void removeBack();
     void removeFront(int frame_count);
     void removeOutlier(set<int> &outlierIndex);
-    list<FeaturePerId> feature;
+    FeaturePerId *getFeature(int feature_id);
+    // 特征点连续存放，下标即slot号；feature_index由feature_id查slot
+    // 删除时保持其余特征点的相对顺序(和优化中para_Feature的顺序一致)
+    vector<FeaturePerId> feature;
+    unordered_map<int, int> feature_index;
     int last_track_num;
     double last_average_parallax;
     int new_feature_num;
@@ -111,8 +123,12 @@ class FeatureManager
 
   private:
     double compensatedParallax2(const FeaturePerId &it_per_id, int frame_count);
+    void compactFeatures(const std::function<bool(FeaturePerId &)> &keep);
+    void triangulateFeature(FeaturePerId &it_per_id, const Matrix3d Rc[][2], const Vector3d tc[][2]);
     const Matrix3d *Rs;
     Matrix3d ric[2];
+    ThreadPool *pool;
+    vector<int> triangulate_index;//本帧需要三角化的特征点
 };
 
 #endif
\ No newline at end of file
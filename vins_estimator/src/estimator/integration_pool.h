@@ -0,0 +1,73 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "../factor/integration_base.h"
+
+// 预积分对象池，所有IntegrationBase都归池所有。
+// pre_integrations[]和all_image_frame里各自持有从池里取出的对象(两者不共用，次新帧边缘化时窗口里的会合并)，
+// 不用时release还回来，滑窗时取出的就是刚还回去的那个，稳定后不再分配内存。
+// 只在处理线程里(持有mProcess时)使用，不加锁
+class IntegrationPool
+{
+  public:
+    IntegrationPool() : alloc_cnt(0) {}
+
+    IntegrationBase *acquire(const Eigen::Vector3d &acc_0, const Eigen::Vector3d &gyr_0,
+                             const Eigen::Vector3d &ba, const Eigen::Vector3d &bg)
+    {
+        if (free_list.empty())
+            return create(new IntegrationBase(acc_0, gyr_0, ba, bg));
+        IntegrationBase *p = take();
+        p->reset(acc_0, gyr_0, ba, bg);
+        return p;
+    }
+
+    IntegrationBase *acquire(const Eigen::Vector3d &acc_0, const Eigen::Vector3d &gyr_0, const Eigen::Vector3d &vel_0,
+                             const Eigen::Vector3d &ba, const Eigen::Vector3d &bg)
+    {
+        if (free_list.empty())
+            return create(new IntegrationBase(acc_0, gyr_0, vel_0, ba, bg));
+        IntegrationBase *p = take();
+        p->reset(acc_0, gyr_0, vel_0, ba, bg);
+        return p;
+    }
+
+    void release(IntegrationBase *p)
+    {
+        if (p != nullptr)
+            free_list.push_back(p);
+    }
+
+    // 累计new过的对象数，长时间运行应保持不变
+    int allocCount() const { return alloc_cnt; }
+    int inUse() const { return (int)(blocks.size() - free_list.size()); }
+
+  private:
+    IntegrationBase *create(IntegrationBase *p)
+    {
+        blocks.emplace_back(p);
+        alloc_cnt++;
+        return p;
+    }
+
+    IntegrationBase *take()
+    {
+        IntegrationBase *p = free_list.back();
+        free_list.pop_back();
+        return p;
+    }
+
+    std::vector<std::unique_ptr<IntegrationBase>> blocks;
+    std::vector<IntegrationBase *> free_list;
+    int alloc_cnt;
+};
@@ -48,6 +48,14 @@ int STEREO;
 int USE_IMU;
 int USE_WHEELS;
 int MULTIPLE_THREAD;
+int PIPELINE;
+int PIPELINE_QUEUE_SIZE;
+int MARGIN_THREADS;
+int SOLVER_THREADS;
+int LOG_BINARY;
+double FRAME_DEADLINE;
+int MIN_OPT_FEATURES;
+int IMU_BUF_SIZE = 4096, VEL_BUF_SIZE = 4096;
 int have_vel_T_cam;
 map<int, Eigen::Vector3d> pts_gt;
 std::string IMAGE0_TOPIC, IMAGE1_TOPIC;
@@ -58,9 +66,14 @@ int MIN_DIST;
 double F_THRESHOLD;
 int SHOW_TRACK;
 int FLOW_BACK;
+int PARALLEL_FLOW;
+int GRID_DETECT;
+int GRID_ROW, GRID_COL;
+int FAST_THRESHOLD;
 
 int IMU_FACTOR;
 int SHOW_MESSAGE;// 是否显示信息
+int DIAG_LEVEL;
 
 
 template <typename T>
@@ -102,14 +115,63 @@ void readParameters(std::string config_file)
     F_THRESHOLD = fsSettings["F_threshold"];
     SHOW_TRACK = fsSettings["show_track"];
     FLOW_BACK = fsSettings["flow_back"];
+    PARALLEL_FLOW = fsSettings["parallel_flow"];
+    GRID_DETECT = fsSettings["grid_detect"];
+    GRID_ROW = fsSettings["grid_row"];
+    GRID_COL = fsSettings["grid_col"];
+    if (GRID_ROW <= 0)
+        GRID_ROW = 4;
+    if (GRID_COL <= 0)
+        GRID_COL = 8;
+    FAST_THRESHOLD = fsSettings["fast_threshold"];
+    if (FAST_THRESHOLD <= 0)
+        FAST_THRESHOLD = 20;
     IMU_FACTOR = fsSettings["imu_factor"];
     CAM_NUM = fsSettings["cam_num"];
     SHOW_MESSAGE = fsSettings["show_message"];
+    DIAG_LEVEL = fsSettings["diag_level"];
+    if (SHOW_MESSAGE && DIAG_LEVEL < DIAG_MESSAGE)
+        DIAG_LEVEL = DIAG_MESSAGE;//兼容原来的show_message
+    if (DIAG_LEVEL > VINS_DIAG_LEVEL)
+        printf("diag_level %d is above the compiled level %d\n", DIAG_LEVEL, VINS_DIAG_LEVEL);
 
     MULTIPLE_THREAD = fsSettings["multiple_thread"];
+    PIPELINE = fsSettings["pipeline"];
+    PIPELINE_QUEUE_SIZE = fsSettings["pipeline_queue_size"];
+    if (PIPELINE_QUEUE_SIZE <= 0)
+        PIPELINE_QUEUE_SIZE = 2;
+    if (PIPELINE_QUEUE_SIZE > IMAGE_BUF_SIZE)
+        PIPELINE_QUEUE_SIZE = IMAGE_BUF_SIZE;
+    if (PIPELINE)
+        MULTIPLE_THREAD = 1;//流水线模式下后端一定在单独线程
+    printf("PIPELINE: %d queue size %d\n", PIPELINE, PIPELINE_QUEUE_SIZE);
+    MARGIN_THREADS = fsSettings["margin_threads"];
+    if (MARGIN_THREADS <= 0)
+        MARGIN_THREADS = 4;
+    SOLVER_THREADS = fsSettings["solver_threads"];
+    if (SOLVER_THREADS <= 0)
+        SOLVER_THREADS = 4;
+    LOG_BINARY = fsSettings["log_binary"];
+    FRAME_DEADLINE = fsSettings["frame_deadline"];
+    MIN_OPT_FEATURES = fsSettings["min_opt_features"];
+    if (MIN_OPT_FEATURES <= 0)
+        MIN_OPT_FEATURES = 60;
 
     USE_IMU = fsSettings["imu"];
     USE_WHEELS = fsSettings["wheels"];
+    //缓冲区要能装下后端最长一次停顿(初始化、长时间求解)期间的传感器数据，溢出会让系统重启
+    double imu_freq = fsSettings["imu_freq"];
+    double wheels_freq = fsSettings["wheels_freq"];
+    double input_buffer_time = fsSettings["input_buffer_time"];
+    if (imu_freq <= 0)
+        imu_freq = 1000;
+    if (wheels_freq <= 0)
+        wheels_freq = 200;
+    if (input_buffer_time <= 0)
+        input_buffer_time = 30;
+    IMU_BUF_SIZE = max(4096, (int)(imu_freq * input_buffer_time));
+    VEL_BUF_SIZE = max(4096, (int)(wheels_freq * input_buffer_time));
+    printf("input buffer: %.1f s, imu %d wheels %d\n", input_buffer_time, IMU_BUF_SIZE, VEL_BUF_SIZE);
     printf("USE_IMU: %d\n", USE_IMU);
     if(USE_IMU)
     {
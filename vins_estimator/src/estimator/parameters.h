@@ -24,6 +24,8 @@ const double FOCAL_LENGTH = 1280.0;
 extern const double for_average_parallax;// = 1280;//代码里有一些460的参数做了修改
 const int WINDOW_SIZE = 15;
 const int NUM_OF_F = 1000;
+const int FEATURE_BUF_SIZE = 64;
+const int IMAGE_BUF_SIZE = 8;
 //#define UNIT_SPHERE_ERROR
 
 extern double INIT_DEPTH;
@@ -63,6 +65,14 @@ extern int STEREO;
 extern int USE_IMU;
 extern int USE_WHEELS;//是否使用轮速计
 extern int MULTIPLE_THREAD;
+extern int PIPELINE;//图像跟踪和后端优化分线程流水执行
+extern int PIPELINE_QUEUE_SIZE;//流水线各级队列长度
+extern int MARGIN_THREADS;//边缘化线程池大小(包括处理线程)
+extern int SOLVER_THREADS;//ceres求解线程数(残差/雅可比计算和线性求解)
+extern int LOG_BINARY;//结果文件写成二进制
+extern double FRAME_DEADLINE;//每帧后端处理的时间预算(ms)，0表示用图像间隔
+extern int MIN_OPT_FEATURES;//超时减少路标点时至少保留的数量
+extern int IMU_BUF_SIZE, VEL_BUF_SIZE;//IMU/轮速计环形缓冲区容量，按频率和input_buffer_time算
 // pts_gt for debug purpose;
 extern map<int, Eigen::Vector3d> pts_gt;
 
@@ -74,9 +84,28 @@ extern int MIN_DIST;
 extern double F_THRESHOLD;
 extern int SHOW_TRACK;
 extern int FLOW_BACK;
+extern int GRID_DETECT;//0:全图goodFeaturesToTrack 1:网格Shi-Tomasi 2:网格FAST
+extern int GRID_ROW, GRID_COL;
+extern int FAST_THRESHOLD;//GRID_DETECT=2时FAST角点的阈值
+extern int PARALLEL_FLOW;//预先建立金字塔并行计算时间/双目光流
 
 extern int IMU_FACTOR;// 0 是自己的  1 是原始的 2 是encode
 extern int SHOW_MESSAGE;// 是否显示信息
+extern int DIAG_LEVEL;//运行时诊断级别
+
+// 诊断级别: 0关闭 1写诊断csv 2打印信息(SHOW_MESSAGE) 3画重投影误差图
+enum DiagLevel
+{
+    DIAG_OFF = 0,
+    DIAG_LOG = 1,
+    DIAG_MESSAGE = 2,
+    DIAG_VISUAL = 3
+};
+// 编译期上限，cmake -DVINS_DIAG_LEVEL=0 时所有诊断代码都被编译器去掉
+#ifndef VINS_DIAG_LEVEL
+#define VINS_DIAG_LEVEL 3
+#endif
+#define DIAG(level) (VINS_DIAG_LEVEL >= (level) && DIAG_LEVEL >= (level))
 
 void readParameters(std::string config_file);
 
@@ -0,0 +1,155 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+// 每帧的处理时间预算。
+// 根据前几帧的跟踪/边缘化/其余处理耗时估计本帧留给ceres的时间，超时或积压时减少进入优化的路标点(乘性减)，
+// 有余量时逐步放开(加性增)。deadline由frame_deadline配置，为0时用相邻图像的时间间隔。
+class SolverBudget
+{
+  public:
+    SolverBudget() : deadline(0), period(0), track_ms(0), margin_ms(0), other_ms(0),
+                     feature_budget(-1), min_features(0), frame_cnt(0), miss_cnt(0), miss_streak(0),
+                     last_process_ms(0), last_solver_time(0) {}
+
+    // deadline_ms <= 0时用测得的图像间隔
+    void setParameter(double deadline_ms, int min_feature_num)
+    {
+        deadline = deadline_ms;
+        min_features = min_feature_num;
+    }
+
+    void reset()
+    {
+        period = 0;
+        track_ms = margin_ms = other_ms = 0;
+        feature_budget = -1;
+        miss_streak = 0;
+    }
+
+    // 处理一帧之前调用，dt为与上一帧的时间间隔(s)
+    void beginFrame(double dt)
+    {
+        if (dt > 0 && dt < 1.0)
+            period = period > 0 ? 0.9 * period + 0.1 * dt * 1000 : dt * 1000;
+    }
+
+    // 当前帧的时间预算(ms)，<=0表示还没有可用的预算
+    double frameDeadline() const
+    {
+        return deadline > 0 ? deadline : period;
+    }
+
+    // 跟踪与后端串行执行(单线程)时跟踪也占用本帧时间
+    void addTrack(double t)
+    {
+        track_ms = filter(track_ms, t);
+    }
+
+    // 留给ceres的时间(s)，不超过max_solver_time
+    double solverTime(double max_solver_time, bool serial_track)
+    {
+        double budget = frameDeadline();
+        double t = max_solver_time;
+        if (budget > 0)
+        {
+            double left = budget - margin_ms - other_ms - (serial_track ? track_ms : 0);
+            //至少留max_solver_time的1/4，保证每帧都能迭代几次
+            double floor_t = max_solver_time > 0 ? 0.25 * max_solver_time : 0.005;
+            left = std::max(left / 1000.0, floor_t);
+            t = max_solver_time > 0 ? std::min(max_solver_time, left) : left;
+        }
+        last_solver_time = t;
+        return t;
+    }
+
+    // 本帧最多加入优化的路标点数，<0表示不限制
+    int featureBudget() const
+    {
+        return feature_budget;
+    }
+
+    // 按跟踪长度从长到短选取路标点: 跟踪长度>min_len的全部保留，==min_len的保留tie_quota个
+    // track_cnt[l]为跟踪长度为l的路标点数
+    void selectThreshold(const std::vector<int> &track_cnt, int &min_len, int &tie_quota) const
+    {
+        min_len = 0;
+        tie_quota = -1;
+        if (feature_budget < 0)
+            return;
+        int left = feature_budget;
+        for (int l = (int)track_cnt.size() - 1; l >= 0; l--)
+        {
+            if (track_cnt[l] >= left)
+            {
+                min_len = l;
+                tie_quota = left;
+                return;
+            }
+            left -= track_cnt[l];
+        }
+    }
+
+    // 处理完一帧后调用。process为整帧后端处理耗时，solve/margin为其中ceres和边缘化的耗时(ms)
+    // used_features为本帧实际加入优化的路标点数，backlog为还在排队的帧数。返回本帧是否超时
+    bool endFrame(double process, double solve, double margin, int used_features, int backlog, bool serial_track)
+    {
+        frame_cnt++;
+        last_process_ms = process + (serial_track ? track_ms : 0);
+        margin_ms = filter(margin_ms, margin);
+        other_ms = filter(other_ms, std::max(process - solve - margin, 0.0));
+
+        double budget = frameDeadline();
+        if (budget <= 0)
+            return false;
+        bool miss = last_process_ms > budget;
+        if (miss)
+        {
+            miss_cnt++;
+            miss_streak++;
+        }
+        else
+            miss_streak = 0;
+
+        if (miss || backlog > 0)
+        {
+            int n = std::max(int(used_features * 0.8), min_features);
+            feature_budget = feature_budget < 0 ? n : std::min(feature_budget, n);
+            if (feature_budget < min_features)
+                feature_budget = min_features;
+        }
+        else if (feature_budget >= 0 && last_process_ms < 0.7 * budget)
+        {
+            //负载降下来后逐步放开，路标点数不再受限时取消限制
+            feature_budget += 10;
+            if (feature_budget > used_features + 10)
+                feature_budget = -1;
+        }
+        return miss;
+    }
+
+    double deadline;      //配置的预算(ms)
+    double period;        //测得的图像间隔(ms)
+    double track_ms, margin_ms, other_ms;//平滑后的耗时
+    int feature_budget;
+    int min_features;
+    int frame_cnt, miss_cnt, miss_streak;
+    double last_process_ms, last_solver_time;
+
+  private:
+    //突增立即跟上，下降时慢慢回落
+    static double filter(double avg, double t)
+    {
+        return t > avg ? t : 0.8 * avg + 0.2 * t;
+    }
+};
@@ -67,7 +67,7 @@ class IMUEncoderFactor : public ceres::SizedCostFunction<18, 7, 9, 7, 9>
             Eigen::Matrix<double, 18, 18> cov = pre_integration->covariance_enc;
             cov.matrix().block<18,3>(0,12) = pow(10,decrease)*cov.matrix().block<18,3>(0,12);
             cov.matrix().block<3,12>(12,0) = pow(10,decrease)*cov.matrix().block<3,12>(12,0);
-            if(SHOW_MESSAGE) {
+            if(DIAG(DIAG_MESSAGE)) {
                 std::cout << "decrease=" << decrease << "  " << pow(10, decrease) << std::endl;
                 std::cout << "cov\n" << cov << std::endl;
             }
@@ -13,6 +13,7 @@
 #include "../estimator/parameters.h"
 
 #include <ceres/ceres.h>
+#include <atomic>
 using namespace Eigen;
 
 class IntegrationBase
@@ -21,59 +22,31 @@ class IntegrationBase
     IntegrationBase() = delete;
     IntegrationBase(const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
                     const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
-        : acc_0{_acc_0}, gyr_0{_gyr_0}, linearized_acc{_acc_0}, linearized_gyr{_gyr_0},
-          linearized_ba{_linearized_ba}, linearized_bg{_linearized_bg},
-          jacobian{Eigen::Matrix<double, 18, 18>::Identity()}, covariance{Eigen::Matrix<double, 18, 18>::Zero()},
-          jacobian_origin{Eigen::Matrix<double, 15, 15>::Identity()}, covariance_origin{Eigen::Matrix<double, 15, 15>::Zero()},
-          sum_dt{0.0}, delta_p{Eigen::Vector3d::Zero()}, delta_q{Eigen::Quaterniond::Identity()}, delta_v{Eigen::Vector3d::Zero()},
-          delta_p_i_vel{Eigen::Vector3d::Zero()},delta_angleaxis{0, Eigen::Vector3d ( 0,0,1 ) }
-
     {
-        noise = Eigen::Matrix<double, 21, 21>::Zero();
-        noise.block<3, 3>(0, 0) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(3, 3) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(6, 6) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(9, 9) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(12, 12) =  (ACC_W * ACC_W) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(15, 15) =  (GYR_W * GYR_W) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(18, 18) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();//轮速
-
-        noise_origin =  Eigen::Matrix<double, 18, 18>::Zero();
-        noise_origin.block<3, 3>(0, 0) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-        noise_origin.block<3, 3>(3, 3) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-        noise_origin.block<3, 3>(6, 6) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-        noise_origin.block<3, 3>(9, 9) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-        noise_origin.block<3, 3>(12, 12) =  (ACC_W * ACC_W) * Eigen::Matrix3d::Identity();
-        noise_origin.block<3, 3>(15, 15) =  (GYR_W * GYR_W) * Eigen::Matrix3d::Identity();
+        samples.reserve(sampleCapacity());
+        reset(_acc_0, _gyr_0, _linearized_ba, _linearized_bg);
     }
     IntegrationBase(const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0, const Eigen::Vector3d &_vel_0,
                     const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
-            : acc_0{_acc_0}, gyr_0{_gyr_0}, vel_0{_vel_0}, linearized_acc{_acc_0}, linearized_gyr{_gyr_0},
-              linearized_ba{_linearized_ba}, linearized_bg{_linearized_bg},
-              jacobian{Eigen::Matrix<double, 18, 18>::Identity()}, covariance{Eigen::Matrix<double, 18, 18>::Zero()},
-              jacobian_origin{Eigen::Matrix<double, 15, 15>::Identity()}, covariance_origin{Eigen::Matrix<double, 15, 15>::Zero()},
-              jacobian_enc{Eigen::Matrix<double, 18, 18>::Identity()}, covariance_enc{Eigen::Matrix<double, 18, 18>::Zero()},
-              sum_dt{0.0}, delta_p{Eigen::Vector3d::Zero()}, delta_q{Eigen::Quaterniond::Identity()}, delta_v{Eigen::Vector3d::Zero()},
-              delta_p_i_vel{Eigen::Vector3d::Zero()},delta_angleaxis{0, Eigen::Vector3d ( 0,0,1 ) }
+    {
+        samples.reserve(sampleCapacity());
+        reset(_acc_0, _gyr_0, _vel_0, _linearized_ba, _linearized_bg);
+    }
 
+    // 构造和从IntegrationPool里重新取出时调用，samples只清空不释放空间
+    void reset(const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
+               const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
     {
-        noise = Eigen::Matrix<double, 21, 21>::Zero();
-        noise.block<3, 3>(0, 0) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(3, 3) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(6, 6) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(9, 9) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(12, 12) =  (ACC_W * ACC_W) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(15, 15) =  (GYR_W * GYR_W) * Eigen::Matrix3d::Identity();
+        init(_acc_0, _gyr_0, Eigen::Vector3d::Zero(), _linearized_ba, _linearized_bg);
+        noise.block<3, 3>(18, 18) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();//轮速
+        noise_enc = Eigen::Matrix<double, 24, 24>::Zero();
+    }
+    void reset(const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0, const Eigen::Vector3d &_vel_0,
+               const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
+    {
+        init(_acc_0, _gyr_0, _vel_0, _linearized_ba, _linearized_bg);
         noise.block<3, 3>(18, 18) =  (ENC_N * ENC_N) * Eigen::Matrix3d::Identity();//轮速
 
-        noise_origin =  Eigen::Matrix<double, 18, 18>::Zero();
-        noise_origin.block<3, 3>(0, 0) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-        noise_origin.block<3, 3>(3, 3) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-        noise_origin.block<3, 3>(6, 6) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-        noise_origin.block<3, 3>(9, 9) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-        noise_origin.block<3, 3>(12, 12) =  (ACC_W * ACC_W) * Eigen::Matrix3d::Identity();
-        noise_origin.block<3, 3>(15, 15) =  (GYR_W * GYR_W) * Eigen::Matrix3d::Identity();
-
         noise_enc = Eigen::Matrix<double, 24, 24>::Zero();
         noise_enc.block<3, 3>(0, 0) = (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
         noise_enc.block<3, 3>(3, 3) = (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
@@ -83,25 +56,18 @@ class IntegrationBase
         noise_enc.block<3, 3>(15, 15) = (ENC_N * ENC_N) * Eigen::Matrix3d::Identity();
         noise_enc.block<3, 3>(18, 18) = (ACC_W * ACC_W) * Eigen::Matrix3d::Identity();
         noise_enc.block<3, 3>(21, 21) = (GYR_W * GYR_W) * Eigen::Matrix3d::Identity();
-
     }
 
     void push_back(double dt, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr)
     {
-        //cout<<"acc_buf.size()  "<<acc_buf.size()<<endl;
-        dt_buf.push_back(dt);
-        acc_buf.push_back(acc);
-        gyr_buf.push_back(gyr);
+        addSample(dt, acc, gyr, Eigen::Vector3d::Zero());
         propagate(dt, acc, gyr);
     }
 
     void push_back_wheels(double dt, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr, const Eigen::Vector3d &vel)
     {
-        //cout<<"acc_buf.size()  "<<acc_buf.size()<<endl;
-        dt_buf.push_back(dt);
-        acc_buf.push_back(acc);
-        gyr_buf.push_back(gyr);
-        vel_buf.push_back(vel);
+        with_wheel = true;
+        addSample(dt, acc, gyr, vel);
         propagate_wheel(dt, acc, gyr,vel);
     }
 
@@ -110,20 +76,99 @@ class IntegrationBase
         sum_dt = 0.0;
         acc_0 = linearized_acc;
         gyr_0 = linearized_gyr;
+        vel_0 = linearized_vel;
         delta_p.setZero();
         delta_q.setIdentity();
         delta_v.setZero();
         delta_p_i_vel.setZero();
-        delta_angleaxis.fromRotationMatrix(delta_q.toRotationMatrix());
+        delta_angleaxis = delta_q;
         linearized_ba = _linearized_ba;
         linearized_bg = _linearized_bg;
+        //三种因子各自的雅可比和协方差都要从头积分
         jacobian.setIdentity();
         covariance.setZero();
-//        for (int i = 0; i < static_cast<int>(dt_buf.size()); i++)
-//            propagate(dt_buf[i], acc_buf[i], gyr_buf[i]);
-        std::cout<<"dt_buf.size() "<<dt_buf.size()<<std::endl;
-        for (int i = 0; i < static_cast<int>(dt_buf.size()); i++)
-            propagate_wheel(dt_buf[i], acc_buf[i], gyr_buf[i],vel_buf[i]);
+        covariance_origin.setZero();
+        jacobian_enc.setIdentity();
+        covariance_enc.setZero();
+        if(DIAG(DIAG_MESSAGE))
+            std::cout<<"repropagate samples "<<samples.size()<<std::endl;
+        if(with_wheel)
+        {
+            for (size_t i = 0; i < samples.size(); i++)
+                propagate_wheel(samples[i].dt, samples[i].acc, samples[i].gyr, samples[i].vel);
+        }
+        else
+        {
+            for (size_t i = 0; i < samples.size(); i++)
+                propagate(samples[i].dt, samples[i].acc, samples[i].gyr);
+        }
+    }
+
+    // bias相对线性化点的变化不大时evaluate里用雅可比一阶修正就够了，超过阈值才需要repropagate
+    bool biasDrifted(const Eigen::Vector3d &ba, const Eigen::Vector3d &bg) const
+    {
+        return (ba - linearized_ba).norm() > BIAS_ACC_THRESHOLD || (bg - linearized_bg).norm() > BIAS_GYR_THRESHOLD;
+    }
+
+    // 中值积分的状态转移F和噪声矩阵V中P,R,V,Ba,Bg的部分(前15行)，纯IMU和轮速计模式0/1共用
+    // R0/R1为积分前后的delta_q
+    template <int N, int M>
+    static void imuTransition(double _dt, const Matrix3d &R0, const Matrix3d &R1, const Matrix3d &R_w_x,
+                              const Matrix3d &R_a_0_x, const Matrix3d &R_a_1_x,
+                              Eigen::Matrix<double, N, N> &F, Eigen::Matrix<double, N, M> &V)
+    {
+        Matrix3d I_w = Matrix3d::Identity() - R_w_x * _dt;
+        Matrix3d R1_a_1 = R1 * R_a_1_x;
+        F.setZero();
+        F.template block<3, 3>(0, 0) = Matrix3d::Identity();
+        F.template block<3, 3>(0, 3) = -0.25 * R0 * R_a_0_x * _dt * _dt +
+                                       -0.25 * R1_a_1 * I_w * _dt * _dt;
+        F.template block<3, 3>(0, 6) = Matrix3d::Identity() * _dt;
+        F.template block<3, 3>(0, 9) = -0.25 * (R0 + R1) * _dt * _dt;
+        F.template block<3, 3>(0, 12) = -0.25 * R1_a_1 * _dt * _dt * -_dt;
+        F.template block<3, 3>(3, 3) = I_w;
+        F.template block<3, 3>(3, 12) = -1.0 * Matrix3d::Identity() * _dt;
+        F.template block<3, 3>(6, 3) = -0.5 * R0 * R_a_0_x * _dt +
+                                       -0.5 * R1_a_1 * I_w * _dt;
+        F.template block<3, 3>(6, 6) = Matrix3d::Identity();
+        F.template block<3, 3>(6, 9) = -0.5 * (R0 + R1) * _dt;
+        F.template block<3, 3>(6, 12) = -0.5 * R1_a_1 * _dt * -_dt;
+        F.template block<3, 3>(9, 9) = Matrix3d::Identity();
+        F.template block<3, 3>(12, 12) = Matrix3d::Identity();
+
+        V.setZero();
+        V.template block<3, 3>(0, 0) =  0.25 * R0 * _dt * _dt;
+        V.template block<3, 3>(0, 3) =  0.25 * -R1_a_1 * _dt * _dt * 0.5 * _dt;
+        V.template block<3, 3>(0, 6) =  0.25 * R1 * _dt * _dt;
+        V.template block<3, 3>(0, 9) =  V.template block<3, 3>(0, 3);
+        V.template block<3, 3>(3, 3) =  0.5 * Matrix3d::Identity() * _dt;
+        V.template block<3, 3>(3, 9) =  0.5 * Matrix3d::Identity() * _dt;
+        V.template block<3, 3>(6, 0) =  0.5 * R0 * _dt;
+        V.template block<3, 3>(6, 3) =  0.5 * -R1_a_1 * _dt * 0.5 * _dt;
+        V.template block<3, 3>(6, 6) =  0.5 * R1 * _dt;
+        V.template block<3, 3>(6, 9) =  V.template block<3, 3>(6, 3);
+        V.template block<3, 3>(9, 12) = Matrix3d::Identity() * _dt;
+        V.template block<3, 3>(12, 15) = Matrix3d::Identity() * _dt;
+    }
+
+    // P = F * P * F^T + V * N * V^T，噪声矩阵是对角的
+    template <int N, int M>
+    static void propagateCovariance(const Eigen::Matrix<double, N, N> &F, const Eigen::Matrix<double, N, M> &V,
+                                    const Eigen::Matrix<double, M, M> &noise, Eigen::Matrix<double, N, N> &cov)
+    {
+        Eigen::Matrix<double, N, N> FP;
+        FP.noalias() = F * cov;
+        cov.noalias() = FP * F.transpose();
+        cov.noalias() += V * noise.diagonal().asDiagonal() * V.transpose();
+    }
+
+    static Matrix3d skew(const Vector3d &v)
+    {
+        Matrix3d m;
+        m << 0, -v(2), v(1),
+             v(2), 0, -v(0),
+             -v(1), v(0), 0;
+        return m;
     }
 
     void midPointIntegration(double _dt, 
@@ -150,54 +195,17 @@ class IntegrationBase
             Vector3d w_x = 0.5 * (_gyr_0 + _gyr_1) - linearized_bg;
             Vector3d a_0_x = _acc_0 - linearized_ba;
             Vector3d a_1_x = _acc_1 - linearized_ba;
-            Matrix3d R_w_x, R_a_0_x, R_a_1_x;
-
-            R_w_x<<0, -w_x(2), w_x(1),
-                w_x(2), 0, -w_x(0),
-                -w_x(1), w_x(0), 0;
-            R_a_0_x<<0, -a_0_x(2), a_0_x(1),
-                a_0_x(2), 0, -a_0_x(0),
-                -a_0_x(1), a_0_x(0), 0;
-            R_a_1_x<<0, -a_1_x(2), a_1_x(1),
-                a_1_x(2), 0, -a_1_x(0),
-                -a_1_x(1), a_1_x(0), 0;
-
-            MatrixXd F = MatrixXd::Zero(15, 15);
-            F.block<3, 3>(0, 0) = Matrix3d::Identity();
-            F.block<3, 3>(0, 3) = -0.25 * delta_q.toRotationMatrix() * R_a_0_x * _dt * _dt + 
-                                  -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt * _dt;
-            F.block<3, 3>(0, 6) = MatrixXd::Identity(3,3) * _dt;
-            F.block<3, 3>(0, 9) = -0.25 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt * _dt;
-            F.block<3, 3>(0, 12) = -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * _dt * -_dt;
-            F.block<3, 3>(3, 3) = Matrix3d::Identity() - R_w_x * _dt;
-            F.block<3, 3>(3, 12) = -1.0 * MatrixXd::Identity(3,3) * _dt;
-            F.block<3, 3>(6, 3) = -0.5 * delta_q.toRotationMatrix() * R_a_0_x * _dt + 
-                                  -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt;
-            F.block<3, 3>(6, 6) = Matrix3d::Identity();
-            F.block<3, 3>(6, 9) = -0.5 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt;
-            F.block<3, 3>(6, 12) = -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * -_dt;
-            F.block<3, 3>(9, 9) = Matrix3d::Identity();
-            F.block<3, 3>(12, 12) = Matrix3d::Identity();
-            //cout<<"A"<<endl<<A<<endl;
 
-            MatrixXd V = MatrixXd::Zero(15,18);
-            V.block<3, 3>(0, 0) =  0.25 * delta_q.toRotationMatrix() * _dt * _dt;
-            V.block<3, 3>(0, 3) =  0.25 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * _dt * 0.5 * _dt;
-            V.block<3, 3>(0, 6) =  0.25 * result_delta_q.toRotationMatrix() * _dt * _dt;
-            V.block<3, 3>(0, 9) =  V.block<3, 3>(0, 3);
-            V.block<3, 3>(3, 3) =  0.5 * MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(3, 9) =  0.5 * MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(6, 0) =  0.5 * delta_q.toRotationMatrix() * _dt;
-            V.block<3, 3>(6, 3) =  0.5 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * 0.5 * _dt;
-            V.block<3, 3>(6, 6) =  0.5 * result_delta_q.toRotationMatrix() * _dt;
-            V.block<3, 3>(6, 9) =  V.block<3, 3>(6, 3);
-            V.block<3, 3>(9, 12) = MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(12, 15) = MatrixXd::Identity(3,3) * _dt;
+            //没有轮速时只有15维状态，雅可比放在jacobian的左上角，协方差放在covariance_origin
+            Eigen::Matrix<double, 15, 15> F;
+            Eigen::Matrix<double, 15, 18> V;
+            imuTransition(_dt, delta_q.toRotationMatrix(), result_delta_q.toRotationMatrix(),
+                          skew(w_x), skew(a_0_x), skew(a_1_x), F, V);
 
             //step_jacobian = F;
             //step_V = V;
-            jacobian = F * jacobian;
-            covariance = F * covariance * F.transpose() + V * noise * V.transpose();
+            jacobian.topLeftCorner<15, 15>() = F * jacobian.topLeftCorner<15, 15>();
+            propagateCovariance(F, V, noise_origin, covariance_origin);
         }
 
     }
@@ -234,115 +242,42 @@ class IntegrationBase
             Vector3d w_x = 0.5 * (_gyr_0 + _gyr_1) - linearized_bg;
             Vector3d a_0_x = _acc_0 - linearized_ba;
             Vector3d a_1_x = _acc_1 - linearized_ba;
-            Matrix3d R_w_x, R_a_0_x, R_a_1_x;
-
-            Vector3d vel_0_x,vel_1_x;
-            vel_0_x = RIV[0]*_vel_0;
-            vel_1_x = RIV[0]*_vel_1;
-            Matrix3d R_vel_0_x,R_vel_1_x;
-
-            R_w_x<<0, -w_x(2), w_x(1),
-                    w_x(2), 0, -w_x(0),
-                    -w_x(1), w_x(0), 0;
-            R_a_0_x<<0, -a_0_x(2), a_0_x(1),
-                    a_0_x(2), 0, -a_0_x(0),
-                    -a_0_x(1), a_0_x(0), 0;
-            R_a_1_x<<0, -a_1_x(2), a_1_x(1),
-                    a_1_x(2), 0, -a_1_x(0),
-                    -a_1_x(1), a_1_x(0), 0;
-            R_vel_0_x<< 0,                  -vel_0_x(2),     vel_0_x(1),
-                        vel_0_x(2),          0,               -vel_0_x(0),
-                        -vel_0_x(1),     vel_0_x(0),          0;
-            R_vel_1_x<< 0,                   -vel_1_x(2),       vel_1_x(1),
-                        vel_1_x(2),          0,                 -vel_1_x(0),
-                        -vel_1_x(1),     vel_1_x(0),             0;
-
-
-            MatrixXd F = MatrixXd::Zero(18, 18);
-            F.block<3, 3>(0, 0) = Matrix3d::Identity();
-            F.block<3, 3>(0, 3) = -0.25 * delta_q.toRotationMatrix() * R_a_0_x * _dt * _dt +
-                                  -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt * _dt;
-            F.block<3, 3>(0, 6) = MatrixXd::Identity(3,3) * _dt;
-            F.block<3, 3>(0, 9) = -0.25 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt * _dt;
-            F.block<3, 3>(0, 12) = -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * _dt * -_dt;
-            F.block<3, 3>(3, 3) = Matrix3d::Identity() - R_w_x * _dt;
-            F.block<3, 3>(3, 12) = -1.0 * MatrixXd::Identity(3,3) * _dt;
-            F.block<3, 3>(6, 3) = -0.5 * delta_q.toRotationMatrix() * R_a_0_x * _dt +
-                                  -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt;
-            F.block<3, 3>(6, 6) = Matrix3d::Identity();
-            F.block<3, 3>(6, 9) = -0.5 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt;
-            F.block<3, 3>(6, 12) = -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * -_dt;
-            F.block<3, 3>(9, 9) = Matrix3d::Identity();
-            F.block<3, 3>(12, 12) = Matrix3d::Identity();
+            Matrix3d R_w_x = skew(w_x);
+            Matrix3d R0 = delta_q.toRotationMatrix();
+            Matrix3d R1 = result_delta_q.toRotationMatrix();
+
+            //IMUFactor_origin只用15维的雅可比(jacobian左上角)和covariance_origin，轮速那3维不用积分
+            if(IMU_FACTOR == 1)
+            {
+                Eigen::Matrix<double, 15, 15> F;
+                Eigen::Matrix<double, 15, 18> V;
+                imuTransition(_dt, R0, R1, R_w_x, skew(a_0_x), skew(a_1_x), F, V);
+                jacobian.topLeftCorner<15, 15>() = F * jacobian.topLeftCorner<15, 15>();
+                propagateCovariance(F, V, noise_origin, covariance_origin);
+                return;
+            }
+
+            Matrix3d R_vel_0_x = skew(RIV[0] * _vel_0);
+            Matrix3d R_vel_1_x = skew(RIV[0] * _vel_1);
+
+            Eigen::Matrix<double, 18, 18> F;
+            Eigen::Matrix<double, 18, 21> V;
+            imuTransition(_dt, R0, R1, R_w_x, skew(a_0_x), skew(a_1_x), F, V);
             //vel
-            F.block<3, 3>(15, 3) = (-0.5 * delta_q.toRotationMatrix() * R_vel_0_x * _dt +
-                                   -0.5 * result_delta_q.toRotationMatrix() * R_vel_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt);  //对角度
-            F.block<3, 3>(15, 12) = (-0.5 * result_delta_q.toRotationMatrix() * R_vel_1_x * _dt);//对角度bias
+            F.block<3, 3>(15, 3) = (-0.5 * R0 * R_vel_0_x * _dt +
+                                   -0.5 * R1 * R_vel_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt);  //对角度
+            F.block<3, 3>(15, 12) = (-0.5 * R1 * R_vel_1_x * _dt);//对角度bias
             F.block<3, 3>(15, 15) = Matrix3d::Identity();//对轮速计偏差
 
-            MatrixXd F_origin = F.matrix().block<15,15>(0,0);
-            //cout<<"A"<<endl<<A<<endl;
-#if 1
-            MatrixXd V = MatrixXd::Zero(18,21);
-            V.block<3, 3>(0, 0) =  0.25 * delta_q.toRotationMatrix() * _dt * _dt;
-            V.block<3, 3>(0, 3) =  0.25 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * _dt * 0.5 * _dt;
-            V.block<3, 3>(0, 6) =  0.25 * result_delta_q.toRotationMatrix() * _dt * _dt;
-            V.block<3, 3>(0, 9) =  V.block<3, 3>(0, 3);
-            V.block<3, 3>(3, 3) =  0.5 * MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(3, 9) =  0.5 * MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(6, 0) =  0.5 * delta_q.toRotationMatrix() * _dt;
-            V.block<3, 3>(6, 3) =  0.5 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * 0.5 * _dt;
-            V.block<3, 3>(6, 6) =  0.5 * result_delta_q.toRotationMatrix() * _dt;
-            V.block<3, 3>(6, 9) =  V.block<3, 3>(6, 3);
-            V.block<3, 3>(9, 12) = MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(12, 15) = MatrixXd::Identity(3,3) * _dt;
-
             //轮式计
-            V.block<3, 3>(15, 3) = 0.25 * -result_delta_q.toRotationMatrix() * R_vel_1_x * _dt  * _dt;
+            V.block<3, 3>(15, 3) = 0.25 * -R1 * R_vel_1_x * _dt  * _dt;
             V.block<3, 3>(15, 9) = V.block<3, 3>(15, 3);
-            V.block<3, 3>(15, 18) = 0.5 * (delta_q.toRotationMatrix()*RIV[0]+result_delta_q.toRotationMatrix()*RIV[0]) * _dt;
+            V.block<3, 3>(15, 18) = 0.5 * (R0 * RIV[0] + R1 * RIV[0]) * _dt;
 
-            MatrixXd V_origin = V.matrix().block<15,18>(0,0);
             //step_jacobian = F;
             //step_V = V;
             jacobian = F * jacobian;
-            jacobian_origin = F_origin * jacobian_origin;
-
-            covariance = F * covariance * F.transpose() + V * noise * V.transpose();
-            covariance_origin = F_origin * covariance_origin * F_origin.transpose() + V_origin * noise_origin * V_origin.transpose();
-#else
-            MatrixXd V = MatrixXd::Zero(18,24);
-            V.block<3, 3>(0, 0) =  0.25 * delta_q.toRotationMatrix() * _dt * _dt;
-            V.block<3, 3>(0, 3) =  0.25 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * _dt * 0.5 * _dt;
-            V.block<3, 3>(0, 6) =  0.25 * result_delta_q.toRotationMatrix() * _dt * _dt;
-            V.block<3, 3>(0, 9) =  V.block<3, 3>(0, 3);
-            V.block<3, 3>(3, 3) =  0.5 * MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(3, 9) =  0.5 * MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(6, 0) =  0.5 * delta_q.toRotationMatrix() * _dt;
-            V.block<3, 3>(6, 3) =  0.5 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * 0.5 * _dt;
-            V.block<3, 3>(6, 6) =  0.5 * result_delta_q.toRotationMatrix() * _dt;
-            V.block<3, 3>(6, 9) =  V.block<3, 3>(6, 3);
-            V.block<3, 3>(9, 12) = MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(12, 15) = MatrixXd::Identity(3,3) * _dt;
-
-            //轮式计
-            V.block<3, 3>(15, 3) = 0.25 * -result_delta_q.toRotationMatrix() * R_vel_1_x * _dt  * _dt;
-            V.block<3, 3>(15, 9) = V.block<3, 3>(15, 3);
-            V.block<3, 3>(15, 18) = 0.5 * (delta_q.toRotationMatrix()*RIV[0]) * _dt;
-            V.block<3, 3>(15, 21) = 0.5 * (result_delta_q.toRotationMatrix()*RIV[0]) * _dt;
-
-
-            MatrixXd V_origin = V.matrix().block<15,18>(0,0);
-            //step_jacobian = F;
-            //step_V = V;
-            jacobian = F * jacobian;
-            jacobian_origin = F_origin * jacobian_origin;
-
-            covariance = F * covariance * F.transpose() + V * noise_enc * V.transpose();
-            covariance_origin = F_origin * covariance_origin * F_origin.transpose() + V_origin * noise_origin * V_origin.transpose();
-#endif
-
-
+            propagateCovariance(F, V, noise, covariance);
         }
 
     }
@@ -362,23 +297,11 @@ class IntegrationBase
         Vector3d un_acc_0 = delta_q * (_acc_0 - linearized_ba);
         Vector3d un_gyr = 0.5 * (_gyr_0 + _gyr_1) - linearized_bg;
         Vector3d un_vel_0 = delta_q * RIV[0] * (_vel_0);//轮速
-//        Eigen::Matrix3d delta_R_rpy=(Eigen::AngleAxisd(un_gyr(2)*_dt,Eigen::Vector3d::UnitZ())
-//                                    *Eigen::AngleAxisd(un_gyr(1)*_dt,Eigen::Vector3d::UnitY())
-//                                    *Eigen::AngleAxisd(un_gyr(0)*_dt,Eigen::Vector3d::UnitX())).toRotationMatrix();
-//        Eigen::Quaterniond delta_q_rpy(delta_R_rpy);
-//        std::cout<<"delta_q_rpy\t"<<delta_q_rpy.coeffs().transpose()<<std::endl;
         result_delta_q = delta_q * Quaterniond(1, un_gyr(0) * _dt / 2, un_gyr(1) * _dt / 2, un_gyr(2) * _dt / 2);
-//        Eigen::Quaterniond delta_q_normed = result_delta_q;
-//        delta_q_normed.normalize();
-//        Eigen::Quaterniond delta_q_2 = delta_q * Quaterniond(1, un_gyr(0) * _dt / 4, un_gyr(1) * _dt / 4, un_gyr(2) * _dt / 4);;
-//        delta_q_2.normalize();
-//        std::cout<<"delta_q_rp2\t"<<delta_q_rpy.coeffs().transpose()<<std::endl;
-//        result_delta_q = delta_q * delta_q_rpy;
         Vector3d un_acc_1 = result_delta_q * (_acc_1 - linearized_ba);
         Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);
         Vector3d un_vel_1 = result_delta_q * RIV[0]* (_vel_1);//轮速
         Vector3d un_vel = 0.5 * (un_vel_0 + un_vel_1);
-//        un_vel = delta_q_2 * RIV[0]* (_vel_0);
 
         result_delta_p = delta_p + delta_v * _dt + 0.5 * un_acc * _dt * _dt;
         result_delta_v = delta_v + un_acc * _dt;
@@ -400,81 +323,68 @@ class IntegrationBase
             Vector3d a_1_x = _acc_1 - linearized_ba;
             Vector3d e_0_x = RIV[0] * _vel_0;
             Vector3d e_1_x = RIV[0] * _vel_0;
-            Matrix3d R_w_x, R_a_0_x, R_a_1_x, R_e_0_x, R_e_1_x;
+            Matrix3d R_w_x = skew(w_x), R_a_0_x = skew(a_0_x), R_a_1_x = skew(a_1_x);
+            Matrix3d R_e_0_x = skew(e_0_x), R_e_1_x = skew(e_1_x);
+            Matrix3d R0 = delta_q.toRotationMatrix();
+            Matrix3d R1 = result_delta_q.toRotationMatrix();
+            Matrix3d I_w = Matrix3d::Identity() - R_w_x * _dt;
 
-            R_w_x<<0, -w_x(2), w_x(1),
-                    w_x(2), 0, -w_x(0),
-                    -w_x(1), w_x(0), 0;
-            R_a_0_x<<0, -a_0_x(2), a_0_x(1),
-                    a_0_x(2), 0, -a_0_x(0),
-                    -a_0_x(1), a_0_x(0), 0;
-            R_a_1_x<<0, -a_1_x(2), a_1_x(1),
-                    a_1_x(2), 0, -a_1_x(0),
-                    -a_1_x(1), a_1_x(0), 0;
-            R_e_0_x << 0, -e_0_x(2), e_0_x(1),
-                    e_0_x(2), 0, -e_0_x(0),
-                    -e_0_x(1), e_0_x(0), 0;
-            R_e_1_x << 0, -e_1_x(2), e_1_x(1),
-                    e_1_x(2), 0, -e_1_x(0),
-                    -e_1_x(1), e_1_x(0), 0;
-
-            MatrixXd F = MatrixXd::Zero(18, 18);
+            Eigen::Matrix<double, 18, 18> F = Eigen::Matrix<double, 18, 18>::Zero();
             F.block<3, 3>(0, 0) = Matrix3d::Identity();
-            F.block<3, 3>(0, 3) = -0.25 * delta_q.toRotationMatrix() * R_a_0_x * _dt * _dt +
-                                  -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt * _dt;
-            F.block<3, 3>(0, 6) = MatrixXd::Identity(3,3) * _dt;
-            F.block<3, 3>(0, 12) = -0.25 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt * _dt;
-            F.block<3, 3>(0, 15) = -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * _dt * -_dt;
-            F.block<3, 3>(3, 3) = Matrix3d::Identity() - R_w_x * _dt;
-            F.block<3, 3>(3, 15) = -1.0 * MatrixXd::Identity(3,3) * _dt;
-            F.block<3, 3>(6, 3) = -0.5 * delta_q.toRotationMatrix() * R_a_0_x * _dt +
-                                  -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt;
+            F.block<3, 3>(0, 3) = -0.25 * R0 * R_a_0_x * _dt * _dt +
+                                  -0.25 * R1 * R_a_1_x * I_w * _dt * _dt;
+            F.block<3, 3>(0, 6) = Matrix3d::Identity() * _dt;
+            F.block<3, 3>(0, 12) = -0.25 * (R0 + R1) * _dt * _dt;
+            F.block<3, 3>(0, 15) = -0.25 * R1 * R_a_1_x * _dt * _dt * -_dt;
+            F.block<3, 3>(3, 3) = I_w;
+            F.block<3, 3>(3, 15) = -1.0 * Matrix3d::Identity() * _dt;
+            F.block<3, 3>(6, 3) = -0.5 * R0 * R_a_0_x * _dt +
+                                  -0.5 * R1 * R_a_1_x * I_w * _dt;
             F.block<3, 3>(6, 6) = Matrix3d::Identity();
-            F.block<3, 3>(6, 12) = -0.5 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt;
-            F.block<3, 3>(6, 15) = -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * -_dt;
+            F.block<3, 3>(6, 12) = -0.5 * (R0 + R1) * _dt;
+            F.block<3, 3>(6, 15) = -0.5 * R1 * R_a_1_x * _dt * -_dt;
             //vel
-            F.block<3, 3>(9, 3) = -0.5 * delta_q.toRotationMatrix() * R_e_0_x * _dt +
-                                  -0.5 * result_delta_q.toRotationMatrix() * R_e_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt; //对角度
+            F.block<3, 3>(9, 3) = -0.5 * R0 * R_e_0_x * _dt +
+                                  -0.5 * R1 * R_e_1_x * I_w * _dt; //对角度
             F.block<3, 3>(9, 9) = Matrix3d::Identity();//对轮速计偏差
-            F.block<3, 3>(9, 15) = 0.5 * result_delta_q.toRotationMatrix() * R_e_1_x * _dt * _dt;//对角度bias
+            F.block<3, 3>(9, 15) = 0.5 * R1 * R_e_1_x * _dt * _dt;//对角度bias
 
 
             F.block<3, 3>(12, 12) = Matrix3d::Identity();//delta bias_a_k
             F.block<3, 3>(15, 15) = Matrix3d::Identity();//delta bias_b_k
 
-            MatrixXd V = MatrixXd::Zero(18, 24);
-            V.block<3, 3>(0, 0) =  0.25 * delta_q.toRotationMatrix() * _dt * _dt;
-            V.block<3, 3>(0, 3) =  0.25 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * _dt * 0.5 * _dt;
-            V.block<3, 3>(0, 9) =  0.25 * result_delta_q.toRotationMatrix() * _dt * _dt;
+            Eigen::Matrix<double, 18, 24> V = Eigen::Matrix<double, 18, 24>::Zero();
+            V.block<3, 3>(0, 0) =  0.25 * R0 * _dt * _dt;
+            V.block<3, 3>(0, 3) =  0.25 * -R1 * R_a_1_x  * _dt * _dt * 0.5 * _dt;
+            V.block<3, 3>(0, 9) =  0.25 * R1 * _dt * _dt;
             V.block<3, 3>(0, 12) =  V.block<3, 3>(0, 3);
 
-            V.block<3, 3>(3, 3) =  0.5 * MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(3, 12) =  0.5 * MatrixXd::Identity(3,3) * _dt;
+            V.block<3, 3>(3, 3) =  0.5 * Matrix3d::Identity() * _dt;
+            V.block<3, 3>(3, 12) =  0.5 * Matrix3d::Identity() * _dt;
 
-            V.block<3, 3>(6, 0) =  0.5 * delta_q.toRotationMatrix() * _dt;
-            V.block<3, 3>(6, 3) =  0.5 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * 0.5 * _dt;
-            V.block<3, 3>(6, 9) =  0.5 * result_delta_q.toRotationMatrix() * _dt;
+            V.block<3, 3>(6, 0) =  0.5 * R0 * _dt;
+            V.block<3, 3>(6, 3) =  0.5 * -R1 * R_a_1_x  * _dt * 0.5 * _dt;
+            V.block<3, 3>(6, 9) =  0.5 * R1 * _dt;
             V.block<3, 3>(6, 12) =  V.block<3, 3>(6, 3);
 
-            V.block<3, 3>(9, 3) = -0.25 * result_delta_q.toRotationMatrix() * R_e_1_x * _dt * _dt; // 轮速-n_w_k
-            V.block<3, 3>(9, 6) = 0.5 * delta_q.toRotationMatrix() * RIV[0] * _dt;//vel - n_a
+            V.block<3, 3>(9, 3) = -0.25 * R1 * R_e_1_x * _dt * _dt; // 轮速-n_w_k
+            V.block<3, 3>(9, 6) = 0.5 * R0 * RIV[0] * _dt;//vel - n_a
             V.block<3, 3>(9, 12) = V.block<3, 3>(9, 3);//轮速-n_w_k+1
-            V.block<3, 3>(9, 15) = 0.5 * result_delta_q.toRotationMatrix() * RIV[0] * _dt;//vel_
+            V.block<3, 3>(9, 15) = 0.5 * R1 * RIV[0] * _dt;//vel_
 
-            V.block<3, 3>(12, 18) = MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(15, 21) = MatrixXd::Identity(3,3) * _dt;
+            V.block<3, 3>(12, 18) = Matrix3d::Identity() * _dt;
+            V.block<3, 3>(15, 21) = Matrix3d::Identity() * _dt;
 
             // step_jacobian_enc = F;
             // step_V_enc = V;
 //            if(vel_0.norm() == 0 && vel_1.norm() == 0 ) //TODO 轮速为0时降低噪声
 //                noise_enc.block<3, 3>(21, 21) = (GYR_W * GYR_W) * Eigen::Matrix3d::Identity();
             jacobian_enc = F * jacobian_enc;
-            covariance_enc = F * covariance_enc * F.transpose() + V * noise_enc * V.transpose();
+            propagateCovariance(F, V, noise_enc, covariance_enc);
         }
 
     }
 
-
     void propagate(double _dt, const Eigen::Vector3d &_acc_1, const Eigen::Vector3d &_gyr_1)
     {
         dt = _dt;
@@ -544,7 +454,7 @@ class IntegrationBase
         linearized_ba = result_linearized_ba;
         linearized_bg = result_linearized_bg;
         delta_q.normalize();
-        delta_angleaxis.fromRotationMatrix(delta_q.toRotationMatrix());//轴角
+        delta_angleaxis = delta_q;//轴角
         sum_dt += dt;
         acc_0 = acc_1;
         gyr_0 = gyr_1;
@@ -702,12 +612,13 @@ class IntegrationBase
     Eigen::Vector3d acc_1, gyr_1;
     Eigen::Vector3d vel_0, vel_1;
 
-    const Eigen::Vector3d linearized_acc, linearized_gyr;
+    Eigen::Vector3d linearized_acc, linearized_gyr, linearized_vel;
     Eigen::Vector3d linearized_ba, linearized_bg;
 
+    //IMU_FACTOR为0时用jacobian/covariance，为1时用jacobian左上角15维和covariance_origin，为2时用jacobian_enc/covariance_enc
     Eigen::Matrix<double, 18, 18> jacobian, covariance;
     Eigen::Matrix<double, 18, 18> jacobian_enc, covariance_enc;
-    Eigen::Matrix<double, 15, 15> jacobian_origin, covariance_origin;
+    Eigen::Matrix<double, 15, 15> covariance_origin;
     Eigen::Matrix<double, 15, 15> step_jacobian;
     Eigen::Matrix<double, 15, 18> step_V;
     Eigen::Matrix<double, 21, 21> noise;
@@ -721,11 +632,77 @@ class IntegrationBase
     Eigen::Vector3d delta_v;
     Eigen::AngleAxis<double> delta_angleaxis;
 
-    std::vector<double> dt_buf;
-    std::vector<Eigen::Vector3d> acc_buf;
-    std::vector<Eigen::Vector3d> gyr_buf;
-    std::vector<Eigen::Vector3d> vel_buf;
+    //repropagate用的原始采样，没有轮速时vel为0
+    struct Sample
+    {
+        double dt;
+        Eigen::Vector3d acc, gyr, vel;
+    };
+    std::vector<Sample> samples;
+    bool with_wheel;
+
+  private:
+    void init(const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0, const Eigen::Vector3d &_vel_0,
+              const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
+    {
+        acc_0 = linearized_acc = _acc_0;
+        gyr_0 = linearized_gyr = _gyr_0;
+        vel_0 = linearized_vel = _vel_0;
+        linearized_ba = _linearized_ba;
+        linearized_bg = _linearized_bg;
+        jacobian.setIdentity();
+        covariance.setZero();
+        jacobian_enc.setIdentity();
+        covariance_enc.setZero();
+        covariance_origin.setZero();
+        sum_dt = 0.0;
+        delta_p.setZero();
+        delta_q.setIdentity();
+        delta_v.setZero();
+        delta_p_i_vel.setZero();
+        delta_angleaxis = Eigen::AngleAxis<double>(0, Eigen::Vector3d(0, 0, 1));
+        samples.clear();
+        with_wheel = false;
+
+        noise = Eigen::Matrix<double, 21, 21>::Zero();
+        noise.block<3, 3>(0, 0) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(3, 3) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(6, 6) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(9, 9) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(12, 12) =  (ACC_W * ACC_W) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(15, 15) =  (GYR_W * GYR_W) * Eigen::Matrix3d::Identity();
+
+        noise_origin =  Eigen::Matrix<double, 18, 18>::Zero();
+        noise_origin.block<3, 3>(0, 0) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
+        noise_origin.block<3, 3>(3, 3) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
+        noise_origin.block<3, 3>(6, 6) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
+        noise_origin.block<3, 3>(9, 9) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
+        noise_origin.block<3, 3>(12, 12) =  (ACC_W * ACC_W) * Eigen::Matrix3d::Identity();
+        noise_origin.block<3, 3>(15, 15) =  (GYR_W * GYR_W) * Eigen::Matrix3d::Identity();
+    }
 
+    void addSample(double dt, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr, const Eigen::Vector3d &vel)
+    {
+        Sample s;
+        s.dt = dt;
+        s.acc = acc;
+        s.gyr = gyr;
+        s.vel = vel;
+        samples.push_back(s);
+        if ((int)samples.size() > sampleCapacity())
+            sampleCapacity() = (int)(2 * samples.size());
+    }
+
+    // 按目前见过的最长区间给新的预积分预留采样空间，1kHz的IMU也只在开始的几帧扩容。
+    // 留两倍是因为边缘化次新帧时两段区间会合并
+    static std::atomic<int> &sampleCapacity()
+    {
+        static std::atomic<int> capacity(64);
+        return capacity;
+    }
+
+  public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 };
 /*
 
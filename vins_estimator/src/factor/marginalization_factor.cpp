@@ -116,12 +116,19 @@ void MarginalizationInfo::addResidualBlockInfo(ResidualBlockInfo *residual_block
     }
 }
 
+ThreadPool &MarginalizationInfo::threadPool()
+{
+    static ThreadPool pool(MARGIN_THREADS);
+    return pool;
+}
+
 void MarginalizationInfo::preMarginalize()
 {
+    //各残差块互不相关，并行计算残差和雅可比
+    threadPool().parallelFor(factors.size(), [&](int i) { factors[i]->Evaluate(); });
+
     for (auto it : factors)
     {
-        it->Evaluate();
-
         std::vector<int> block_sizes = it->cost_function->parameter_block_sizes();
         for (int i = 0; i < static_cast<int>(block_sizes.size()); i++)
         {
@@ -147,47 +154,50 @@ int MarginalizationInfo::globalSize(int size) const
     return size == 6 ? 7 : size;
 }
 
-void* ThreadsConstructA(void* threadsstruct)
+static MarginalizationScratch scratch;
+
+void MarginalizationInfo::marginalize()
 {
-    ThreadsStruct* p = ((ThreadsStruct*)threadsstruct);
-    for (auto it : p->sub_factors)
+    std::vector<int> &block_idx = scratch.block_idx;
+    std::vector<int> &block_size = scratch.block_size;
+    block_idx.clear();
+    block_size.clear();
+    std::unordered_map<long, int> block_id;//参数块地址 -> 编号
+    block_id.reserve(parameter_block_size.size());
+
+    //要边缘化的逆深度(1维参数块)，每个残差块最多连一个时，H中路标点部分是对角阵，可以先逐个消元
+    std::unordered_map<long, int> landmark;
+    for (const auto &it : parameter_block_idx)
+        if (parameter_block_size[it.first] == SIZE_FEATURE)
+            landmark[it.first] = 0;
+    for (auto it : factors)
     {
-        for (int i = 0; i < static_cast<int>(it->parameter_blocks.size()); i++)
+        int cnt = 0;
+        for (auto addr : it->parameter_blocks)
+            cnt += landmark.count(reinterpret_cast<long>(addr));
+        if (cnt > 1)
         {
-            int idx_i = p->parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[i])];
-            int size_i = p->parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[i])];
-            if (size_i == 7)
-                size_i = 6;
-            Eigen::MatrixXd jacobian_i = it->jacobians[i].leftCols(size_i);
-            for (int j = i; j < static_cast<int>(it->parameter_blocks.size()); j++)
-            {
-                int idx_j = p->parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[j])];
-                int size_j = p->parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[j])];
-                if (size_j == 7)
-                    size_j = 6;
-                Eigen::MatrixXd jacobian_j = it->jacobians[j].leftCols(size_j);
-                if (i == j)
-                    p->A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                else
-                {
-                    p->A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                    p->A.block(idx_j, idx_i, size_j, size_i) = p->A.block(idx_i, idx_j, size_i, size_j).transpose();
-                }
-            }
-            p->b.segment(idx_i, size_i) += jacobian_i.transpose() * it->residuals;
+            landmark.clear();
+            break;
         }
     }
-    return threadsstruct;
-}
 
-void MarginalizationInfo::marginalize()
-{
+    //路标点排在最前面，然后是其余要边缘化的参数块，最后是保留的参数块
     int pos = 0;
-    for (auto &it : parameter_block_idx)
+    for (int pass = 0; pass < 2; pass++)
     {
-        it.second = pos;
-        pos += localSize(parameter_block_size[it.first]);
+        for (auto &it : parameter_block_idx)
+        {
+            if ((landmark.count(it.first) > 0) != (pass == 0))
+                continue;
+            it.second = pos;
+            block_id[it.first] = block_idx.size();
+            block_idx.push_back(pos);
+            block_size.push_back(localSize(parameter_block_size[it.first]));
+            pos += block_size.back();
+        }
     }
+    int nl = landmark.size();
 
     m = pos;
 
@@ -196,7 +206,10 @@ void MarginalizationInfo::marginalize()
         if (parameter_block_idx.find(it.first) == parameter_block_idx.end())
         {
             parameter_block_idx[it.first] = pos;
-            pos += localSize(it.second);
+            block_id[it.first] = block_idx.size();
+            block_idx.push_back(pos);
+            block_size.push_back(localSize(it.second));
+            pos += block_size.back();
         }
     }
 
@@ -210,91 +223,109 @@ void MarginalizationInfo::marginalize()
     }
 
     TicToc t_summing;
-    Eigen::MatrixXd A(pos, pos);
-    Eigen::VectorXd b(pos);
-    A.setZero();
-    b.setZero();
-    /*
+    //H按参数块分块: 每个残差块只贡献它所连接的参数块之间的JiT*Jj。
+    //按行(参数块)分配任务，每个任务只写自己那一行的上三角部分，线程之间不需要各自的A再求和
+    int num_blocks = block_idx.size();
+    std::vector<int> &factor_block_offset = scratch.factor_block_offset;
+    std::vector<int> &factor_block = scratch.factor_block;
+    std::vector<int> &row_offset = scratch.row_offset;
+    std::vector<std::pair<int, int>> &row_factor = scratch.row_factor;
+    factor_block_offset.clear();
+    factor_block.clear();
+    row_offset.assign(num_blocks + 1, 0);
     for (auto it : factors)
     {
-        for (int i = 0; i < static_cast<int>(it->parameter_blocks.size()); i++)
+        factor_block_offset.push_back(factor_block.size());
+        for (auto addr : it->parameter_blocks)
         {
-            int idx_i = parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[i])];
-            int size_i = localSize(parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[i])]);
-            Eigen::MatrixXd jacobian_i = it->jacobians[i].leftCols(size_i);
-            for (int j = i; j < static_cast<int>(it->parameter_blocks.size()); j++)
-            {
-                int idx_j = parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[j])];
-                int size_j = localSize(parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[j])]);
-                Eigen::MatrixXd jacobian_j = it->jacobians[j].leftCols(size_j);
-                if (i == j)
-                    A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                else
-                {
-                    A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                    A.block(idx_j, idx_i, size_j, size_i) = A.block(idx_i, idx_j, size_i, size_j).transpose();
-                }
-            }
-            b.segment(idx_i, size_i) += jacobian_i.transpose() * it->residuals;
+            int id = block_id[reinterpret_cast<long>(addr)];
+            factor_block.push_back(id);
+            row_offset[id + 1]++;
         }
     }
-    ROS_INFO("summing up costs %f ms", t_summing.toc());
-    */
-    //multi thread
-
+    factor_block_offset.push_back(factor_block.size());
+    for (int i = 0; i < num_blocks; i++)
+        row_offset[i + 1] += row_offset[i];
+    row_factor.resize(factor_block.size());
+    {
+        std::vector<int> fill(row_offset.begin(), row_offset.end() - 1);
+        for (int f = 0; f < (int)factors.size(); f++)
+            for (int k = factor_block_offset[f]; k < factor_block_offset[f + 1]; k++)
+                row_factor[fill[factor_block[k]]++] = std::make_pair(f, k - factor_block_offset[f]);
+    }
 
-    TicToc t_thread_summing;
-    pthread_t tids[NUM_THREADS];
-    ThreadsStruct threadsstruct[NUM_THREADS];
-    int i = 0;
-    for (auto it : factors)
+    if (scratch.A.rows() < pos)
     {
-        threadsstruct[i].sub_factors.push_back(it);
-        i++;
-        i = i % NUM_THREADS;
+        scratch.A.resize(pos, pos);
+        scratch.b.resize(pos);
     }
-    for (int i = 0; i < NUM_THREADS; i++)
+    auto A = scratch.A.topLeftCorner(pos, pos);
+    auto b = scratch.b.head(pos);
+    A.setZero();
+    b.setZero();
+
+    threadPool().parallelFor(num_blocks, [&](int bi)
     {
-        TicToc zero_matrix;
-        threadsstruct[i].A = Eigen::MatrixXd::Zero(pos,pos);
-        threadsstruct[i].b = Eigen::VectorXd::Zero(pos);
-        threadsstruct[i].parameter_block_size = parameter_block_size;
-        threadsstruct[i].parameter_block_idx = parameter_block_idx;
-        int ret = pthread_create( &tids[i], NULL, ThreadsConstructA ,(void*)&(threadsstruct[i]));
-        if (ret != 0)
+        int idx_i = block_idx[bi];
+        int size_i = block_size[bi];
+        for (int r = row_offset[bi]; r < row_offset[bi + 1]; r++)
         {
-            ROS_WARN("pthread_create error");
-            ROS_BREAK();
+            ResidualBlockInfo *it = factors[row_factor[r].first];
+            int k = row_factor[r].second;
+            const int *blocks = &factor_block[factor_block_offset[row_factor[r].first]];
+            auto jacobian_i = it->jacobians[k].leftCols(size_i);
+            for (int l = 0; l < static_cast<int>(it->parameter_blocks.size()); l++)
+            {
+                int idx_j = block_idx[blocks[l]];
+                if (idx_j < idx_i)
+                    continue;
+                int size_j = block_size[blocks[l]];
+                A.block(idx_i, idx_j, size_i, size_j).noalias() += jacobian_i.transpose() * it->jacobians[l].leftCols(size_j);
+            }
+            b.segment(idx_i, size_i).noalias() += jacobian_i.transpose() * it->residuals;
         }
-    }
-    for( int i = NUM_THREADS - 1; i >= 0; i--)  
+    });
+    //ROS_DEBUG("block summing up costs %f ms", t_summing.toc());
+
+
+    //先消去路标点: Hll是对角阵，Hxx -= Hxl * Hll^-1 * Hlx, bx -= Hxl * Hll^-1 * bl
+    //令U = Hxl * Hll^-1/2，只更新上三角
+    if (nl > 0)
     {
-        pthread_join( tids[i], NULL ); 
-        A += threadsstruct[i].A;
-        b += threadsstruct[i].b;
+        int nx = pos - nl;
+        Eigen::VectorXd Hll_inv_sqrt = (A.diagonal().head(nl).array() > eps).select(A.diagonal().head(nl).array().rsqrt(), 0);
+        if (scratch.U.rows() < nx || scratch.U.cols() < nl)
+            scratch.U.resize(std::max<int>(nx, scratch.U.rows()), std::max<int>(nl, scratch.U.cols()));
+        auto U = scratch.U.topLeftCorner(nx, nl);
+        U.noalias() = A.block(0, nl, nl, nx).transpose() * Hll_inv_sqrt.asDiagonal();
+        A.block(nl, nl, nx, nx).selfadjointView<Eigen::Upper>().rankUpdate(U, -1.0);
+        b.segment(nl, nx).noalias() -= U * Hll_inv_sqrt.cwiseProduct(b.head(nl));
     }
-    //ROS_DEBUG("thread summing up costs %f ms", t_thread_summing.toc());
-    //ROS_INFO("A diff %f , b diff %f ", (A - tmp_A).sum(), (b - tmp_b).sum());
-
 
-    //TODO
-    Eigen::MatrixXd Amm = 0.5 * (A.block(0, 0, m, m) + A.block(0, 0, m, m).transpose());
-    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes(Amm);
+    //剩下的位姿、速度偏置等参数块用稠密方法边缘化
+    int mm = m - nl;
+    Eigen::MatrixXd Arr = A.block(m, m, n, n).selfadjointView<Eigen::Upper>();
+    Eigen::VectorXd brr = b.segment(m, n);
+    if (mm > 0)
+    {
+        //TODO
+        //A只填了上三角
+        Eigen::MatrixXd Amm = A.block(nl, nl, mm, mm).selfadjointView<Eigen::Upper>();
+        Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes(Amm);
 
-    //ROS_ASSERT_MSG(saes.eigenvalues().minCoeff() >= -1e-4, "min eigenvalue %f", saes.eigenvalues().minCoeff());
+        //ROS_ASSERT_MSG(saes.eigenvalues().minCoeff() >= -1e-4, "min eigenvalue %f", saes.eigenvalues().minCoeff());
 
-    Eigen::MatrixXd Amm_inv = saes.eigenvectors() * Eigen::VectorXd((saes.eigenvalues().array() > eps).select(saes.eigenvalues().array().inverse(), 0)).asDiagonal() * saes.eigenvectors().transpose();
-    //printf("error1: %f\n", (Amm * Amm_inv - Eigen::MatrixXd::Identity(m, m)).sum());
+        Eigen::MatrixXd Amm_inv = saes.eigenvectors() * Eigen::VectorXd((saes.eigenvalues().array() > eps).select(saes.eigenvalues().array().inverse(), 0)).asDiagonal() * saes.eigenvectors().transpose();
+        //printf("error1: %f\n", (Amm * Amm_inv - Eigen::MatrixXd::Identity(m, m)).sum());
 
-    Eigen::VectorXd bmm = b.segment(0, m);
-    Eigen::MatrixXd Amr = A.block(0, m, m, n);
-    Eigen::MatrixXd Arm = A.block(m, 0, n, m);
-    Eigen::MatrixXd Arr = A.block(m, m, n, n);
-    Eigen::VectorXd brr = b.segment(m, n);
-    A = Arr - Arm * Amm_inv * Amr;
-    b = brr - Arm * Amm_inv * bmm;
+        Eigen::VectorXd bmm = b.segment(nl, mm);
+        Eigen::MatrixXd Amr = A.block(nl, m, mm, n);
+        Eigen::MatrixXd Arm_Amm_inv = Amr.transpose() * Amm_inv;
+        Arr.noalias() -= Arm_Amm_inv * Amr;
+        brr.noalias() -= Arm_Amm_inv * bmm;
+    }
 
-    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes2(A);
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes2(Arr);
     Eigen::VectorXd S = Eigen::VectorXd((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array(), 0));
     Eigen::VectorXd S_inv = Eigen::VectorXd((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array().inverse(), 0));
 
@@ -302,7 +333,7 @@ void MarginalizationInfo::marginalize()
     Eigen::VectorXd S_inv_sqrt = S_inv.cwiseSqrt();
 
     linearized_jacobians = S_sqrt.asDiagonal() * saes2.eigenvectors().transpose();
-    linearized_residuals = S_inv_sqrt.asDiagonal() * saes2.eigenvectors().transpose() * b;
+    linearized_residuals = S_inv_sqrt.asDiagonal() * saes2.eigenvectors().transpose() * brr;
     //std::cout << A << std::endl
     //          << std::endl;
     //std::cout << linearized_jacobians << std::endl;
@@ -12,14 +12,13 @@
 #include <ros/ros.h>
 #include <ros/console.h>
 #include <cstdlib>
-#include <pthread.h>
 #include <ceres/ceres.h>
 #include <unordered_map>
 
 #include "../utility/utility.h"
 #include "../utility/tic_toc.h"
-
-const int NUM_THREADS = 4;
+#include "vins_common/thread_pool.h"
+#include "../estimator/parameters.h"
 
 struct ResidualBlockInfo
 {
@@ -43,13 +42,18 @@ struct ResidualBlockInfo
     }
 };
 
-struct ThreadsStruct
+// 边缘化每帧都要重新构造MarginalizationInfo，H/b和索引等临时数据放在这里跨帧复用
+struct MarginalizationScratch
 {
-    std::vector<ResidualBlockInfo *> sub_factors;
-    Eigen::MatrixXd A;
+    Eigen::MatrixXd A;//容量只增不减，每次只用左上角pos x pos
     Eigen::VectorXd b;
-    std::unordered_map<long, int> parameter_block_size; //global size
-    std::unordered_map<long, int> parameter_block_idx; //local size
+    Eigen::MatrixXd U;//路标点消元用
+    std::vector<int> block_idx;  //每个参数块在A中的位置(local size)
+    std::vector<int> block_size; //local size
+    std::vector<int> factor_block_offset;//第i个残差块的参数块编号存放在factor_block[factor_block_offset[i]...]
+    std::vector<int> factor_block;
+    std::vector<int> row_offset;//按参数块(行)索引的残差块列表，CSR格式
+    std::vector<std::pair<int, int>> row_factor;//(残差块序号, 参数块在残差块中的序号)
 };
 
 class MarginalizationInfo
@@ -63,6 +67,7 @@ class MarginalizationInfo
     void preMarginalize();
     void marginalize();
     std::vector<double *> getParameterBlocks(std::unordered_map<long, double *> &addr_shift);
+    static ThreadPool &threadPool();
 
     std::vector<ResidualBlockInfo *> factors;
     int m, n;
@@ -41,7 +41,7 @@ ProjectionOneFrameTwoCamFactor::ProjectionOneFrameTwoCamFactor(const Eigen::Vect
 
 bool ProjectionOneFrameTwoCamFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
 {
-    TicToc tic_toc;
+    //TicToc tic_toc;
 
     Eigen::Vector3d tic(parameters[0][0], parameters[0][1], parameters[0][2]);
     Eigen::Quaterniond qic(parameters[0][6], parameters[0][3], parameters[0][4], parameters[0][5]);
@@ -128,7 +128,7 @@ bool ProjectionOneFrameTwoCamFactor::Evaluate(double const *const *parameters, d
                           sqrt_info * velocity_j.head(2);
         }
     }
-    sum_t += tic_toc.toc();
+    //sum_t += tic_toc.toc();//Evaluate会被多个线程同时调用，不能累加静态变量
 
     return true;
 }
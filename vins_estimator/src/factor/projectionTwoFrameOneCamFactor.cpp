@@ -18,7 +18,8 @@ ProjectionTwoFrameOneCamFactor::ProjectionTwoFrameOneCamFactor(const Eigen::Vect
                                        const Eigen::Vector2d &_velocity_i, const Eigen::Vector2d &_velocity_j,
                                        const double _td_i, const double _td_j) : 
                                        pts_i(_pts_i), pts_j(_pts_j), 
-                                       td_i(_td_i), td_j(_td_j)
+                                       td_i(_td_i), td_j(_td_j),
+                                       frame_cache(nullptr), frame_i(0), frame_j(0)
 {
     velocity_i.x() = _velocity_i.x();
     velocity_i.y() = _velocity_i.y();
@@ -42,7 +43,9 @@ ProjectionTwoFrameOneCamFactor::ProjectionTwoFrameOneCamFactor(const Eigen::Vect
 
 bool ProjectionTwoFrameOneCamFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
 {
-    TicToc tic_toc;
+    if (frame_cache && frame_cache->valid())
+        return evaluateCached(parameters, residuals, jacobians);
+    //TicToc tic_toc;
     Eigen::Vector3d Pi(parameters[0][0], parameters[0][1], parameters[0][2]);
     Eigen::Quaterniond Qi(parameters[0][6], parameters[0][3], parameters[0][4], parameters[0][5]);
 
@@ -150,11 +153,115 @@ bool ProjectionTwoFrameOneCamFactor::Evaluate(double const *const *parameters, d
                           sqrt_info * velocity_j.head(2);
         }
     }
-    sum_t += tic_toc.toc();
+    //sum_t += tic_toc.toc();//Evaluate会被多个线程同时调用，不能累加静态变量
 
     return true;
 }
 
+// 与Evaluate相同，帧对相关的部分用ProjectionFrameCache里算好的，parameters[0..2]不再读
+bool ProjectionTwoFrameOneCamFactor::evaluateCached(double const *const *parameters, double *residuals, double **jacobians) const
+{
+    const ProjectionFrameCache::FramePair &pair = frame_cache->pair(frame_i, frame_j);
+    const Eigen::Matrix3d &ric = frame_cache->ric;
+    const Eigen::Matrix3d &ricT = frame_cache->ricT;
+
+    double inv_dep_i = parameters[3][0];
+    double td = parameters[4][0];
+
+    Eigen::Vector3d pts_i_td, pts_j_td;
+    pts_i_td = pts_i - (td - td_i) * velocity_i;
+    pts_j_td = pts_j - (td - td_j) * velocity_j;
+    Eigen::Vector3d pts_camera_i = pts_i_td / inv_dep_i;
+    Eigen::Vector3d rot_pts_camera_i = pair.R_cj_ci * pts_camera_i;
+    Eigen::Vector3d pts_camera_j = rot_pts_camera_i + pair.t_cj_ci;
+    Eigen::Map<Eigen::Vector2d> residual(residuals);
+
+#ifdef UNIT_SPHERE_ERROR
+    residual =  tangent_base * (pts_camera_j.normalized() - pts_j_td.normalized());
+#else
+    double dep_j = pts_camera_j.z();
+    residual = (pts_camera_j / dep_j).head<2>() - pts_j_td.head<2>();
+#endif
+
+    residual = sqrt_info * residual;
+
+    if (jacobians)
+    {
+        Eigen::Matrix<double, 2, 3> reduce(2, 3);
+#ifdef UNIT_SPHERE_ERROR
+        double norm = pts_camera_j.norm();
+        Eigen::Matrix3d norm_jaco;
+        double x1, x2, x3;
+        x1 = pts_camera_j(0);
+        x2 = pts_camera_j(1);
+        x3 = pts_camera_j(2);
+        norm_jaco << 1.0 / norm - x1 * x1 / pow(norm, 3), - x1 * x2 / pow(norm, 3),            - x1 * x3 / pow(norm, 3),
+                     - x1 * x2 / pow(norm, 3),            1.0 / norm - x2 * x2 / pow(norm, 3), - x2 * x3 / pow(norm, 3),
+                     - x1 * x3 / pow(norm, 3),            - x2 * x3 / pow(norm, 3),            1.0 / norm - x3 * x3 / pow(norm, 3);
+        reduce = tangent_base * norm_jaco;
+#else
+        reduce << 1. / dep_j, 0, -pts_camera_j(0) / (dep_j * dep_j),
+            0, 1. / dep_j, -pts_camera_j(1) / (dep_j * dep_j);
+#endif
+        reduce = sqrt_info * reduce;
+
+        if (jacobians[0] || jacobians[1])
+        {
+            Eigen::Vector3d pts_imu_i = ric * pts_camera_i + frame_cache->tic;
+            if (jacobians[0])
+            {
+                Eigen::Map<Eigen::Matrix<double, 2, 7, Eigen::RowMajor>> jacobian_pose_i(jacobians[0]);
+
+                Eigen::Matrix<double, 3, 6> jaco_i;
+                jaco_i.leftCols<3>() = frame_cache->ricT_RjT[frame_j];
+                jaco_i.rightCols<3>().noalias() = pair.ricT_Rji * -Utility::skewSymmetric(pts_imu_i);
+
+                jacobian_pose_i.leftCols<6>().noalias() = reduce * jaco_i;
+                jacobian_pose_i.rightCols<1>().setZero();
+            }
+
+            if (jacobians[1])
+            {
+                Eigen::Map<Eigen::Matrix<double, 2, 7, Eigen::RowMajor>> jacobian_pose_j(jacobians[1]);
+                Eigen::Vector3d pts_imu_j = pair.R_bj_bi * pts_imu_i + pair.t_bj_bi;
+
+                Eigen::Matrix<double, 3, 6> jaco_j;
+                jaco_j.leftCols<3>() = -frame_cache->ricT_RjT[frame_j];
+                jaco_j.rightCols<3>().noalias() = ricT * Utility::skewSymmetric(pts_imu_j);
+
+                jacobian_pose_j.leftCols<6>().noalias() = reduce * jaco_j;
+                jacobian_pose_j.rightCols<1>().setZero();
+            }
+        }
+        if (jacobians[2])
+        {
+            Eigen::Map<Eigen::Matrix<double, 2, 7, Eigen::RowMajor>> jacobian_ex_pose(jacobians[2]);
+            Eigen::Matrix<double, 3, 6> jaco_ex;
+            jaco_ex.leftCols<3>() = pair.ricT_Rji - ricT;
+            jaco_ex.rightCols<3>() = -pair.R_cj_ci * Utility::skewSymmetric(pts_camera_i) + Utility::skewSymmetric(rot_pts_camera_i) +
+                                     Utility::skewSymmetric(pair.t_cj_ci);
+            jacobian_ex_pose.leftCols<6>().noalias() = reduce * jaco_ex;
+            jacobian_ex_pose.rightCols<1>().setZero();
+        }
+        if (jacobians[3] || jacobians[4])
+        {
+            Eigen::Matrix<double, 2, 3> reduce_R = reduce * pair.R_cj_ci;
+            if (jacobians[3])
+            {
+                Eigen::Map<Eigen::Vector2d> jacobian_feature(jacobians[3]);
+                jacobian_feature = reduce_R * pts_i_td * -1.0 / (inv_dep_i * inv_dep_i);
+            }
+            if (jacobians[4])
+            {
+                Eigen::Map<Eigen::Vector2d> jacobian_td(jacobians[4]);
+                jacobian_td = reduce_R * velocity_i / inv_dep_i * -1.0  +
+                              sqrt_info * velocity_j.head(2);
+            }
+        }
+    }
+    return true;
+}
+
 void ProjectionTwoFrameOneCamFactor::check(double **parameters)
 {
     double *res = new double[2];
@@ -17,6 +17,7 @@
 #include "../utility/utility.h"
 #include "../utility/tic_toc.h"
 #include "../estimator/parameters.h"
+#include "projection_frame_cache.h"
 
 class ProjectionTwoFrameOneCamFactor : public ceres::SizedCostFunction<2, 7, 7, 7, 1, 1>
 {
@@ -26,6 +27,13 @@ class ProjectionTwoFrameOneCamFactor : public ceres::SizedCostFunction<2, 7, 7,
     				   const double _td_i, const double _td_j);
     virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
     void check(double **parameters);
+    // 滑窗优化时设置，pose_i/pose_j/外参相关的矩阵从cache取，不再每个观测各算一遍
+    void setFrameCache(const ProjectionFrameCache *_frame_cache, int _frame_i, int _frame_j)
+    {
+        frame_cache = _frame_cache;
+        frame_i = _frame_i;
+        frame_j = _frame_j;
+    }
 
     Eigen::Vector3d pts_i, pts_j;
     Eigen::Vector3d velocity_i, velocity_j;
@@ -33,4 +41,10 @@ class ProjectionTwoFrameOneCamFactor : public ceres::SizedCostFunction<2, 7, 7,
     Eigen::Matrix<double, 2, 3> tangent_base;
     static Eigen::Matrix2d sqrt_info;
     static double sum_t;
+
+  private:
+    bool evaluateCached(double const *const *parameters, double *residuals, double **jacobians) const;
+
+    const ProjectionFrameCache *frame_cache;
+    int frame_i, frame_j;
 };
@@ -29,7 +29,7 @@ ProjectionFactor::ProjectionFactor(const Eigen::Vector3d &_pts_i, const Eigen::V
 
 bool ProjectionFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
 {
-    TicToc tic_toc;
+    //TicToc tic_toc;
     Eigen::Vector3d Pi(parameters[0][0], parameters[0][1], parameters[0][2]);
     Eigen::Quaterniond Qi(parameters[0][6], parameters[0][3], parameters[0][4], parameters[0][5]);
 
@@ -124,7 +124,7 @@ bool ProjectionFactor::Evaluate(double const *const *parameters, double *residua
 #endif
         }
     }
-    sum_t += tic_toc.toc();
+    //sum_t += tic_toc.toc();//Evaluate会被多个线程同时调用，不能累加静态变量
 
     return true;
 }
@@ -0,0 +1,105 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <ceres/ceres.h>
+#include <Eigen/Dense>
+#include "../estimator/parameters.h"
+
+// ceres 1.14起有EvaluationCallback(1.14在Solver::Options里，2.0起在Problem::Options里)
+#if defined(CERES_VERSION_MAJOR) && (CERES_VERSION_MAJOR > 1 || (CERES_VERSION_MAJOR == 1 && CERES_VERSION_MINOR >= 14))
+#define VINS_USE_EVALUATION_CALLBACK 1
+#endif
+
+// 滑窗内同一对帧(i, j)上的所有投影残差共用的旋转和平移。
+// ceres每次在新的点上计算残差前调用PrepareForEvaluation(此时参数已写回para_Pose/para_Ex_Pose)，
+// 这里按帧对算一次，投影因子的Evaluate里只剩每个观测自己的向量运算。
+// 只在Solve期间有效，Solve前后调用reset；边缘化等其他地方调用的投影因子不用它。
+class ProjectionFrameCache
+#ifdef VINS_USE_EVALUATION_CALLBACK
+    : public ceres::EvaluationCallback
+#endif
+{
+  public:
+    struct FramePair
+    {
+        Eigen::Matrix3d R_cj_ci; //ric^T * Rj^T * Ri * ric
+        Eigen::Vector3d t_cj_ci; //ric^T * (Rj^T * (Ri * tic + Pi - Pj) - tic)
+        Eigen::Matrix3d R_bj_bi; //Rj^T * Ri
+        Eigen::Vector3d t_bj_bi; //Rj^T * (Pi - Pj)
+        Eigen::Matrix3d ricT_Rji;//ric^T * Rj^T * Ri
+    };
+
+    ProjectionFrameCache(double (*_para_pose)[SIZE_POSE], double *_para_ex_pose)
+        : para_pose(_para_pose), para_ex_pose(_para_ex_pose), ready(false) {}
+
+    virtual ~ProjectionFrameCache() {}
+
+    void reset()
+    {
+        ready = false;
+    }
+
+    bool valid() const
+    {
+        return ready;
+    }
+
+    virtual void PrepareForEvaluation(bool evaluate_jacobians, bool new_evaluation_point)
+    {
+        if (new_evaluation_point || !ready)
+            update();
+    }
+
+    void update()
+    {
+        tic = Eigen::Vector3d(para_ex_pose[0], para_ex_pose[1], para_ex_pose[2]);
+        ric = Eigen::Quaterniond(para_ex_pose[6], para_ex_pose[3], para_ex_pose[4], para_ex_pose[5]).toRotationMatrix();
+        ricT = ric.transpose();
+        for (int k = 0; k < WINDOW_SIZE + 1; k++)
+        {
+            P[k] = Eigen::Vector3d(para_pose[k][0], para_pose[k][1], para_pose[k][2]);
+            R[k] = Eigen::Quaterniond(para_pose[k][6], para_pose[k][3], para_pose[k][4], para_pose[k][5]).toRotationMatrix();
+            ricT_RjT[k].noalias() = ricT * R[k].transpose();
+        }
+        for (int i = 0; i < WINDOW_SIZE + 1; i++)
+        {
+            Eigen::Vector3d Pi_tic = R[i] * tic + P[i];
+            for (int j = i + 1; j < WINDOW_SIZE + 1; j++)
+            {
+                FramePair &p = pairs[i][j];
+                p.R_bj_bi.noalias() = R[j].transpose() * R[i];
+                p.t_bj_bi.noalias() = R[j].transpose() * (P[i] - P[j]);
+                p.ricT_Rji.noalias() = ricT_RjT[j] * R[i];
+                p.R_cj_ci.noalias() = p.ricT_Rji * ric;
+                p.t_cj_ci.noalias() = ricT_RjT[j] * (Pi_tic - P[j]);
+                p.t_cj_ci -= ricT * tic;
+            }
+        }
+        ready = true;
+    }
+
+    const FramePair &pair(int i, int j) const
+    {
+        return pairs[i][j];
+    }
+
+    Eigen::Matrix3d ric, ricT;
+    Eigen::Vector3d tic;
+    Eigen::Matrix3d R[WINDOW_SIZE + 1];
+    Eigen::Vector3d P[WINDOW_SIZE + 1];
+    Eigen::Matrix3d ricT_RjT[WINDOW_SIZE + 1];//ric^T * Rj^T
+
+  private:
+    double (*para_pose)[SIZE_POSE];
+    double *para_ex_pose;
+    FramePair pairs[WINDOW_SIZE + 1][WINDOW_SIZE + 1];//只用i < j
+    bool ready;
+};
@@ -45,6 +45,14 @@ void reduceVector(vector<int> &v, vector<uchar> status)
     v.resize(j);
 }
 
+// 有金字塔时直接把金字塔传给LK，避免每次调用都重新建立
+static cv::_InputArray pyrOrImg(const vector<cv::Mat> &pyr, const cv::Mat &img)
+{
+    if (pyr.empty())
+        return cv::_InputArray(img);
+    return cv::_InputArray(pyr);
+}
+
 FeatureTracker::FeatureTracker()
 {
     stereo_cam = 0;
@@ -85,6 +93,113 @@ void FeatureTracker::setMask()
     }
 }
 
+// 网格提取: 每个格子单独检测角点，格子之间并行
+class GridDetectInvoker : public cv::ParallelLoopBody
+{
+  public:
+    GridDetectInvoker(const cv::Mat &_img, const cv::Mat &_mask, const vector<cv::Rect> &_cells,
+                      const vector<int> &_need, vector<vector<cv::Point2f>> &_cell_pts)
+        : img(_img), mask(_mask), cells(_cells), need(_need), cell_pts(_cell_pts) {}
+
+    virtual void operator()(const cv::Range &range) const
+    {
+        for (int i = range.start; i < range.end; i++)
+        {
+            cv::Mat cell_img = img(cells[i]);
+            cv::Mat cell_mask = mask(cells[i]);
+            vector<cv::Point2f> &pts = cell_pts[i];
+            if (GRID_DETECT == 2)
+            {
+                vector<cv::KeyPoint> kps;
+                cv::FAST(cell_img, kps, FAST_THRESHOLD, true);
+                sort(kps.begin(), kps.end(), [](const cv::KeyPoint &a, const cv::KeyPoint &b)
+                     {
+                        return a.response > b.response;
+                     });
+                for (auto &kp : kps)
+                {
+                    if (cell_mask.at<uchar>(kp.pt) == 0)
+                        continue;
+                    bool too_close = false;
+                    for (auto &p : pts)
+                        if (hypot(p.x - kp.pt.x, p.y - kp.pt.y) < MIN_DIST)
+                        {
+                            too_close = true;
+                            break;
+                        }
+                    if (too_close)
+                        continue;
+                    pts.push_back(kp.pt);
+                    if ((int)pts.size() >= need[i])
+                        break;
+                }
+            }
+            else
+                cv::goodFeaturesToTrack(cell_img, pts, need[i], 0.01, MIN_DIST, cell_mask);
+            for (auto &p : pts)
+            {
+                p.x += cells[i].x;
+                p.y += cells[i].y;
+            }
+        }
+    }
+
+  private:
+    const cv::Mat &img, &mask;
+    const vector<cv::Rect> &cells;
+    const vector<int> &need;
+    vector<vector<cv::Point2f>> &cell_pts;
+};
+
+// 只在已跟踪点不足配额的格子里提取新点，结果按格子轮流取，总数不超过n_max_cnt
+void FeatureTracker::detectGrid(int n_max_cnt)
+{
+    int cell_num = GRID_ROW * GRID_COL;
+    int quota = (MAX_CNT + cell_num - 1) / cell_num;
+    vector<int> cnt(cell_num, 0);
+    for (auto &p : cur_pts)
+    {
+        int r = min(GRID_ROW - 1, max(0, int(p.y * GRID_ROW / row)));
+        int c = min(GRID_COL - 1, max(0, int(p.x * GRID_COL / col)));
+        cnt[r * GRID_COL + c]++;
+    }
+
+    vector<cv::Rect> cells;
+    vector<int> need;
+    for (int r = 0; r < GRID_ROW; r++)
+        for (int c = 0; c < GRID_COL; c++)
+        {
+            int n = quota - cnt[r * GRID_COL + c];
+            if (n <= 0)
+                continue;
+            int x0 = c * col / GRID_COL, x1 = (c + 1) * col / GRID_COL;
+            int y0 = r * row / GRID_ROW, y1 = (r + 1) * row / GRID_ROW;
+            cells.push_back(cv::Rect(x0, y0, x1 - x0, y1 - y0));
+            need.push_back(n);
+        }
+
+    vector<vector<cv::Point2f>> cell_pts(cells.size());
+    cv::parallel_for_(cv::Range(0, cells.size()), GridDetectInvoker(cur_img, mask, cells, need, cell_pts));
+
+    //每个格子只在格子内保证MIN_DIST，合并时再用mask检查，去掉格子边界两侧挨得太近的点
+    n_pts.clear();
+    for (size_t k = 0; (int)n_pts.size() < n_max_cnt; k++)
+    {
+        bool remain = false;
+        for (auto &pts : cell_pts)
+            if (k < pts.size() && (int)n_pts.size() < n_max_cnt)
+            {
+                remain = true;
+                if (mask.at<uchar>(pts[k]) == 0)
+                    continue;
+                n_pts.push_back(pts[k]);
+                cv::circle(mask, pts[k], MIN_DIST, 0, -1);
+            }
+        if (!remain)
+            break;
+    }
+}
+
 double FeatureTracker::distance(cv::Point2f &pt1, cv::Point2f &pt2)
 {
     //printf("pt1: %f %f pt2: %f %f\n", pt1.x, pt1.y, pt2.x, pt2.y);
@@ -93,8 +208,64 @@ double FeatureTracker::distance(cv::Point2f &pt1, cv::Point2f &pt2)
     return sqrt(dx * dx + dy * dy);
 }
 
+// 当前帧和右目的金字塔每帧只建一次(PARALLEL_FLOW时同时建立)，
+// 上一帧的金字塔是上一次的cur_pyr，在trackImage结束时交换过来
+void FeatureTracker::buildPyramids(const cv::Mat &rightImg)
+{
+    const cv::Size win_size(21, 21);
+    const int max_level = 3;
+    bool build_right = !rightImg.empty() && stereo_cam;
+    if (build_right && PARALLEL_FLOW)
+    {
+        flowPool().parallelFor(2, [&](int i)
+        {
+            if (i == 0)
+                cv::buildOpticalFlowPyramid(rightImg, right_pyr, win_size, max_level);
+            else
+                cv::buildOpticalFlowPyramid(cur_img, cur_pyr, win_size, max_level);
+        });
+        return;
+    }
+    if (build_right)
+        cv::buildOpticalFlowPyramid(rightImg, right_pyr, win_size, max_level);
+    else
+        right_pyr.clear();
+    cv::buildOpticalFlowPyramid(cur_img, cur_pyr, win_size, max_level);
+}
+
+ThreadPool &FeatureTracker::flowPool()
+{
+    if (!flow_pool)
+        flow_pool.reset(new ThreadPool(2));
+    return *flow_pool;
+}
+
+// 左右目LK光流，FLOW_BACK时做反向检查
+void FeatureTracker::flowLeftRight(const vector<cv::Point2f> &left_pts, const cv::Mat &rightImg,
+                                   vector<cv::Point2f> &right_pts, vector<uchar> &status)
+{
+    vector<cv::Point2f> reverseLeftPts;
+    vector<uchar> statusRightLeft;
+    vector<float> err;
+    // cur left ---- cur right左右目LK光流
+    cv::calcOpticalFlowPyrLK(pyrOrImg(cur_pyr, cur_img), pyrOrImg(right_pyr, rightImg), left_pts, right_pts, status, err, cv::Size(21, 21), 3);
+    // reverse check cur right ---- cur left
+    if(FLOW_BACK)
+    {
+        cv::calcOpticalFlowPyrLK(pyrOrImg(right_pyr, rightImg), pyrOrImg(cur_pyr, cur_img), right_pts, reverseLeftPts, statusRightLeft, err, cv::Size(21, 21), 3);
+        for(size_t i = 0; i < status.size(); i++)
+        {
+            cv::Point2f left_pt = left_pts[i];
+            if(status[i] && statusRightLeft[i] && inBorder(right_pts[i]) && distance(left_pt, reverseLeftPts[i]) <= 0.5)
+                status[i] = 1;
+            else
+                status[i] = 0;
+        }
+    }
+}
+
 //输入的参数可以是两个图片或者一个图片 光流检测
-map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackImage(double _cur_time, const cv::Mat &_img, const cv::Mat &_img1)
+void FeatureTracker::trackImage(double _cur_time, const cv::Mat &_img, const cv::Mat &_img1, FeatureFrame &featureFrame)
 {
     TicToc t_r;
     cur_time = _cur_time;
@@ -116,6 +287,11 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
     }
     */
     cur_pts.clear();
+    bool track_right = !rightImg.empty() && stereo_cam;
+    map<int, cv::Point2f> tracked_right_pts;//PARALLEL_FLOW: 已跟踪点在右目中的位置
+    TicToc t_p;
+    buildPyramids(rightImg);
+    ROS_DEBUG("build pyramids costs: %fms", t_p.toc());
 
     if (prev_pts.size() > 0)// 前一帧有特征点
     {
@@ -127,7 +303,7 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
         {
             cur_pts = predict_pts;
             //光流法
-            cv::calcOpticalFlowPyrLK(prev_img, cur_img, prev_pts, cur_pts, status, err, cv::Size(21, 21), 1, 
+            cv::calcOpticalFlowPyrLK(pyrOrImg(prev_pyr, prev_img), pyrOrImg(cur_pyr, cur_img), prev_pts, cur_pts, status, err, cv::Size(21, 21), 1, 
             cv::TermCriteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS, 30, 0.01), cv::OPTFLOW_USE_INITIAL_FLOW);
             
             int succ_num = 0;
@@ -137,35 +313,59 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
                     succ_num++;
             }
             if (succ_num < 10)
-               cv::calcOpticalFlowPyrLK(prev_img, cur_img, prev_pts, cur_pts, status, err, cv::Size(21, 21), 3);
+               cv::calcOpticalFlowPyrLK(pyrOrImg(prev_pyr, prev_img), pyrOrImg(cur_pyr, cur_img), prev_pts, cur_pts, status, err, cv::Size(21, 21), 3);
         }
         else
-            cv::calcOpticalFlowPyrLK(prev_img, cur_img, prev_pts, cur_pts, status, err, cv::Size(21, 21), 3);
+            cv::calcOpticalFlowPyrLK(pyrOrImg(prev_pyr, prev_img), pyrOrImg(cur_pyr, cur_img), prev_pts, cur_pts, status, err, cv::Size(21, 21), 3);
         chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
         chrono::duration<double,milli> time_used = chrono::duration_cast<chrono::duration<double,milli>>(t2 - t1);
 //        cout<<"LK_time_used "<<time_used.count()<<"ms"<<endl;
-        // reverse check
-        if(FLOW_BACK)//执行向前和向后的光流以提高特征跟踪精度
+
+        // PARALLEL_FLOW: 每个点的LK相互独立，已跟踪点的左右目光流和反向检查同时计算
+        vector<cv::Point2f> stereo_right_pts;
+        vector<uchar> stereo_status;
+        bool parallel_right = PARALLEL_FLOW && track_right;
+        auto checkTrack = [&]()
         {
-            vector<uchar> reverse_status;//反向计算一次光流
-            vector<cv::Point2f> reverse_pts = prev_pts;
-            cv::calcOpticalFlowPyrLK(cur_img, prev_img, cur_pts, reverse_pts, reverse_status, err, cv::Size(21, 21), 1, 
-            cv::TermCriteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS, 30, 0.01), cv::OPTFLOW_USE_INITIAL_FLOW);
-            //cv::calcOpticalFlowPyrLK(cur_img, prev_img, cur_pts, reverse_pts, reverse_status, err, cv::Size(21, 21), 3); 
-            for(size_t i = 0; i < status.size(); i++)
+            // reverse check
+            if(FLOW_BACK)//执行向前和向后的光流以提高特征跟踪精度
             {
-                if(status[i] && reverse_status[i] && distance(prev_pts[i], reverse_pts[i]) <= 0.5)
+                vector<uchar> reverse_status;//反向计算一次光流
+                vector<cv::Point2f> reverse_pts = prev_pts;
+                vector<float> reverse_err;
+                cv::calcOpticalFlowPyrLK(pyrOrImg(cur_pyr, cur_img), pyrOrImg(prev_pyr, prev_img), cur_pts, reverse_pts, reverse_status, reverse_err, cv::Size(21, 21), 1, 
+                cv::TermCriteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS, 30, 0.01), cv::OPTFLOW_USE_INITIAL_FLOW);
+                //cv::calcOpticalFlowPyrLK(cur_img, prev_img, cur_pts, reverse_pts, reverse_status, err, cv::Size(21, 21), 3); 
+                for(size_t i = 0; i < status.size(); i++)
                 {
-                    status[i] = 1;
+                    if(status[i] && reverse_status[i] && distance(prev_pts[i], reverse_pts[i]) <= 0.5)
+                    {
+                        status[i] = 1;
+                    }
+                    else
+                        status[i] = 0;
                 }
-                else
-                    status[i] = 0;
             }
+
+            for (int i = 0; i < int(cur_pts.size()); i++)// 将当前帧跟踪的位于图像边界外的点标记为0
+                if (status[i] && !inBorder(cur_pts[i]))
+                    status[i] = 0;
+        };
+        if (parallel_right)
+        {
+            flowPool().parallelFor(2, [&](int i)
+            {
+                if (i == 0)
+                    flowLeftRight(cur_pts, rightImg, stereo_right_pts, stereo_status);
+                else
+                    checkTrack();
+            });
+            for (size_t i = 0; i < status.size(); i++)
+                if (status[i] && stereo_status[i])
+                    tracked_right_pts[ids[i]] = stereo_right_pts[i];
         }
-        
-        for (int i = 0; i < int(cur_pts.size()); i++)// 将当前帧跟踪的位于图像边界外的点标记为0
-            if (status[i] && !inBorder(cur_pts[i]))
-                status[i] = 0;
+        else
+            checkTrack();
         // 4. 根据status,把跟踪失败的点剔除
         //从当前帧数据prev_pts和cur_pts中剔除
         //prev_pts和cur_pts中的特征点是一一对应的
@@ -201,7 +401,10 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
             if (mask.type() != CV_8UC1)
                 cout << "mask type wrong " << endl;
             //角点检测，之前已经检测到的，使用mask屏蔽掉，不检测。因此检测到的都是新特征点
-            cv::goodFeaturesToTrack(cur_img, n_pts, MAX_CNT - cur_pts.size(), 0.01, MIN_DIST, mask);
+            if (GRID_DETECT)
+                detectGrid(n_max_cnt);
+            else
+                cv::goodFeaturesToTrack(cur_img, n_pts, MAX_CNT - cur_pts.size(), 0.01, MIN_DIST, mask);
          /**
          *void cv::goodFeaturesToTrack(    在mask中不为0的区域检测新的特征点
          *   InputArray  image,              输入图像
@@ -220,7 +423,7 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
             n_pts.clear();
         chrono::steady_clock::time_point t2_track = chrono::steady_clock::now();
         chrono::duration<double,milli> time_used_track  = chrono::duration_cast<chrono::duration<double,milli>>(t2_track - t1_track);
-        if(SHOW_MESSAGE)
+        if(DIAG(DIAG_MESSAGE))
             cout<<"track _time_used "<<time_used_track.count()<<"ms"<<endl;
         ROS_DEBUG("detect feature costs: %f ms", t_t.toc());
         for (auto &p : n_pts)//addPoints()向cur_pts添加新的追踪点
@@ -242,26 +445,49 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
         cur_un_right_pts.clear();
         right_pts_velocity.clear();
         cur_un_right_pts_map.clear();
-        if(!cur_pts.empty())
+        if(!cur_pts.empty() && PARALLEL_FLOW)
         {
-            //printf("stereo image; track feature on right image\n");
-            vector<cv::Point2f> reverseLeftPts;
-            vector<uchar> status, statusRightLeft;
-            vector<float> err;
-            // cur left ---- cur right左右目LK光流
-            cv::calcOpticalFlowPyrLK(cur_img, rightImg, cur_pts, cur_right_pts, status, err, cv::Size(21, 21), 3);
-            // reverse check cur right ---- cur left
-            if(FLOW_BACK)
+            // 已跟踪点的右目结果前面已经算好，这里只跟踪新提取的点
+            vector<cv::Point2f> new_pts, new_right_pts;
+            vector<int> new_index;
+            vector<uchar> status;
+            for (size_t i = 0; i < cur_pts.size(); i++)
+                if (track_cnt[i] == 1)
+                {
+                    new_pts.push_back(cur_pts[i]);
+                    new_index.push_back(i);
+                }
+            if (!new_pts.empty())
+                flowLeftRight(new_pts, rightImg, new_right_pts, status);
+            vector<cv::Point2f> right_of_new(cur_pts.size());
+            vector<uchar> new_ok(cur_pts.size(), 0);
+            for (size_t k = 0; k < new_index.size(); k++)
             {
-                cv::calcOpticalFlowPyrLK(rightImg, cur_img, cur_right_pts, reverseLeftPts, statusRightLeft, err, cv::Size(21, 21), 3);
-                for(size_t i = 0; i < status.size(); i++)
+                right_of_new[new_index[k]] = new_right_pts[k];
+                new_ok[new_index[k]] = status[k];
+            }
+            for (size_t i = 0; i < cur_pts.size(); i++)
+            {
+                auto it = tracked_right_pts.find(ids[i]);
+                if (track_cnt[i] > 1 && it != tracked_right_pts.end())
                 {
-                    if(status[i] && statusRightLeft[i] && inBorder(cur_right_pts[i]) && distance(cur_pts[i], reverseLeftPts[i]) <= 0.5)
-                        status[i] = 1;
-                    else
-                        status[i] = 0;
+                    cur_right_pts.push_back(it->second);
+                    ids_right.push_back(ids[i]);
+                }
+                else if (track_cnt[i] == 1 && new_ok[i])
+                {
+                    cur_right_pts.push_back(right_of_new[i]);
+                    ids_right.push_back(ids[i]);
                 }
             }
+            cur_un_right_pts = undistortedPts(cur_right_pts, m_camera[1]);
+            right_pts_velocity = ptsVelocity(ids_right, cur_un_right_pts, cur_un_right_pts_map, prev_un_right_pts_map);
+        }
+        else if(!cur_pts.empty())
+        {
+            //printf("stereo image; track feature on right image\n");
+            vector<uchar> status;
+            flowLeftRight(cur_pts, rightImg, cur_right_pts, status);
 
             ids_right = ids;
             reduceVector(cur_right_pts, status);
@@ -289,6 +515,7 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
     // 更新帧、特征点
     //当下一帧图像到来时，当前帧数据就成为了上一帧发布的数据
     prev_img = cur_img;
+    prev_pyr.swap(cur_pyr);//当前帧金字塔留给下一帧用，交换后cur_pyr的内存在下一帧复用
     prev_pts = cur_pts;
     prev_un_pts = cur_un_pts;
     prev_un_pts_map = cur_un_pts_map;
@@ -299,7 +526,9 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
     for(size_t i = 0; i < cur_pts.size(); i++)
         prevLeftPtsMap[ids[i]] = cur_pts[i];
 
-    map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> featureFrame;
+    //featureFrame由调用者从FeatureFramePool取得，这里只往里面填数据
+    featureFrame.clear();
+    featureFrame.t = cur_time;
     for (size_t i = 0; i < ids.size(); i++)
     {
         int feature_id = ids[i];
@@ -317,7 +546,7 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
 
         Eigen::Matrix<double, 7, 1> xyz_uv_velocity;
         xyz_uv_velocity << x, y, z, p_u, p_v, velocity_x, velocity_y;
-        featureFrame[feature_id].emplace_back(camera_id,  xyz_uv_velocity);
+        featureFrame.push_back(feature_id, camera_id, xyz_uv_velocity);
         //cout<<feature_id<<" "<<endl;
     }
 
@@ -340,12 +569,12 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
 
             Eigen::Matrix<double, 7, 1> xyz_uv_velocity;
             xyz_uv_velocity << x, y, z, p_u, p_v, velocity_x, velocity_y;
-            featureFrame[feature_id].emplace_back(camera_id,  xyz_uv_velocity);
+            featureFrame.push_back(feature_id, camera_id, xyz_uv_velocity);
         }
     }
+    featureFrame.sortById();//同一个id的左右目观测相邻，按id升序
 
     //printf("feature track whole time %f\n", t_r.toc());
-    return featureFrame;
 }
 
 void FeatureTracker::rejectWithF()
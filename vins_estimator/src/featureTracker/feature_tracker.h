@@ -14,6 +14,8 @@
 #include <cstdio>
 #include <iostream>
 #include <queue>
+#include <thread>
+#include <memory>
 #include <execinfo.h>
 #include <csignal>
 #include <opencv2/opencv.hpp>
@@ -23,7 +25,9 @@
 #include "camodocal/camera_models/CataCamera.h"
 #include "camodocal/camera_models/PinholeCamera.h"
 #include "../estimator/parameters.h"
+#include "../estimator/feature_frame.h"
 #include "../utility/tic_toc.h"
+#include "vins_common/thread_pool.h"
 
 using namespace std;
 using namespace camodocal;
@@ -37,8 +41,9 @@ class FeatureTracker
 {
 public:
     FeatureTracker();
-    map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> trackImage(double _cur_time, const cv::Mat &_img, const cv::Mat &_img1 = cv::Mat());
+    void trackImage(double _cur_time, const cv::Mat &_img, const cv::Mat &_img1, FeatureFrame &featureFrame);
     void setMask();
+    void detectGrid(int n_max_cnt);
     void readIntrinsicParameter(const vector<string> &calib_file);
     void showUndistortion(const string &name);
     void rejectWithF();
@@ -63,12 +68,17 @@ public:
     void removeOutliers(set<int> &removePtsIds);
     cv::Mat getTrackImage();
     bool inBorder(const cv::Point2f &pt);
+    void buildPyramids(const cv::Mat &rightImg);
+    void flowLeftRight(const vector<cv::Point2f> &left_pts, const cv::Mat &rightImg,
+                       vector<cv::Point2f> &right_pts, vector<uchar> &status);
+    ThreadPool &flowPool();
 
     int row, col;
     cv::Mat imTrack;
     cv::Mat mask;
     cv::Mat fisheye_mask;
     cv::Mat prev_img, cur_img;
+    vector<cv::Mat> prev_pyr, cur_pyr, right_pyr;//缓存的LK光流金字塔
     cv::Mat prev_ing_test_q;
     vector<cv::Point2f> n_pts;
     vector<cv::Point2f> predict_pts;
@@ -87,4 +97,5 @@ public:
     bool stereo_cam;
     int n_id;
     bool hasPrediction;
+    std::unique_ptr<ThreadPool> flow_pool;//PARALLEL_FLOW用的常驻线程，第一次用到时创建
 };
@@ -26,11 +26,10 @@ class ImageFrame
 {
     public:
         ImageFrame(){};
-        ImageFrame(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>>& _points, double _t):t{_t},is_key_frame{false}
+        ImageFrame(const FeatureFrame& _points, double _t):points{_points},t{_t},is_key_frame{false}
         {
-            points = _points;
         };
-        map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>> > > points;
+        FeatureFrame points;
         double t;
         Matrix3d R;
         Vector3d T;
@@ -151,7 +151,8 @@ void imu_callback(const sensor_msgs::ImuConstPtr &imu_msg)
 //特征
 void feature_callback(const sensor_msgs::PointCloudConstPtr &feature_msg)
 {
-    map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> featureFrame;
+    static FeatureFrame featureFrame;//回调在同一个线程里，复用内存
+    featureFrame.clear();
     for (unsigned int i = 0; i < feature_msg->points.size(); i++)
     {
         int feature_id = feature_msg->channels[0].values[i];
@@ -174,7 +175,7 @@ void feature_callback(const sensor_msgs::PointCloudConstPtr &feature_msg)
         ROS_ASSERT(z == 1);
         Eigen::Matrix<double, 7, 1> xyz_uv_velocity;
         xyz_uv_velocity << x, y, z, p_u, p_v, velocity_x, velocity_y;
-        featureFrame[feature_id].emplace_back(camera_id,  xyz_uv_velocity);
+        featureFrame.push_back(feature_id, camera_id, xyz_uv_velocity);
     }
     double t = feature_msg->header.stamp.toSec();
     estimator.inputFeature(t, featureFrame);
@@ -186,8 +187,7 @@ void restart_callback(const std_msgs::BoolConstPtr &restart_msg)
     if (restart_msg->data == true)
     {
         ROS_WARN("restart the estimator!");
-        estimator.clearState();
-        estimator.setParameter();
+        estimator.requestRestart();
     }
     return;
 }
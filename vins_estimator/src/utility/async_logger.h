@@ -0,0 +1,216 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <initializer_list>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include "ring_buffer.h"
+
+const int LOG_RECORD_SIZE = 16;
+
+// 一行记录: 最多LOG_RECORD_SIZE个数，格式化和写文件都在后台线程做
+struct LogRecord
+{
+    int file;
+    int n;//n < 0 表示清空文件
+    uint32_t int_mask;//第i位为1时第i列按precision(0)输出(计数、帧号等)
+    double v[LOG_RECORD_SIZE];
+};
+
+// 后台写文件，求解线程只往环形缓冲区里放定长记录，不做格式化也不碰文件。
+// 后台线程定时或缓冲区过半时把积攒的记录一次性写出并fflush。
+// 文本格式与原来ofstream(fixed)输出一致；binary模式下每行写成 int32 n + n个double，文件名加.bin
+class AsyncLogger
+{
+  public:
+    explicit AsyncLogger(size_t capacity = 4096) : buf(capacity), stop(false)
+    {
+        writer = std::thread(&AsyncLogger::process, this);
+    }
+
+    ~AsyncLogger()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stop = true;
+        }
+        con.notify_one();
+        writer.join();
+        drain();
+        for (auto &f : files)
+            if (f.fp)
+                fclose(f.fp);
+        if (buf.dropped() > 0)
+            printf("async logger dropped %zu records\n", buf.dropped());
+    }
+
+    // 注册文件，同一路径返回同一个编号。文件由后台线程在第一次写时打开
+    // labels[i]非空时打印在第i列前面(例如"Ps: ")
+    int open(const std::string &path, bool append, int precision, const std::string &sep = ",",
+             bool trailing_sep = true, bool binary = false, const std::vector<std::string> &labels = std::vector<std::string>())
+    {
+        std::lock_guard<std::mutex> lock(m);
+        std::string real_path = binary ? path + ".bin" : path;
+        for (size_t i = 0; i < files.size(); i++)
+            if (files[i].path == real_path)
+                return i;
+        LogFile f;
+        f.path = real_path;
+        f.append = append;
+        f.precision = precision;
+        f.sep = sep;
+        f.trailing_sep = trailing_sep;
+        f.binary = binary;
+        f.labels = labels;
+        f.fp = nullptr;
+        files.push_back(f);
+        return files.size() - 1;
+    }
+
+    // 以下可以在任意线程调用，只拷贝一条定长记录
+    void write(int file, const double *v, int n, uint32_t int_mask = 0)
+    {
+        LogRecord rec;
+        rec.file = file;
+        rec.n = n < LOG_RECORD_SIZE ? n : LOG_RECORD_SIZE;
+        rec.int_mask = int_mask;
+        for (int i = 0; i < rec.n; i++)
+            rec.v[i] = v[i];
+        push(rec);
+    }
+
+    void write(int file, std::initializer_list<double> v, uint32_t int_mask = 0)
+    {
+        write(file, v.begin(), v.size(), int_mask);
+    }
+
+    // 清空文件，之后的记录从头写
+    void truncate(int file)
+    {
+        LogRecord rec;
+        rec.file = file;
+        rec.n = -1;
+        rec.int_mask = 0;
+        push(rec);
+    }
+
+  private:
+    struct LogFile
+    {
+        std::string path;
+        bool append;
+        int precision;
+        std::string sep;
+        bool trailing_sep;
+        bool binary;
+        std::vector<std::string> labels;
+        FILE *fp;
+        std::string pending;//本批次待写的内容
+    };
+
+    void push(const LogRecord &rec)
+    {
+        size_t size;
+        {
+            std::lock_guard<std::mutex> lock(m_push);//环形缓冲区只支持单生产者
+            buf.push(rec);
+            size = buf.size();
+        }
+        if (size * 2 >= buf.capacity())
+            con.notify_one();
+    }
+
+    void process()
+    {
+        while (1)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m);
+                con.wait_for(lock, std::chrono::milliseconds(200));
+                if (stop)
+                    return;
+            }
+            drain();
+        }
+    }
+
+    void drain()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        char tmp[64];
+        while (!buf.empty())
+        {
+            const LogRecord &rec = buf.front();
+            if (rec.file < 0 || rec.file >= (int)files.size())
+            {
+                buf.pop();
+                continue;
+            }
+            LogFile &f = files[rec.file];
+            if (rec.n < 0)
+            {
+                f.pending.clear();
+                if (f.fp)
+                    fclose(f.fp);
+                f.fp = fopen(f.path.c_str(), f.binary ? "wb" : "w");
+            }
+            else if (f.binary)
+            {
+                int32_t n = rec.n;
+                f.pending.append(reinterpret_cast<const char *>(&n), sizeof(n));
+                f.pending.append(reinterpret_cast<const char *>(rec.v), sizeof(double) * rec.n);
+            }
+            else
+            {
+                for (int i = 0; i < rec.n; i++)
+                {
+                    if (i < (int)f.labels.size())
+                        f.pending += f.labels[i];
+                    snprintf(tmp, sizeof(tmp), "%.*f", (rec.int_mask >> i & 1) ? 0 : f.precision, rec.v[i]);
+                    f.pending += tmp;
+                    if (i + 1 < rec.n || f.trailing_sep)
+                        f.pending += f.sep;
+                }
+                f.pending += '\n';
+            }
+            buf.pop();
+        }
+
+        for (auto &f : files)
+        {
+            if (f.pending.empty())
+                continue;
+            if (!f.fp)
+                f.fp = fopen(f.path.c_str(), f.append ? (f.binary ? "ab" : "a") : (f.binary ? "wb" : "w"));
+            if (f.fp)
+            {
+                fwrite(f.pending.data(), 1, f.pending.size(), f.fp);
+                fflush(f.fp);
+            }
+            f.pending.clear();
+        }
+    }
+
+    RingBuffer<LogRecord> buf;
+    std::mutex m_push;
+    std::mutex m;//files和后台线程
+    std::condition_variable con;
+    std::vector<LogFile> files;
+    std::thread writer;
+    bool stop;
+};
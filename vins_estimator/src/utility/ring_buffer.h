@@ -0,0 +1,118 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// 单生产者单消费者的无锁环形缓冲区，容量固定(取2的幂)，构造后不再分配内存。
+// push只能由生产者线程调用，front/pop/span等只能由消费者线程调用。
+// 消费者持有的元素和Span在pop之前不会被生产者覆盖。
+template <typename T>
+class RingBuffer
+{
+  public:
+    // 连续时间段的只读视图，不拷贝数据
+    class Span
+    {
+      public:
+        Span() : buf(nullptr), first(0), len(0) {}
+        Span(const RingBuffer *_buf, size_t _first, size_t _len) : buf(_buf), first(_first), len(_len) {}
+
+        const T &operator[](size_t i) const { return buf->at(first + i); }
+        const T &front() const { return (*this)[0]; }
+        const T &back() const { return (*this)[len - 1]; }
+        size_t size() const { return len; }
+        bool empty() const { return len == 0; }
+
+      private:
+        const RingBuffer *buf;
+        size_t first, len;
+    };
+
+    explicit RingBuffer(size_t capacity)
+    {
+        reset(capacity);
+    }
+
+    // 重新分配容量并清空，只能在生产者和消费者都还没开始用的时候调用
+    void reset(size_t capacity)
+    {
+        size_t n = 1;
+        while (n < capacity)
+            n <<= 1;
+        data.assign(n, T());
+        mask = n - 1;
+        head.store(0);
+        tail.store(0);
+        drop_cnt.store(0);
+    }
+
+    // 生产者: 满时丢弃新数据并返回false，不会阻塞
+    bool push(const T &value)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) > mask)
+        {
+            drop_cnt.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        data[h & mask] = value;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 以下为消费者接口
+    bool empty() const
+    {
+        return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+    }
+
+    size_t size() const
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+    }
+
+    const T &front() const { return at(0); }
+    const T &back() const { return at(size() - 1); }
+
+    // 距队头第i个元素
+    const T &at(size_t i) const
+    {
+        return data[(tail.load(std::memory_order_relaxed) + i) & mask];
+    }
+    const T &operator[](size_t i) const { return at(i); }
+
+    // 消费者在pop之前可以修改自己持有的元素(例如提前释放资源)
+    T &front() { return data[tail.load(std::memory_order_relaxed) & mask]; }
+
+    void pop(size_t n = 1)
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    void clear()
+    {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    Span span(size_t first, size_t len) const { return Span(this, first, len); }
+
+    size_t capacity() const { return mask + 1; }
+    size_t dropped() const { return drop_cnt.load(std::memory_order_relaxed); }
+
+  private:
+    std::vector<T> data;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;//生产者写
+    alignas(64) std::atomic<size_t> tail;//消费者写
+    std::atomic<size_t> drop_cnt;
+};
@@ -36,3 +36,27 @@ class TicToc
   private:
     std::chrono::time_point<std::chrono::system_clock> start, end;
 };
+
+// 耗时统计: 最近一次/平均/最大 (ms)
+class TimeStat
+{
+  public:
+    TimeStat() : last(0), sum(0), max(0), cnt(0) {}
+
+    void add(double t)
+    {
+        last = t;
+        sum += t;
+        if (t > max)
+            max = t;
+        cnt++;
+    }
+
+    double average() const
+    {
+        return cnt > 0 ? sum / cnt : 0;
+    }
+
+    double last, sum, max;
+    int cnt;
+};
@@ -114,6 +114,27 @@ void printStatistics(const Estimator &estimator, double t)
     sum_of_calculation++;
     ROS_DEBUG("vo solver costs: %f ms", t);
     ROS_DEBUG("average of time %f ms", sum_of_time / sum_of_calculation);
+    ROS_DEBUG("wait feature %f ms imu %f ms wheels %f ms", estimator.wait_feature_stat.last,
+              estimator.wait_imu_stat.last, estimator.wait_wheels_stat.last);
+    ROS_DEBUG("average wait feature %f ms imu %f ms wheels %f ms", estimator.wait_feature_stat.average(),
+              estimator.wait_imu_stat.average(), estimator.wait_wheels_stat.average());
+    ROS_DEBUG("process %f ms average %f ms max %f ms", estimator.process_stat.last,
+              estimator.process_stat.average(), estimator.process_stat.max);
+    if (PIPELINE)
+    {
+        TimeStat image_queue, input_stall, track, track_stall;
+        estimator.getTrackStats(image_queue, input_stall, track, track_stall);
+        ROS_DEBUG("pipeline image queue %f ms input stall %f ms track %f ms track stall %f ms",
+                  image_queue.average(), input_stall.average(), track.average(), track_stall.average());
+        ROS_DEBUG("pipeline max track %f ms max track stall %f ms", track.max, track_stall.max);
+    }
+    ROS_DEBUG("budget %f ms solver time %f ms landmarks %d (limit %d) solve %f ms marg %f ms missed %d/%d",
+              estimator.budget.frameDeadline(), estimator.budget.last_solver_time * 1000, estimator.opt_feature_cnt,
+              estimator.budget.featureBudget(), estimator.solve_stat.average(), estimator.margin_stat.average(),
+              estimator.budget.miss_cnt, estimator.budget.frame_cnt);
+    if (USE_IMU)
+        ROS_DEBUG("preintegration repropagated on bias drift %d times, blocks allocated %d in use %d",
+                  estimator.bias_repropagate_cnt, estimator.integration_pool.allocCount(), estimator.integration_pool.inUse());
 
     sum_of_path += (estimator.Ps[WINDOW_SIZE] - last_path).norm();
     last_path = estimator.Ps[WINDOW_SIZE];
@@ -154,26 +175,14 @@ void pubOdometry(const Estimator &estimator, const std_msgs::Header &header)
         pub_path.publish(path);
 
         // write result to file
-        ofstream foutC(VINS_RESULT_PATH, ios::app);
-        foutC.setf(ios::fixed, ios::floatfield);
-        foutC.precision(0);
-        foutC << header.stamp.toSec()  << ",";
-        foutC.precision(5);
-        foutC <<"Ps: "<<estimator.Ps[WINDOW_SIZE].x() << ","
-              << estimator.Ps[WINDOW_SIZE].y() << ","
-              << estimator.Ps[WINDOW_SIZE].z() << ","
-              <<"tmp_Q: "<< tmp_Q.w() << ","
-              << tmp_Q.x() << ","
-              << tmp_Q.y() << ","
-              << tmp_Q.z() << ","
-              <<"Vs: "<< estimator.Vs[WINDOW_SIZE].x() << ","
-              << estimator.Vs[WINDOW_SIZE].y() << ","
-              << estimator.Vs[WINDOW_SIZE].z() << ","
-//              << -0.003172<<","<<0.021267<<","<<0.078502<<","<<-0.025266<<","<<0.136696<<","<<0.075593//自己加的，为了凑够euroc数据格式
-                << endl;
-        foutC.close();
+        estimator.logger.write(estimator.log_odometry,
+                               {header.stamp.toSec(),
+                                estimator.Ps[WINDOW_SIZE].x(), estimator.Ps[WINDOW_SIZE].y(), estimator.Ps[WINDOW_SIZE].z(),
+                                tmp_Q.w(), tmp_Q.x(), tmp_Q.y(), tmp_Q.z(),
+                                estimator.Vs[WINDOW_SIZE].x(), estimator.Vs[WINDOW_SIZE].y(), estimator.Vs[WINDOW_SIZE].z()},
+                               1u);
         Eigen::Vector3d tmp_T = estimator.Ps[WINDOW_SIZE];
-        if(SHOW_MESSAGE)
+        if(DIAG(DIAG_MESSAGE))
         {
             printf("time: %f, t: %f %f %f q: %f %f %f %f \n", header.stamp.toSec(), tmp_T.x(), tmp_T.y(), tmp_T.z(),
                    tmp_Q.w(), tmp_Q.x(), tmp_Q.y(), tmp_Q.z());